@@ -6,10 +6,6 @@ ifdef component_compile_rules
     $(error Please include wolfssl component prior to homekit)
     endif
 
-    ifndef cJSON_ROOT
-    $(error Please include cJSON component prior to homekit)
-    endif
-
     ifndef http-parser_ROOT
     $(error Please include http-parser component prior to homekit)
     endif
@@ -17,7 +13,7 @@ ifdef component_compile_rules
     # Base flash address where persisted information (e.g. pairings) will be stored
     HOMEKIT_SPI_FLASH_BASE_ADDR ?= 0x100000
     # Maximum number of simultaneous clients allowed.
-    # Each connected client requires ~1100-1200 bytes of RAM.
+    # Each connected client requires ~2100-2200 bytes of RAM.
     HOMEKIT_MAX_CLIENTS ?= 16
     # Set to 1 to enable WolfSSL low resources, saving about 70KB in firmware size,
     # but increasing pair verify time from 1 to 7 secs (Without overclocking).
@@ -80,7 +76,7 @@ ifdef component_compile_rules
 
 else
     # ESP_IDF
-    COMPONENT_DEPENDS = wolfssl cJSON http-parser
+    COMPONENT_DEPENDS = wolfssl http-parser
 
     COMPONENT_PRIV_INCLUDEDIRS = src
     COMPONENT_SRCDIRS = src
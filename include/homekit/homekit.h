@@ -17,6 +17,14 @@ typedef enum {
     HOMEKIT_EVENT_PAIRING_REMOVED,
 } homekit_event_t;
 
+typedef enum {
+    HOMEKIT_LOG_NONE = 0,
+    HOMEKIT_LOG_ERROR,
+    HOMEKIT_LOG_INFO,
+    // Debug messages are only available when built with HOMEKIT_DEBUG
+    HOMEKIT_LOG_DEBUG,
+} homekit_log_level_t;
+
 
 typedef struct {
     // Pointer to an array of homekit_accessory_t pointers.
@@ -33,6 +41,8 @@ typedef struct {
     // field must contain pointer to a function that should
     // somehow communicate password to the user (e.g. display
     // it on a screen if accessory has one).
+    // password_callback is called from pair setup, which
+    // runs on a separate crypto task.
     char *password;
     void (*password_callback)(const char *password);
 
@@ -43,6 +53,7 @@ typedef struct {
     // Callback for "POST /resource" to get snapshot image from camera
     void (*on_resource)(const char *body, size_t body_size);
 
+    // Called from server task
     void (*on_event)(homekit_event_t event);
 } homekit_server_config_t;
 
@@ -56,9 +67,16 @@ void homekit_server_init(homekit_server_config_t *config);
 // Reset HomeKit accessory server, removing all pairings
 void homekit_server_reset();
 
+// Set verbosity of server log output. Can be changed at any time.
+void homekit_set_log_level(homekit_log_level_t level);
+
 int  homekit_get_accessory_id(char *buffer, size_t size);
 bool homekit_is_paired();
 
+// Reports value of a characteristic which getter_async returned false.
+// Can be called from any task.
+void homekit_characteristic_getter_complete(homekit_characteristic_t *ch, homekit_value_t value);
+
 // Client related stuff
 homekit_client_id_t homekit_get_client_id();
 
@@ -1,6 +1,9 @@
 #ifndef __TLV_H__
 #define __TLV_H__
 
+#include <stdbool.h>
+#include <stddef.h>
+
 typedef unsigned char byte;
 
 typedef struct _tlv {
@@ -11,12 +14,19 @@ typedef struct _tlv {
 } tlv_t;
 
 
+struct _arena;
+
 typedef struct {
     tlv_t *head;
+    // If set, list nodes and values are allocated from it
+    struct _arena *arena;
 } tlv_values_t;
 
 
 tlv_values_t *tlv_new();
+// Creates TLV list allocated from given arena. Memory is released
+// when arena is reset, tlv_free() does nothing for such lists.
+tlv_values_t *tlv_new_in(struct _arena *arena);
 
 void tlv_free(tlv_values_t *values);
 
@@ -29,8 +39,90 @@ tlv_t *tlv_get_value(const tlv_values_t *values, byte type);
 int tlv_get_integer_value(const tlv_values_t *values, byte type, int def);
 tlv_values_t *tlv_get_tlv_value(const tlv_values_t *values, byte type);
 
+// Returns number of bytes value of given size takes when encoded,
+// including headers of all its fragments
+size_t tlv_encoded_size(size_t size);
+
 int tlv_format(const tlv_values_t *values, byte *buffer, size_t *size);
 
 int tlv_parse(const byte *buffer, size_t length, tlv_values_t *values);
 
+
+// Location of TLV item inside parsed buffer. Values longer than 255 bytes
+// are split into consecutive fragments of the same type: offset is where
+// data of the first fragment starts and size is total size of all fragments.
+typedef struct {
+    byte type;
+    bool fragmented;
+    size_t offset;
+    size_t size;
+} tlv_item_t;
+
+// Zero-copy TLV reader. Items are indexed into storage provided by caller,
+// values stay in the original buffer, which should outlive the reader.
+typedef struct {
+    const byte *buffer;
+    size_t length;
+
+    tlv_item_t *items;
+    size_t count;
+} tlv_reader_t;
+
+// Value of TLV item, points either into parsed buffer or to reassembled
+// fragments
+typedef struct {
+    const byte *value;
+    size_t size;
+} tlv_view_t;
+
+// Indexes items of buffer. Returns -1 if buffer is malformed or has more
+// than max_items items.
+int tlv_reader_init(tlv_reader_t *reader, const byte *buffer, size_t length, tlv_item_t *items, size_t max_items);
+
+const tlv_item_t *tlv_reader_find(const tlv_reader_t *reader, byte type);
+int tlv_reader_get_integer(const tlv_reader_t *reader, byte type, int def);
+
+// Copies value of item to buffer of at least item->size bytes,
+// joining fragments
+void tlv_reader_copy(const tlv_reader_t *reader, const tlv_item_t *item, byte *buffer);
+
+// Resolves value of item with given type. Fragmented values are reassembled
+// into memory allocated from given arena (or with malloc() if it is NULL,
+// then caller should free view->value if item->fragmented).
+// Returns false if there is no such item or memory can not be allocated.
+bool tlv_reader_get(const tlv_reader_t *reader, byte type, tlv_view_t *view, struct _arena *arena);
+
+
+// Writes TLV items straight into a buffer, splitting values longer than
+// 255 bytes into fragments. Writes that do not fit set overflow flag
+// and are dropped, so it is enough to check it once at the end.
+typedef struct {
+    byte *buffer;
+    size_t size;
+    size_t length;
+
+    bool overflow;
+} tlv_writer_t;
+
+// Writer over NULL buffer (e.g. failed allocation) overflows on first write
+void tlv_writer_init(tlv_writer_t *writer, byte *buffer, size_t size);
+
+int tlv_writer_add_value(tlv_writer_t *writer, byte type, const byte *value, size_t size);
+int tlv_writer_add_string(tlv_writer_t *writer, byte type, const char *value);
+int tlv_writer_add_integer(tlv_writer_t *writer, byte type, size_t size, int value);
+
+// Starts item with value produced in place: either nested items added
+// after this call or raw data written to tlv_writer_reserve() memory.
+// Returns mark to pass to tlv_writer_end(). Items can be nested.
+size_t tlv_writer_begin(tlv_writer_t *writer, byte type);
+// Completes item started with tlv_writer_begin(), fragmenting its value
+// in place if needed. Needs 2 bytes of room per extra fragment.
+int tlv_writer_end(tlv_writer_t *writer, size_t mark);
+
+// Appends given number of bytes to current item and returns pointer
+// to them, NULL if they do not fit
+byte *tlv_writer_reserve(tlv_writer_t *writer, size_t size);
+// Returns value of item started with tlv_writer_begin() written so far
+byte *tlv_writer_value(const tlv_writer_t *writer, size_t mark, size_t *size);
+
 #endif // __TLV_H__
@@ -80,9 +80,22 @@ typedef struct _homekit_service homekit_service_t;
 typedef struct _homekit_characteristic homekit_characteristic_t;
 
 
+// Maximum size of string (including terminating NUL)
+// stored inside value by homekit_value_copy_compact()
+#define HOMEKIT_VALUE_INLINE_SIZE 12
+
+// String, TLV and data values can be static (not owned by value),
+// owned by value (freed when value is destructed) or shared. Shared
+// values live in immutable reference counted buffers, copying them
+// only increments reference count. Server keeps shared copies
+// internally, values of characteristics stay owned. Data values
+// are never freed unless shared.
 typedef struct {
     bool is_null : 1;
     bool is_static : 1;
+    bool is_shared : 1;
+    // String is stored in inline_value, string_value is not valid
+    bool is_inline : 1;
     homekit_format_t format : 6;
     union {
         bool bool_value;
@@ -90,12 +103,29 @@ typedef struct {
         float float_value;
         char *string_value;
         tlv_values_t *tlv_values;
-        // data
+        struct {
+            uint8_t *data_value;
+            size_t data_size;
+        };
+        char inline_value[HOMEKIT_VALUE_INLINE_SIZE];
     };
 } homekit_value_t;
 
+#ifndef __cplusplus
+// Value is embedded into every characteristic, event and read
+_Static_assert(sizeof(void*) != 4 || sizeof(homekit_value_t) <= 16,
+               "homekit_value_t should not exceed 16 bytes");
+#endif
+
 bool homekit_value_equal(homekit_value_t *a, homekit_value_t *b);
+// Copies value, strings and TLVs are duplicated into memory owned by copy
 void homekit_value_copy(homekit_value_t *dst, homekit_value_t *src);
+// Copies value for internal use: short strings are stored inside value
+// without allocating memory, other strings, TLVs and data are shared.
+// String of such copy can only be accessed with homekit_value_string().
+void homekit_value_copy_compact(homekit_value_t *dst, homekit_value_t *src);
+// Returns string of string value regardless of where it is stored
+const char *homekit_value_string(const homekit_value_t *value);
 homekit_value_t *homekit_value_clone(homekit_value_t *value);
 void homekit_value_destruct(homekit_value_t *value);
 void homekit_value_free(homekit_value_t *value);
@@ -140,11 +170,9 @@ void homekit_value_free(homekit_value_t *value);
 #define HOMEKIT_TLV_(value, ...) \
     {.format=homekit_format_tlv, .tlv_values=(value), ##__VA_ARGS__}
 #define HOMEKIT_TLV(value, ...) (homekit_value_t) HOMEKIT_TLV_(value, ##__VA_ARGS__)
-/*
-#define HOMEKIT_DATA_(value, ...) \
-    {.format=homekit_format_data, .data_value=(value), ##__VA_ARGS__}
-#define HOMEKIT_DATA(value, ...) (homekit_value_t) HOMEKIT_DATA_(value, ##__VA_ARGS__)
-*/
+#define HOMEKIT_DATA_(value, size, ...) \
+    {.format=homekit_format_data, .data_value=(value), .data_size=(size), ##__VA_ARGS__}
+#define HOMEKIT_DATA(value, size, ...) (homekit_value_t) HOMEKIT_DATA_(value, size, ##__VA_ARGS__)
 
 
 typedef struct {
@@ -182,6 +210,9 @@ struct _homekit_characteristic {
 
     unsigned int id;
     const char *type;
+    // Apple short type (e.g. 0x25 for "00000025-0000-1000-8000-0026BB765291"),
+    // assigned by homekit_accessories_init(). 0 for custom types.
+    uint32_t type_id;
     const char *description;
     homekit_format_t format;
     homekit_unit_t unit;
@@ -204,7 +235,17 @@ struct _homekit_characteristic {
     homekit_value_t (*getter_ex)(const homekit_characteristic_t *ch);
     void (*setter_ex)(homekit_characteristic_t *ch, const homekit_value_t value);
 
+    // Getter for values that take long to read (e.g. slow sensors).
+    // Should either store value and return true, or start reading value
+    // and return false. In latter case value should be reported later
+    // with homekit_characteristic_getter_complete().
+    bool (*getter_async)(homekit_characteristic_t *ch, homekit_value_t *value);
+
     void *context;
+
+    // Index of characteristic among all characteristics of all accessories,
+    // assigned by homekit_accessories_init()
+    unsigned int slot;
 };
 
 struct _homekit_service {
@@ -212,6 +253,8 @@ struct _homekit_service {
 
     unsigned int id;
     const char *type;
+    // Apple short type, same as in characteristic
+    uint32_t type_id;
     bool hidden;
     bool primary;
 
@@ -310,7 +353,9 @@ homekit_characteristic_t *homekit_characteristic_clone(homekit_characteristic_t
 
 
 // Init accessories by automatically assigning IDs to all
-// accessories/services/characteristics, normalizing internal data.
+// accessories/services/characteristics, normalizing internal data
+// and building index for homekit_characteristic_by_aid_and_iid().
+// Should be called again after accessories are changed.
 void homekit_accessories_init(homekit_accessory_t **accessories);
 
 // Find accessory by ID. Returns NULL if not found
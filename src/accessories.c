@@ -1,7 +1,78 @@
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <homekit/types.h>
 
+#include "port.h"
+#include "server.h"
+
+// Header of reference counted buffer, payload follows it
+typedef struct {
+    volatile int refcount;
+} shared_header_t;
+
+#define SHARED_ALIGN(x) (((x) + 7) & ~(size_t)7)
+#define SHARED_HEADER(payload) ((shared_header_t *)((uint8_t *)(payload) - SHARED_ALIGN(sizeof(shared_header_t))))
+
+
+static void *shared_alloc(size_t size) {
+    shared_header_t *header = malloc(SHARED_ALIGN(sizeof(shared_header_t)) + size);
+    if (!header)
+        return NULL;
+
+    header->refcount = 1;
+    return (uint8_t *)header + SHARED_ALIGN(sizeof(shared_header_t));
+}
+
+
+static void shared_retain(void *payload) {
+    homekit_atomic_add(&SHARED_HEADER(payload)->refcount, 1);
+}
+
+
+static void shared_release(void *payload) {
+    shared_header_t *header = SHARED_HEADER(payload);
+    if (!homekit_atomic_add(&header->refcount, -1))
+        free(header);
+}
+
+
+// Copies TLV list into a single shared buffer
+static tlv_values_t *shared_tlv_copy(const tlv_values_t *src) {
+    size_t size = SHARED_ALIGN(sizeof(tlv_values_t));
+    for (tlv_t *t=src->head; t; t=t->next)
+        size += SHARED_ALIGN(sizeof(tlv_t)) + SHARED_ALIGN(t->size);
+
+    uint8_t *p = shared_alloc(size);
+    if (!p)
+        return NULL;
+
+    tlv_values_t *values = (tlv_values_t *)p;
+    values->head = NULL;
+    values->arena = NULL;
+    p += SHARED_ALIGN(sizeof(tlv_values_t));
+
+    tlv_t **tail = &values->head;
+    for (tlv_t *t=src->head; t; t=t->next) {
+        tlv_t *tlv = (tlv_t *)p;
+        p += SHARED_ALIGN(sizeof(tlv_t));
+
+        tlv->type = t->type;
+        tlv->size = t->size;
+        tlv->value = t->size ? p : NULL;
+        tlv->next = NULL;
+        if (t->size)
+            memcpy(tlv->value, t->value, t->size);
+        p += SHARED_ALIGN(t->size);
+
+        *tail = tlv;
+        tail = &tlv->next;
+    }
+
+    return values;
+}
+
+
 bool homekit_value_equal(homekit_value_t *a, homekit_value_t *b) {
     if (a->is_null != b->is_null)
         return false;
@@ -20,10 +91,16 @@ bool homekit_value_equal(homekit_value_t *a, homekit_value_t *b) {
             return a->int_value == b->int_value;
         case homekit_format_float:
             return a->float_value == b->float_value;
-        case homekit_format_string:
-            return !strcmp(a->string_value, b->string_value);
+        case homekit_format_string: {
+            const char *sa = homekit_value_string(a), *sb = homekit_value_string(b);
+            if (sa == sb)
+                return true;
+            if (!sa || !sb)
+                return false;
+            return !strcmp(sa, sb);
+        }
         case homekit_format_tlv: {
-            if (!a->tlv_values && !b->tlv_values)
+            if (a->tlv_values == b->tlv_values)
                 return true;
             if (!a->tlv_values || !b->tlv_values)
                 return false;
@@ -33,21 +110,29 @@ bool homekit_value_equal(homekit_value_t *a, homekit_value_t *b) {
             for (; ta && tb; ta=ta->next, tb=tb->next) {
                 if (ta->type != tb->type || ta->size != tb->size)
                     return false;
-                if (strncmp((char *)ta->value, (char *)tb->value, ta->size))
+                if (ta->size && memcmp(ta->value, tb->value, ta->size))
                     return false;
             }
 
             return (!ta && !tb);
         }
         case homekit_format_data:
-            // TODO: implement comparison
-            return false;
+            if (a->data_size != b->data_size)
+                return false;
+            if (a->data_value == b->data_value)
+                return true;
+            if (!a->data_value || !b->data_value)
+                return false;
+            return !memcmp(a->data_value, b->data_value, a->data_size);
     }
 
     return false;
 }
 
-void homekit_value_copy(homekit_value_t *dst, homekit_value_t *src) {
+// Copies value. Non-static strings and TLVs are duplicated into memory
+// owned by copy, or, if share is set, referenced through shared buffer.
+// Data values can only be owned through shared buffer.
+static void value_copy(homekit_value_t *dst, homekit_value_t *src, bool share) {
     memset(dst, 0, sizeof(*dst));
 
     dst->format = src->format;
@@ -72,16 +157,42 @@ void homekit_value_copy(homekit_value_t *dst, homekit_value_t *src) {
                 if (src->is_static) {
                     dst->string_value = src->string_value;
                     dst->is_static = true;
+                } else if (src->is_shared && share) {
+                    shared_retain(src->string_value);
+                    dst->string_value = src->string_value;
+                    dst->is_shared = true;
+                } else if (!homekit_value_string(src)) {
+                    break;
+                } else if (share) {
+                    size_t size = strlen(homekit_value_string(src)) + 1;
+                    dst->string_value = shared_alloc(size);
+                    if (dst->string_value) {
+                        memcpy(dst->string_value, homekit_value_string(src), size);
+                        dst->is_shared = true;
+                    }
                 } else {
-                    dst->string_value = strdup(src->string_value);
+                    dst->string_value = strdup(homekit_value_string(src));
                 }
                 break;
             case homekit_format_tlv: {
                 if (src->is_static) {
                     dst->tlv_values = src->tlv_values;
                     dst->is_static = true;
+                } else if (src->is_shared && share) {
+                    shared_retain(src->tlv_values);
+                    dst->tlv_values = src->tlv_values;
+                    dst->is_shared = true;
+                } else if (!src->tlv_values) {
+                    break;
+                } else if (share) {
+                    dst->tlv_values = shared_tlv_copy(src->tlv_values);
+                    if (dst->tlv_values)
+                        dst->is_shared = true;
                 } else {
                     dst->tlv_values = tlv_new();
+                    if (!dst->tlv_values)
+                        break;
+
                     for (tlv_t *v=src->tlv_values->head; v; v=v->next) {
                       tlv_add_value(dst->tlv_values, v->type, v->value, v->size);
                     }
@@ -89,7 +200,21 @@ void homekit_value_copy(homekit_value_t *dst, homekit_value_t *src) {
                 break;
             }
             case homekit_format_data:
-                // TODO:
+                dst->data_size = src->data_size;
+                if (src->is_static) {
+                    dst->data_value = src->data_value;
+                    dst->is_static = true;
+                } else if (src->is_shared) {
+                    shared_retain(src->data_value);
+                    dst->data_value = src->data_value;
+                    dst->is_shared = true;
+                } else if (src->data_value) {
+                    dst->data_value = shared_alloc(src->data_size);
+                    if (dst->data_value) {
+                        memcpy(dst->data_value, src->data_value, src->data_size);
+                        dst->is_shared = true;
+                    }
+                }
                 break;
             default:
                 // unknown format
@@ -99,6 +224,33 @@ void homekit_value_copy(homekit_value_t *dst, homekit_value_t *src) {
 }
 
 
+void homekit_value_copy(homekit_value_t *dst, homekit_value_t *src) {
+    value_copy(dst, src, false);
+}
+
+
+void homekit_value_copy_compact(homekit_value_t *dst, homekit_value_t *src) {
+    if (!src->is_null && !src->is_static && src->format == homekit_format_string) {
+        const char *s = homekit_value_string(src);
+        size_t size = s ? strlen(s) + 1 : 0;
+        if (size && size <= HOMEKIT_VALUE_INLINE_SIZE) {
+            memset(dst, 0, sizeof(*dst));
+            dst->format = src->format;
+            dst->is_inline = true;
+            memcpy(dst->inline_value, s, size);
+            return;
+        }
+    }
+
+    value_copy(dst, src, true);
+}
+
+
+const char *homekit_value_string(const homekit_value_t *value) {
+    return value->is_inline ? value->inline_value : value->string_value;
+}
+
+
 homekit_value_t *homekit_value_clone(homekit_value_t *value) {
     homekit_value_t *copy = malloc(sizeof(homekit_value_t));
     homekit_value_copy(copy, value);
@@ -109,15 +261,26 @@ void homekit_value_destruct(homekit_value_t *value) {
     if (!value->is_null) {
         switch (value->format) {
             case homekit_format_string:
-                if (!value->is_static && value->string_value)
+                if (value->is_static || value->is_inline || !value->string_value)
+                    break;
+                if (value->is_shared)
+                    shared_release(value->string_value);
+                else
                     free(value->string_value);
                 break;
             case homekit_format_tlv:
-                if (!value->is_static && value->tlv_values)
+                if (value->is_static || !value->tlv_values)
+                    break;
+                if (value->is_shared)
+                    shared_release(value->tlv_values);
+                else
                     tlv_free(value->tlv_values);
                 break;
             case homekit_format_data:
-                // TODO:
+                // Data is owned only when shared, getters can return
+                // data that stays owned by accessory code
+                if (value->is_shared && value->data_value)
+                    shared_release(value->data_value);
                 break;
             default:
                 // unknown format
@@ -180,6 +343,7 @@ homekit_characteristic_t* homekit_characteristic_clone(homekit_characteristic_t*
     strncpy((char*) p, ch->type, type_len);
     p[type_len - 1] = 0;
     p += type_len;
+    clone->type_id = ch->type_id;
 
     clone->description = (char*) p;
     strncpy((char*) p, ch->description, description_len);
@@ -248,6 +412,7 @@ homekit_characteristic_t* homekit_characteristic_clone(homekit_characteristic_t*
     clone->callback = ch->callback;
     clone->getter_ex = ch->getter_ex;
     clone->setter_ex = ch->setter_ex;
+    clone->getter_async = ch->getter_async;
     clone->context = ch->context;
 
     return clone;
@@ -280,6 +445,7 @@ homekit_service_t* homekit_service_clone(homekit_service_t* service) {
     clone->type = strncpy((char*) p, service->type, type_len);
     p[type_len - 1] = 0;
     p += align_size(type_len);
+    clone->type_id = service->type_id;
 
     clone->hidden = service->hidden;
     clone->primary = service->primary;
@@ -352,7 +518,110 @@ void homekit_characteristic_ex_old_setter(homekit_characteristic_t *ch, homekit_
 }
 
 
+// Characteristics of initialized accessories sorted by aid and iid
+typedef struct {
+    unsigned int aid;
+    unsigned int iid;
+    homekit_characteristic_t *ch;
+} characteristic_index_entry_t;
+
+static homekit_accessory_t **characteristic_index_accessories = NULL;
+static characteristic_index_entry_t *characteristic_index = NULL;
+static unsigned int characteristic_index_count = 0;
+
+
+static int characteristic_index_compare(const void *a, const void *b) {
+    const characteristic_index_entry_t *ea = a, *eb = b;
+    if (ea->aid != eb->aid)
+        return ea->aid < eb->aid ? -1 : 1;
+    if (ea->iid != eb->iid)
+        return ea->iid < eb->iid ? -1 : 1;
+    return 0;
+}
+
+
+static void characteristic_index_build(homekit_accessory_t **accessories, unsigned int count) {
+    if (characteristic_index)
+        free(characteristic_index);
+
+    characteristic_index_accessories = NULL;
+    characteristic_index_count = 0;
+
+    characteristic_index = malloc(count * sizeof(characteristic_index_entry_t));
+    if (!characteristic_index)
+        // Lookups fall back to scanning accessories
+        return;
+
+    unsigned int i = 0;
+    for (homekit_accessory_t **accessory_it = accessories; *accessory_it; accessory_it++) {
+        homekit_accessory_t *accessory = *accessory_it;
+        for (homekit_service_t **service_it = accessory->services; *service_it; service_it++) {
+            for (homekit_characteristic_t **ch_it = (*service_it)->characteristics; *ch_it; ch_it++) {
+                characteristic_index[i].aid = accessory->id;
+                characteristic_index[i].iid = (*ch_it)->id;
+                characteristic_index[i].ch = *ch_it;
+                i++;
+            }
+        }
+    }
+
+    qsort(characteristic_index, count, sizeof(characteristic_index_entry_t), characteristic_index_compare);
+
+    characteristic_index_accessories = accessories;
+    characteristic_index_count = count;
+}
+
+
+// Parses Apple type UUID in either full ("00000025-0000-1000-8000-0026BB765291")
+// or short ("25") form. Returns 0 for anything else.
+static uint32_t homekit_type_id(const char *type) {
+    uint32_t id = 0;
+    int digits = 0;
+
+    const char *p = type;
+    for (; *p && *p != '-'; p++) {
+        int d;
+        if (*p >= '0' && *p <= '9')
+            d = *p - '0';
+        else if (*p >= 'a' && *p <= 'f')
+            d = *p - 'a' + 10;
+        else if (*p >= 'A' && *p <= 'F')
+            d = *p - 'A' + 10;
+        else
+            return 0;
+
+        if (++digits > 8)
+            return 0;
+
+        id = (id << 4) | d;
+    }
+
+    if (!digits)
+        return 0;
+
+    if (*p && strcasecmp(p, "-0000-1000-8000-0026BB765291"))
+        return 0;
+
+    return id;
+}
+
+
+// Compares type of service or characteristic with type being looked up.
+// Apple types are compared by their short type, custom ones as strings.
+static bool homekit_type_match(const char *type, uint32_t type_id, const char *query, uint32_t query_id) {
+    if (!query_id)
+        return !strcmp(type, query);
+
+    if (!type_id)
+        // Not initialized yet
+        type_id = homekit_type_id(type);
+
+    return type_id == query_id;
+}
+
+
 void homekit_accessories_init(homekit_accessory_t **accessories) {
+    unsigned int slot = 0;
     int aid = 1;
     for (homekit_accessory_t **accessory_it = accessories; *accessory_it; accessory_it++) {
         homekit_accessory_t *accessory = *accessory_it;
@@ -367,6 +636,7 @@ void homekit_accessories_init(homekit_accessory_t **accessories) {
         for (homekit_service_t **service_it = accessory->services; *service_it; service_it++) {
             homekit_service_t *service = *service_it;
             service->accessory = accessory;
+            service->type_id = homekit_type_id(service->type);
             if (service->id) {
                 if (service->id >= iid)
                     iid = service->id+1;
@@ -377,6 +647,7 @@ void homekit_accessories_init(homekit_accessory_t **accessories) {
             for (homekit_characteristic_t **ch_it = service->characteristics; *ch_it; ch_it++) {
                 homekit_characteristic_t *ch = *ch_it;
                 ch->service = service;
+                ch->type_id = homekit_type_id(ch->type);
                 if (ch->id) {
                     if (ch->id >= iid)
                         iid = ch->id+1;
@@ -384,6 +655,8 @@ void homekit_accessories_init(homekit_accessory_t **accessories) {
                     ch->id = iid++;
                 }
 
+                ch->slot = slot++;
+
                 if (!ch->getter_ex && ch->getter) {
                     ch->getter_ex = homekit_characteristic_ex_old_getter;
                 }
@@ -396,6 +669,8 @@ void homekit_accessories_init(homekit_accessory_t **accessories) {
             }
         }
     }
+
+    characteristic_index_build(accessories, slot);
 }
 
 homekit_accessory_t *homekit_accessory_by_id(homekit_accessory_t **accessories, int aid) {
@@ -410,10 +685,12 @@ homekit_accessory_t *homekit_accessory_by_id(homekit_accessory_t **accessories,
 }
 
 homekit_service_t *homekit_service_by_type(homekit_accessory_t *accessory, const char *type) {
+    uint32_t type_id = homekit_type_id(type);
+
     for (homekit_service_t **service_it = accessory->services; *service_it; service_it++) {
         homekit_service_t *service = *service_it;
 
-        if (!strcmp(service->type, type))
+        if (homekit_type_match(service->type, service->type_id, type, type_id))
             return service;
     }
 
@@ -421,10 +698,12 @@ homekit_service_t *homekit_service_by_type(homekit_accessory_t *accessory, const
 }
 
 homekit_characteristic_t *homekit_service_characteristic_by_type(homekit_service_t *service, const char *type) {
+    uint32_t type_id = homekit_type_id(type);
+
     for (homekit_characteristic_t **ch_it = service->characteristics; *ch_it; ch_it++) {
         homekit_characteristic_t *ch = *ch_it;
 
-        if (!strcmp(ch->type, type))
+        if (homekit_type_match(ch->type, ch->type_id, type, type_id))
             return ch;
     }
 
@@ -432,6 +711,15 @@ homekit_characteristic_t *homekit_service_characteristic_by_type(homekit_service
 }
 
 homekit_characteristic_t *homekit_characteristic_by_aid_and_iid(homekit_accessory_t **accessories, int aid, int iid) {
+    if (accessories == characteristic_index_accessories) {
+        characteristic_index_entry_t key = { .aid = aid, .iid = iid };
+        characteristic_index_entry_t *entry = bsearch(
+            &key, characteristic_index, characteristic_index_count,
+            sizeof(characteristic_index_entry_t), characteristic_index_compare
+        );
+        return entry ? entry->ch : NULL;
+    }
+
     for (homekit_accessory_t **accessory_it = accessories; *accessory_it; accessory_it++) {
         homekit_accessory_t *accessory = *accessory_it;
 
@@ -455,6 +743,8 @@ homekit_characteristic_t *homekit_characteristic_by_aid_and_iid(homekit_accessor
 
 
 homekit_characteristic_t *homekit_characteristic_find_by_type(homekit_accessory_t **accessories, int aid, const char *type) {
+    uint32_t type_id = homekit_type_id(type);
+
     for (homekit_accessory_t **accessory_it = accessories; *accessory_it; accessory_it++) {
         homekit_accessory_t *accessory = *accessory_it;
 
@@ -467,7 +757,7 @@ homekit_characteristic_t *homekit_characteristic_find_by_type(homekit_accessory_
             for (homekit_characteristic_t **ch_it = service->characteristics; *ch_it; ch_it++) {
                 homekit_characteristic_t *ch = *ch_it;
 
-                if (!strcmp(ch->type, type))
+                if (homekit_type_match(ch->type, ch->type_id, type, type_id))
                     return ch;
             }
         }
@@ -478,6 +768,8 @@ homekit_characteristic_t *homekit_characteristic_find_by_type(homekit_accessory_
 
 
 void homekit_characteristic_notify(homekit_characteristic_t *ch, homekit_value_t value) {
+    homekit_server_notify_characteristic(ch, value);
+
     homekit_characteristic_change_callback_t *callback = ch->callback;
     while (callback) {
         callback->function(ch, value, callback->context);
@@ -0,0 +1,117 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+
+typedef struct _arena_chunk {
+    struct _arena_chunk *next;
+} arena_chunk_t;
+
+
+struct _arena {
+    size_t size;
+    size_t pos;
+    // Offset of last allocation in block, so that it can be resized in place
+    size_t last;
+
+    // Allocations that did not fit into block
+    arena_chunk_t *chunks;
+
+    uint8_t *data;
+};
+
+
+arena_t *arena_new(size_t size) {
+    size = ARENA_ALIGN(size);
+
+    arena_t *arena = malloc(ARENA_ALIGN(sizeof(arena_t)) + size);
+    if (!arena)
+        return NULL;
+
+    arena->size = size;
+    arena->pos = 0;
+    arena->last = 0;
+    arena->chunks = NULL;
+    arena->data = (uint8_t *)arena + ARENA_ALIGN(sizeof(arena_t));
+
+    return arena;
+}
+
+
+void arena_free(arena_t *arena) {
+    arena_reset(arena);
+    free(arena);
+}
+
+
+void arena_reset(arena_t *arena) {
+    while (arena->chunks) {
+        arena_chunk_t *next = arena->chunks->next;
+        free(arena->chunks);
+        arena->chunks = next;
+    }
+
+    arena->pos = 0;
+    arena->last = 0;
+}
+
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = ARENA_ALIGN(size);
+
+    if (size <= arena->size - arena->pos) {
+        void *ptr = arena->data + arena->pos;
+        arena->last = arena->pos;
+        arena->pos += size;
+        return ptr;
+    }
+
+    arena_chunk_t *chunk = malloc(ARENA_ALIGN(sizeof(arena_chunk_t)) + size);
+    if (!chunk)
+        return NULL;
+
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+
+    return (uint8_t *)chunk + ARENA_ALIGN(sizeof(arena_chunk_t));
+}
+
+
+void *arena_realloc(arena_t *arena, void *ptr, size_t old_size, size_t size) {
+    if (!ptr)
+        return arena_alloc(arena, size);
+
+    if (ptr == arena->data + arena->last &&
+            ARENA_ALIGN(size) <= arena->size - arena->last) {
+        arena->pos = arena->last + ARENA_ALIGN(size);
+        return ptr;
+    }
+
+    if (size <= old_size)
+        return ptr;
+
+    void *new_ptr = arena_alloc(arena, size);
+    if (!new_ptr)
+        return NULL;
+
+    memcpy(new_ptr, ptr, old_size);
+
+    return new_ptr;
+}
+
+
+char *arena_strndup(arena_t *arena, const char *s, size_t length) {
+    size_t n = strnlen(s, length);
+    char *result = arena_alloc(arena, n + 1);
+    if (!result)
+        return NULL;
+
+    memcpy(result, s, n);
+    result[n] = 0;
+
+    return result;
+}
@@ -0,0 +1,26 @@
+#ifndef __HOMEKIT_ARENA_H__
+#define __HOMEKIT_ARENA_H__
+
+#include <stddef.h>
+
+// Bump allocator for short-lived objects. Allocations are served from
+// a single preallocated block, allocations that do not fit are malloc'ed
+// separately. Individual allocations are never freed, all memory is
+// released at once by arena_reset().
+
+struct _arena;
+typedef struct _arena arena_t;
+
+
+arena_t *arena_new(size_t size);
+void arena_free(arena_t *arena);
+
+// Releases all allocations made from arena
+void arena_reset(arena_t *arena);
+
+void *arena_alloc(arena_t *arena, size_t size);
+// Resizes allocation, extending it in place if it was the last one in block
+void *arena_realloc(arena_t *arena, void *ptr, size_t old_size, size_t size);
+char *arena_strndup(arena_t *arena, const char *s, size_t length);
+
+#endif // __HOMEKIT_ARENA_H__
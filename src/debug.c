@@ -3,6 +3,18 @@
 #include "debug.h"
 
 
+#ifdef HOMEKIT_DEBUG
+homekit_log_level_t homekit_log_level = HOMEKIT_LOG_DEBUG;
+#else
+homekit_log_level_t homekit_log_level = HOMEKIT_LOG_INFO;
+#endif
+
+
+void homekit_set_log_level(homekit_log_level_t level) {
+    homekit_log_level = level;
+}
+
+
 char *binary_to_string(const byte *data, size_t size) {
     int i;
 
@@ -33,9 +45,10 @@ char *binary_to_string(const byte *data, size_t size) {
 
 
 void print_binary(const char *prompt, const byte *data, size_t size) {
-#ifdef HOMEKIT_DEBUG
+    if (!DEBUG_ENABLED())
+        return;
+
     char *buffer = binary_to_string(data, size);
     printf("%s (%d bytes): \"%s\"\n", prompt, (int)size, buffer);
     free(buffer);
-#endif
 }
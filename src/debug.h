@@ -3,21 +3,47 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <homekit/homekit.h>
 
 typedef unsigned char byte;
 
+extern homekit_log_level_t homekit_log_level;
+
+#define LOG_ENABLED(level) (homekit_log_level >= (level))
+
 #ifdef HOMEKIT_DEBUG
 
-#define DEBUG(message, ...) printf(">>> %s: " message "\n", __func__, ##__VA_ARGS__)
+// Code that only prepares arguments for debug messages (e.g. formats
+// binary data) should be guarded by DEBUG_ENABLED(), so that it is
+// skipped when debug output is turned off at runtime and compiled out
+// without HOMEKIT_DEBUG.
+#define DEBUG_ENABLED() LOG_ENABLED(HOMEKIT_LOG_DEBUG)
+
+#define DEBUG(message, ...) \
+    do { \
+        if (DEBUG_ENABLED()) \
+            printf(">>> %s: " message "\n", __func__, ##__VA_ARGS__); \
+    } while (0)
 
 #else
 
+#define DEBUG_ENABLED() 0
+
 #define DEBUG(message, ...)
 
 #endif
 
-#define INFO(message, ...) printf(">>> HomeKit: " message "\n", ##__VA_ARGS__)
-#define ERROR(message, ...) printf("!!! HomeKit: " message "\n", ##__VA_ARGS__)
+#define INFO(message, ...) \
+    do { \
+        if (LOG_ENABLED(HOMEKIT_LOG_INFO)) \
+            printf(">>> HomeKit: " message "\n", ##__VA_ARGS__); \
+    } while (0)
+
+#define ERROR(message, ...) \
+    do { \
+        if (LOG_ENABLED(HOMEKIT_LOG_ERROR)) \
+            printf("!!! HomeKit: " message "\n", ##__VA_ARGS__); \
+    } while (0)
 
 #define DEBUG_HEAP() DEBUG("Free heap: %d", xPortGetFreeHeapSize());
 
@@ -1,16 +1,23 @@
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdarg.h>
+#include <string.h>
+#include <math.h>
 #include "json.h"
+#include "arena.h"
 #include "debug.h"
 
 #define JSON_MAX_DEPTH 30
 #define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+// Number of fraction digits written for floats
+#define JSON_FLOAT_PRECISION 6
 
 #define DEBUG_STATE(json) \
-    DEBUG("State = %d, last JSON output: %s", \
-          json->state, json->buffer + MAX(0, (long int)json->pos - 20));
+    DEBUG("State = %d, last JSON output: %.*s", \
+          json->state, (int)MIN(json->pos, 20), json->buffer + MAX(0, (long int)json->pos - 20));
 
 typedef enum {
     JSON_STATE_START = 1,
@@ -40,23 +47,51 @@ struct json_stream {
 
     json_flush_callback on_flush;
     void *context;
+
+    arena_t *arena;
 };
 
 
 json_stream *json_new(size_t buffer_size, json_flush_callback on_flush, void *context) {
-    json_stream *json = malloc(sizeof(json_stream));
+    return json_new_in(NULL, buffer_size, on_flush, context);
+}
+
+json_stream *json_new_in(arena_t *arena, size_t buffer_size, json_flush_callback on_flush, void *context) {
+    json_stream *json;
+    if (arena) {
+        json = arena_alloc(arena, sizeof(json_stream));
+        if (!json)
+            return NULL;
+
+        json->buffer = arena_alloc(arena, buffer_size);
+        if (!json->buffer)
+            return NULL;
+    } else {
+        json = malloc(sizeof(json_stream));
+        if (!json)
+            return NULL;
+
+        json->buffer = malloc(buffer_size);
+        if (!json->buffer) {
+            free(json);
+            return NULL;
+        }
+    }
     json->size = buffer_size;
     json->pos = 0;
-    json->buffer = malloc(json->size);
     json->state = JSON_STATE_START;
     json->nesting_idx = 0;
     json->on_flush = on_flush;
     json->context = context;
+    json->arena = arena;
 
     return json;
 }
 
 void json_free(json_stream *json) {
+    if (json->arena)
+        return;
+
     free(json->buffer);
     free(json);
 }
@@ -70,29 +105,168 @@ void json_flush(json_stream *json) {
     json->pos = 0;
 }
 
-void json_write(json_stream *json, const char *format, ...) {
-    va_list arg_ptr;
-
-    va_start(arg_ptr, format);
-    int len = vsnprintf((char *)json->buffer + json->pos, json->size - json->pos, format, arg_ptr);
-    va_end(arg_ptr);
+// Output is appended to buffer byte by byte, buffer is flushed whenever
+// it fills up, so values of any size can be written.
+static void json_write(json_stream *json, const char *data, size_t size) {
+    while (size) {
+        if (json->pos == json->size)
+            json_flush(json);
+
+        size_t chunk_size = MIN(size, json->size - json->pos);
+        memcpy(json->buffer + json->pos, data, chunk_size);
+        json->pos += chunk_size;
+        data += chunk_size;
+        size -= chunk_size;
+    }
+}
 
-    if (len + json->pos > json->size - 1) {
+static void json_write_char(json_stream *json, char c) {
+    if (json->pos == json->size)
         json_flush(json);
 
-        va_start(arg_ptr, format);
-        int len = vsnprintf((char *)json->buffer + json->pos, json->size - json->pos, format, arg_ptr);
-        va_end(arg_ptr);
+    json->buffer[json->pos++] = c;
+}
+
+// Formats unsigned integer right-aligned into end of buffer and
+// returns pointer to its first digit
+static char *json_format_unsigned(unsigned long long x, char *end) {
+    char *p = end;
+    do {
+        *--p = '0' + (x % 10);
+        x /= 10;
+    } while (x);
 
-        if (len > json->size - 1) {
-            ERROR("Write value too large");
-            DEBUG("Format = %s", format);
-        } else {
-            json->pos += len;
-        }
+    return p;
+}
+
+static void json_write_integer(json_stream *json, long long x) {
+    char buffer[24];
+    char *end = buffer + sizeof(buffer);
+
+    char *p;
+    if (x < 0) {
+        p = json_format_unsigned(-(unsigned long long)x, end);
+        *--p = '-';
     } else {
-        json->pos += len;
+        p = json_format_unsigned(x, end);
+    }
+
+    json_write(json, p, end - p);
+}
+
+// Writes float with JSON_FLOAT_PRECISION fraction digits at most, dropping
+// trailing zeros. Values too large for fixed notation are written with
+// exponent. There is no JSON representation for NaN and infinity, they
+// are written as null.
+static void json_write_float(json_stream *json, float value) {
+    if (isnan(value) || isinf(value)) {
+        json_write(json, "null", 4);
+        return;
+    }
+
+    char buffer[48];
+    char *end = buffer + sizeof(buffer);
+    char *p = end;
+
+    double x = value;
+    bool negative = x < 0;
+    if (negative)
+        x = -x;
+
+    unsigned long long scale = 1;
+    for (int i=0; i < JSON_FLOAT_PRECISION; i++)
+        scale *= 10;
+
+    // Large values would overflow scaled value and small ones would
+    // lose their digits, both are written with exponent and mantissa
+    // normalized to one integer digit
+    int exponent = 0;
+    if (x >= 1e12) {
+        while (x >= 10) {
+            x /= 10;
+            exponent++;
+        }
+    } else if (x > 0 && x < (double)1e-4f) {
+        // Compared as float, so that 0.0001f stays in fixed notation
+        while (x < 1) {
+            x *= 10;
+            exponent--;
+        }
+    }
+
+    unsigned long long scaled = (unsigned long long)(x * scale + 0.5);
+    if (exponent && scaled >= 10 * scale) {
+        // Mantissa was rounded up to 10
+        scaled /= 10;
+        exponent++;
+    }
+
+    if (exponent) {
+        p = json_format_unsigned(exponent < 0 ? -exponent : exponent, p);
+        *--p = exponent < 0 ? '-' : '+';
+        *--p = 'e';
+    }
+    unsigned long long fraction = scaled % scale;
+
+    if (fraction) {
+        int digits = JSON_FLOAT_PRECISION;
+        while (fraction % 10 == 0) {
+            fraction /= 10;
+            digits--;
+        }
+
+        char *fraction_end = p;
+        p = json_format_unsigned(fraction, p);
+        while (fraction_end - p < digits)
+            *--p = '0';
+        *--p = '.';
     }
+
+    p = json_format_unsigned(scaled / scale, p);
+    if (negative && (scaled || exponent))
+        *--p = '-';
+
+    json_write(json, p, end - p);
+}
+
+static void json_write_string(json_stream *json, const char *x) {
+    static const char hex[] = "0123456789abcdef";
+
+    json_write_char(json, '"');
+
+    // Characters that need no escaping are written in runs
+    const char *run = x;
+    for (; *x; x++) {
+        unsigned char c = *x;
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+
+        json_write(json, run, x - run);
+        run = x + 1;
+
+        char escape[6] = { '\\', 0 };
+        size_t escape_size = 2;
+        switch (c) {
+            case '"': escape[1] = '"'; break;
+            case '\\': escape[1] = '\\'; break;
+            case '\b': escape[1] = 'b'; break;
+            case '\f': escape[1] = 'f'; break;
+            case '\n': escape[1] = 'n'; break;
+            case '\r': escape[1] = 'r'; break;
+            case '\t': escape[1] = 't'; break;
+            default:
+                escape[1] = 'u';
+                escape[2] = '0';
+                escape[3] = '0';
+                escape[4] = hex[c >> 4];
+                escape[5] = hex[c & 0xf];
+                escape_size = 6;
+        }
+        json_write(json, escape, escape_size);
+    }
+    json_write(json, run, x - run);
+
+    json_write_char(json, '"');
 }
 
 void json_object_start(json_stream *json) {
@@ -101,11 +275,11 @@ void json_object_start(json_stream *json) {
 
     switch (json->state) {
         case JSON_STATE_ARRAY_ITEM:
-            json_write(json, ",");
+            json_write_char(json, ',');
         case JSON_STATE_START:
         case JSON_STATE_OBJECT_KEY:
         case JSON_STATE_ARRAY:
-            json_write(json, "{");
+            json_write_char(json, '{');
 
             json->state = JSON_STATE_OBJECT;
             json->nesting[json->nesting_idx++] = JSON_NESTING_OBJECT;
@@ -124,7 +298,7 @@ void json_object_end(json_stream *json) {
     switch (json->state) {
         case JSON_STATE_OBJECT:
         case JSON_STATE_OBJECT_VALUE:
-            json_write(json, "}");
+            json_write_char(json, '}');
 
             json->nesting_idx--;
             if (!json->nesting_idx) {
@@ -153,11 +327,11 @@ void json_array_start(json_stream *json) {
 
     switch (json->state) {
         case JSON_STATE_ARRAY_ITEM:
-            json_write(json, ",");
+            json_write_char(json, ',');
         case JSON_STATE_START:
         case JSON_STATE_OBJECT_KEY:
         case JSON_STATE_ARRAY:
-            json_write(json, "[");
+            json_write_char(json, '[');
 
             json->state = JSON_STATE_ARRAY;
             json->nesting[json->nesting_idx++] = JSON_NESTING_ARRAY;
@@ -176,7 +350,7 @@ void json_array_end(json_stream *json) {
     switch (json->state) {
         case JSON_STATE_ARRAY:
         case JSON_STATE_ARRAY_ITEM:
-            json_write(json, "]");
+            json_write_char(json, ']');
 
             json->nesting_idx--;
             if (!json->nesting_idx) {
@@ -204,7 +378,7 @@ void json_integer(json_stream *json, long long x) {
         return;
 
     void _do_write() {
-        json_write(json, "%ld", x);
+        json_write_integer(json, x);
     }
 
     switch (json->state) {
@@ -213,7 +387,7 @@ void json_integer(json_stream *json, long long x) {
             json->state = JSON_STATE_END;
             break;
         case JSON_STATE_ARRAY_ITEM:
-            json_write(json, ",");
+            json_write_char(json, ',');
         case JSON_STATE_ARRAY:
             _do_write();
             json->state = JSON_STATE_ARRAY_ITEM;
@@ -234,7 +408,7 @@ void json_float(json_stream *json, float x) {
         return;
 
     void _do_write() {
-        json_write(json, "%1.15g", x);
+        json_write_float(json, x);
     }
 
     switch (json->state) {
@@ -243,7 +417,7 @@ void json_float(json_stream *json, float x) {
             json->state = JSON_STATE_END;
             break;
         case JSON_STATE_ARRAY_ITEM:
-            json_write(json, ",");
+            json_write_char(json, ',');
         case JSON_STATE_ARRAY:
             _do_write();
             json->state = JSON_STATE_ARRAY_ITEM;
@@ -264,8 +438,7 @@ void json_string(json_stream *json, const char *x) {
         return;
 
     void _do_write() {
-        // TODO: escape string
-        json_write(json, "\"%s\"", x);
+        json_write_string(json, x);
     }
 
     switch (json->state) {
@@ -274,16 +447,16 @@ void json_string(json_stream *json, const char *x) {
             json->state = JSON_STATE_END;
             break;
         case JSON_STATE_ARRAY_ITEM:
-            json_write(json, ",");
+            json_write_char(json, ',');
         case JSON_STATE_ARRAY:
             _do_write();
             json->state = JSON_STATE_ARRAY_ITEM;
             break;
         case JSON_STATE_OBJECT_VALUE:
-            json_write(json, ",");
+            json_write_char(json, ',');
         case JSON_STATE_OBJECT:
             _do_write();
-            json_write(json, ":");
+            json_write_char(json, ':');
             json->state = JSON_STATE_OBJECT_KEY;
             break;
         case JSON_STATE_OBJECT_KEY:
@@ -302,7 +475,10 @@ void json_boolean(json_stream *json, bool x) {
         return;
 
     void _do_write() {
-        json_write(json, (x) ? "true" : "false");
+        if (x)
+            json_write(json, "true", 4);
+        else
+            json_write(json, "false", 5);
     }
 
     switch (json->state) {
@@ -311,7 +487,7 @@ void json_boolean(json_stream *json, bool x) {
             json->state = JSON_STATE_END;
             break;
         case JSON_STATE_ARRAY_ITEM:
-            json_write(json, ",");
+            json_write_char(json, ',');
         case JSON_STATE_ARRAY:
             _do_write();
             json->state = JSON_STATE_ARRAY_ITEM;
@@ -332,7 +508,7 @@ void json_null(json_stream *json) {
         return;
 
     void _do_write() {
-        json_write(json, "null");
+        json_write(json, "null", 4);
     }
 
     switch (json->state) {
@@ -341,7 +517,7 @@ void json_null(json_stream *json) {
             json->state = JSON_STATE_END;
             break;
         case JSON_STATE_ARRAY_ITEM:
-            json_write(json, ",");
+            json_write_char(json, ',');
         case JSON_STATE_ARRAY:
             _do_write();
             json->state = JSON_STATE_ARRAY_ITEM;
@@ -357,3 +533,430 @@ void json_null(json_stream *json) {
     }
 }
 
+
+
+void json_reader_init(json_reader *reader, char *data, size_t size) {
+    reader->data = data;
+    reader->size = size;
+    reader->pos = 0;
+    reader->depth = 0;
+    reader->objects = 0;
+    reader->need_comma = false;
+    reader->after_key = false;
+}
+
+
+static void json_reader_skip_whitespace(json_reader *reader) {
+    while (reader->pos < reader->size) {
+        char c = reader->data[reader->pos];
+        if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+            break;
+        reader->pos++;
+    }
+}
+
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+
+// Validates string starting at opening quote and fills token with its raw contents
+static int json_reader_string(json_reader *reader, json_token *token) {
+    size_t pos = reader->pos + 1;
+
+    token->value = reader->data + pos;
+    token->escaped = false;
+
+    while (pos < reader->size) {
+        unsigned char c = reader->data[pos];
+        if (c == '"') {
+            token->length = reader->data + pos - token->value;
+            reader->pos = pos + 1;
+            return 0;
+        }
+
+        if (c < 0x20)
+            return -1;
+
+        if (c == '\\') {
+            token->escaped = true;
+            if (++pos >= reader->size)
+                return -1;
+
+            switch (reader->data[pos]) {
+                case '"': case '\\': case '/':
+                case 'b': case 'f': case 'n': case 'r': case 't':
+                    break;
+                case 'u':
+                    if (pos + 4 >= reader->size)
+                        return -1;
+                    for (int i=1; i <= 4; i++)
+                        if (hex_digit(reader->data[pos + i]) < 0)
+                            return -1;
+                    pos += 4;
+                    break;
+                default:
+                    return -1;
+            }
+        }
+
+        pos++;
+    }
+
+    return -1;
+}
+
+
+static int json_reader_number(json_reader *reader, json_token *token) {
+    const char *data = reader->data;
+    size_t size = reader->size;
+    size_t pos = reader->pos;
+
+    #define IS_DIGIT(i) ((i) < size && data[i] >= '0' && data[i] <= '9')
+
+    if (pos < size && data[pos] == '-')
+        pos++;
+
+    if (!IS_DIGIT(pos))
+        return -1;
+    if (data[pos] == '0') {
+        pos++;
+    } else {
+        while (IS_DIGIT(pos))
+            pos++;
+    }
+
+    if (pos < size && data[pos] == '.') {
+        pos++;
+        if (!IS_DIGIT(pos))
+            return -1;
+        while (IS_DIGIT(pos))
+            pos++;
+    }
+
+    if (pos < size && (data[pos] == 'e' || data[pos] == 'E')) {
+        pos++;
+        if (pos < size && (data[pos] == '+' || data[pos] == '-'))
+            pos++;
+        if (!IS_DIGIT(pos))
+            return -1;
+        while (IS_DIGIT(pos))
+            pos++;
+    }
+
+    #undef IS_DIGIT
+
+    token->value = reader->data + reader->pos;
+    token->length = pos - reader->pos;
+    token->escaped = false;
+    reader->pos = pos;
+
+    return 0;
+}
+
+
+static json_token_type json_reader_literal(json_reader *reader, const char *literal, json_token_type type) {
+    size_t length = strlen(literal);
+    if (reader->size - reader->pos < length || strncmp(reader->data + reader->pos, literal, length))
+        return JSON_TOKEN_ERROR;
+
+    reader->pos += length;
+    return type;
+}
+
+
+json_token_type json_reader_next(json_reader *reader, json_token *token) {
+    token->type = JSON_TOKEN_ERROR;
+    token->value = NULL;
+    token->length = 0;
+    token->escaped = false;
+
+    json_reader_skip_whitespace(reader);
+
+    if (!reader->depth && reader->need_comma) {
+        // Top level value is complete, only whitespace can follow
+        if (reader->pos < reader->size)
+            return JSON_TOKEN_ERROR;
+
+        token->type = JSON_TOKEN_END;
+        return JSON_TOKEN_END;
+    }
+
+    if (reader->pos >= reader->size)
+        return JSON_TOKEN_ERROR;
+
+    bool in_object = reader->depth && (reader->objects & (1 << (reader->depth - 1)));
+    char c = reader->data[reader->pos];
+
+    if (reader->need_comma) {
+        if (c == ',') {
+            reader->pos++;
+            json_reader_skip_whitespace(reader);
+            if (reader->pos >= reader->size)
+                return JSON_TOKEN_ERROR;
+
+            c = reader->data[reader->pos];
+            if (c == '}' || c == ']')
+                return JSON_TOKEN_ERROR;
+        } else if (c != (in_object ? '}' : ']')) {
+            return JSON_TOKEN_ERROR;
+        }
+        reader->need_comma = false;
+    }
+
+    if (c == '}' || c == ']') {
+        if (c != (in_object ? '}' : ']') || reader->after_key || !reader->depth)
+            return JSON_TOKEN_ERROR;
+
+        reader->pos++;
+        reader->depth--;
+        reader->need_comma = true;
+
+        token->type = in_object ? JSON_TOKEN_OBJECT_END : JSON_TOKEN_ARRAY_END;
+        return token->type;
+    }
+
+    if (in_object && !reader->after_key) {
+        if (c != '"' || json_reader_string(reader, token))
+            return JSON_TOKEN_ERROR;
+
+        json_reader_skip_whitespace(reader);
+        if (reader->pos >= reader->size || reader->data[reader->pos] != ':')
+            return JSON_TOKEN_ERROR;
+
+        reader->pos++;
+        reader->after_key = true;
+
+        token->type = JSON_TOKEN_KEY;
+        return JSON_TOKEN_KEY;
+    }
+
+    reader->after_key = false;
+
+    json_token_type type;
+    switch (c) {
+        case '{':
+        case '[':
+            if (reader->depth >= JSON_MAX_DEPTH)
+                return JSON_TOKEN_ERROR;
+
+            if (c == '{')
+                reader->objects |= (1 << reader->depth);
+            else
+                reader->objects &= ~(1 << reader->depth);
+
+            reader->depth++;
+            reader->pos++;
+
+            token->type = (c == '{') ? JSON_TOKEN_OBJECT_START : JSON_TOKEN_ARRAY_START;
+            return token->type;
+        case '"':
+            if (json_reader_string(reader, token))
+                return JSON_TOKEN_ERROR;
+            type = JSON_TOKEN_STRING;
+            break;
+        case 't':
+            type = json_reader_literal(reader, "true", JSON_TOKEN_TRUE);
+            break;
+        case 'f':
+            type = json_reader_literal(reader, "false", JSON_TOKEN_FALSE);
+            break;
+        case 'n':
+            type = json_reader_literal(reader, "null", JSON_TOKEN_NULL);
+            break;
+        default:
+            if (json_reader_number(reader, token))
+                return JSON_TOKEN_ERROR;
+            type = JSON_TOKEN_NUMBER;
+    }
+
+    if (type == JSON_TOKEN_ERROR)
+        return JSON_TOKEN_ERROR;
+
+    reader->need_comma = true;
+
+    token->type = type;
+    return type;
+}
+
+
+int json_reader_skip(json_reader *reader, const json_token *token) {
+    if (token->type != JSON_TOKEN_OBJECT_START && token->type != JSON_TOKEN_ARRAY_START)
+        return (token->type > JSON_TOKEN_END) ? 0 : -1;
+
+    uint8_t depth = reader->depth - 1;
+    json_token t;
+    while (reader->depth > depth) {
+        if (json_reader_next(reader, &t) <= JSON_TOKEN_END)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+bool json_token_equals(const json_token *token, const char *s) {
+    return !token->escaped && token->value &&
+        strlen(s) == token->length && !strncmp(token->value, s, token->length);
+}
+
+
+static size_t utf8_encode(unsigned int code, char *output) {
+    if (code < 0x80) {
+        output[0] = code;
+        return 1;
+    }
+    if (code < 0x800) {
+        output[0] = 0xC0 | (code >> 6);
+        output[1] = 0x80 | (code & 0x3F);
+        return 2;
+    }
+    if (code < 0x10000) {
+        output[0] = 0xE0 | (code >> 12);
+        output[1] = 0x80 | ((code >> 6) & 0x3F);
+        output[2] = 0x80 | (code & 0x3F);
+        return 3;
+    }
+    output[0] = 0xF0 | (code >> 18);
+    output[1] = 0x80 | ((code >> 12) & 0x3F);
+    output[2] = 0x80 | ((code >> 6) & 0x3F);
+    output[3] = 0x80 | (code & 0x3F);
+    return 4;
+}
+
+
+static unsigned int hex_code(const char *s) {
+    return (hex_digit(s[0]) << 12) | (hex_digit(s[1]) << 8) | (hex_digit(s[2]) << 4) | hex_digit(s[3]);
+}
+
+
+char *json_token_string(json_token *token) {
+    char *s = token->value;
+    if (!s)
+        return NULL;
+
+    if (!token->escaped) {
+        // Overwrites closing quote
+        s[token->length] = 0;
+        return s;
+    }
+
+    // Decoded string is never longer than escaped one, so it is
+    // written over the source as it is read
+    const char *in = s;
+    const char *end = s + token->length;
+    char *out = s;
+
+    while (in < end) {
+        if (*in != '\\') {
+            *out++ = *in++;
+            continue;
+        }
+
+        in++;
+        switch (*in++) {
+            case 'b': *out++ = '\b'; break;
+            case 'f': *out++ = '\f'; break;
+            case 'n': *out++ = '\n'; break;
+            case 'r': *out++ = '\r'; break;
+            case 't': *out++ = '\t'; break;
+            case 'u': {
+                unsigned int code = hex_code(in);
+                in += 4;
+
+                if (code >= 0xD800 && code < 0xDC00 && end - in >= 6 &&
+                        in[0] == '\\' && in[1] == 'u') {
+                    unsigned int low = hex_code(in + 2);
+                    if (low >= 0xDC00 && low < 0xE000) {
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        in += 6;
+                    }
+                }
+
+                out += utf8_encode(code, out);
+                break;
+            }
+            default:
+                // Quote, backslash and slash stand for themselves
+                *out++ = in[-1];
+        }
+    }
+
+    *out = 0;
+    token->length = out - s;
+    token->escaped = false;
+
+    return s;
+}
+
+
+// Longest number text json_token_number() converts
+#define JSON_MAX_NUMBER_LENGTH 64
+
+int json_token_number(const json_token *token, double *value) {
+    char buffer[JSON_MAX_NUMBER_LENGTH + 1];
+    if (token->type != JSON_TOKEN_NUMBER || token->length > JSON_MAX_NUMBER_LENGTH)
+        return -1;
+
+    memcpy(buffer, token->value, token->length);
+    buffer[token->length] = 0;
+
+    double x = strtod(buffer, NULL);
+    if (isinf(x))
+        return -1;
+
+    *value = x;
+    return 0;
+}
+
+
+int json_token_integer(const json_token *token, long long *value) {
+    if (token->type == JSON_TOKEN_TRUE || token->type == JSON_TOKEN_FALSE) {
+        *value = (token->type == JSON_TOKEN_TRUE);
+        return 0;
+    }
+
+    if (token->type != JSON_TOKEN_NUMBER)
+        return -1;
+
+    for (size_t i=0; i < token->length; i++) {
+        char c = token->value[i];
+        if (c == '.' || c == 'e' || c == 'E') {
+            double x;
+            // Bounds are powers of two, so they are exact as doubles
+            if (json_token_number(token, &x) || x < -9223372036854775808.0 || x >= 9223372036854775808.0)
+                return -1;
+
+            *value = (long long)x;
+            return 0;
+        }
+    }
+
+    // Digits are accumulated as negative number, so that
+    // the most negative value does not overflow
+    bool negative = token->value[0] == '-';
+    long long x = 0;
+    for (size_t i=negative ? 1 : 0; i < token->length; i++) {
+        int digit = token->value[i] - '0';
+        if (x < (LLONG_MIN + digit) / 10)
+            return -1;
+
+        x = x * 10 - digit;
+    }
+
+    if (!negative) {
+        if (x == LLONG_MIN)
+            return -1;
+        x = -x;
+    }
+
+    *value = x;
+    return 0;
+}
@@ -1,13 +1,21 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 struct json_stream;
 typedef struct json_stream json_stream;
 
 typedef void (*json_flush_callback)(uint8_t *buffer, size_t size, void *context);
 
+struct _arena;
+
+// Returns NULL if stream or its buffer can not be allocated
 json_stream *json_new(size_t buffer_size, json_flush_callback on_flush, void *context);
+// Creates JSON stream with state and buffer allocated from given arena.
+// json_free() is a no-op for such streams.
+json_stream *json_new_in(struct _arena *arena, size_t buffer_size, json_flush_callback on_flush, void *context);
 void json_free(json_stream *json);
 
 void json_flush(json_stream *json);
@@ -24,3 +32,70 @@ void json_string(json_stream *json, const char *x);
 void json_boolean(json_stream *json, bool x);
 void json_null(json_stream *json);
 
+
+
+// Pull parser for JSON documents held in writable memory. Tokens point
+// into parsed data and strings are decoded in place on request, so
+// parsing does not allocate memory.
+
+typedef enum {
+    JSON_TOKEN_ERROR = -1,
+    JSON_TOKEN_END = 0,
+    JSON_TOKEN_OBJECT_START,
+    JSON_TOKEN_OBJECT_END,
+    JSON_TOKEN_ARRAY_START,
+    JSON_TOKEN_ARRAY_END,
+    JSON_TOKEN_KEY,
+    JSON_TOKEN_STRING,
+    JSON_TOKEN_NUMBER,
+    JSON_TOKEN_TRUE,
+    JSON_TOKEN_FALSE,
+    JSON_TOKEN_NULL,
+} json_token_type;
+
+typedef struct {
+    json_token_type type;
+
+    // Raw contents of KEY and STRING tokens (without quotes)
+    // or text of NUMBER token
+    char *value;
+    size_t length;
+    // String contains escape sequences
+    bool escaped;
+} json_token;
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t pos;
+
+    uint8_t depth;
+    // Bit per nesting level, set for objects
+    uint32_t objects;
+
+    bool need_comma;
+    bool after_key;
+} json_reader;
+
+void json_reader_init(json_reader *reader, char *data, size_t size);
+
+// Reads next token. Structure of document is validated as it is read,
+// JSON_TOKEN_ERROR is returned for malformed input and JSON_TOKEN_END
+// after top level value is complete.
+json_token_type json_reader_next(json_reader *reader, json_token *token);
+
+// Skips value that starts with given token, including nested values
+// of objects and arrays. Returns 0 on success.
+int json_reader_skip(json_reader *reader, const json_token *token);
+
+bool json_token_equals(const json_token *token, const char *s);
+
+// Decodes escape sequences of KEY or STRING token in place and
+// NUL-terminates it. Should be called at most once per token.
+char *json_token_string(json_token *token);
+
+// Convert NUMBER token (json_token_integer() also takes true and false).
+// Return 0 on success, -1 if token is not a number or its value does not
+// fit. Fractions are truncated by json_token_integer().
+int json_token_number(const json_token *token, double *value);
+int json_token_integer(const json_token *token, long long *value);
@@ -0,0 +1,113 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if !defined(__linux__) || defined(ESP_IDF) || defined(ESP_OPEN_RTOS)
+#include <lwip/sockets.h>
+#endif
+
+#include "output_queue.h"
+
+
+void output_queue_init(output_queue_t *queue, size_t block_size, size_t max_length) {
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->block_size = block_size;
+    queue->max_length = max_length;
+    queue->length = 0;
+}
+
+
+void output_queue_clear(output_queue_t *queue) {
+    output_block_t *block = queue->head;
+    while (block) {
+        output_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->length = 0;
+}
+
+
+size_t output_queue_free_space(const output_queue_t *queue) {
+    const output_block_t *block = queue->tail;
+    if (!block)
+        return 0;
+    if (!block->length)
+        return queue->block_size;
+
+    return queue->block_size - block->start - block->length;
+}
+
+
+uint8_t *output_queue_reserve(output_queue_t *queue, size_t size) {
+    if (size > queue->block_size || queue->length + size > queue->max_length)
+        return NULL;
+
+    output_block_t *block = queue->tail;
+    if (block && !block->length)
+        // Block was drained, reuse it from the start
+        block->start = 0;
+
+    if (output_queue_free_space(queue) < size) {
+        block = malloc(sizeof(output_block_t) + queue->block_size);
+        if (!block)
+            return NULL;
+
+        block->next = NULL;
+        block->start = 0;
+        block->length = 0;
+
+        if (queue->tail)
+            queue->tail->next = block;
+        else
+            queue->head = block;
+        queue->tail = block;
+    }
+
+    return block->data + block->start + block->length;
+}
+
+
+void output_queue_commit(output_queue_t *queue, size_t size) {
+    queue->tail->length += size;
+    queue->length += size;
+}
+
+
+int output_queue_write(output_queue_t *queue, int socket) {
+    int written = 0;
+
+    while (queue->length) {
+        output_block_t *block = queue->head;
+        int r = write(socket, block->data + block->start, block->length);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+
+        block->start += r;
+        block->length -= r;
+        queue->length -= r;
+        written += r;
+
+        if (block->length)
+            // Socket buffer is full
+            break;
+
+        // Last block is kept for data that follows
+        if (block->next) {
+            queue->head = block->next;
+            free(block);
+        }
+    }
+
+    return written;
+}
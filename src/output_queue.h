@@ -0,0 +1,50 @@
+#ifndef __HOMEKIT_OUTPUT_QUEUE_H__
+#define __HOMEKIT_OUTPUT_QUEUE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Queue of data waiting to be written to a non-blocking socket. Data is
+// kept in a list of fixed size blocks, new block is allocated when data
+// does not fit into the last one, so writer never has to wait for socket.
+// Total amount of pending data is limited by max_length.
+
+typedef struct _output_block {
+    struct _output_block *next;
+    // Pending data is data[start..start+length)
+    size_t start;
+    size_t length;
+    uint8_t data[];
+} output_block_t;
+
+typedef struct {
+    output_block_t *head;
+    output_block_t *tail;
+
+    size_t block_size;
+    size_t max_length;
+    // Number of bytes in all blocks not yet written
+    size_t length;
+} output_queue_t;
+
+
+void output_queue_init(output_queue_t *queue, size_t block_size, size_t max_length);
+// Releases all blocks, pending data is dropped
+void output_queue_clear(output_queue_t *queue);
+
+// Returns number of contiguous bytes that can be reserved without
+// allocating a new block
+size_t output_queue_free_space(const output_queue_t *queue);
+
+// Returns pointer to size contiguous bytes (at most block_size) after
+// pending data. Bytes become pending once output_queue_commit() is called.
+// Returns NULL if pending data would exceed max_length or memory can not
+// be allocated.
+uint8_t *output_queue_reserve(output_queue_t *queue, size_t size);
+void output_queue_commit(output_queue_t *queue, size_t size);
+
+// Writes as much pending data as socket accepts without blocking.
+// Returns number of bytes written or -1 on socket error (errno is set).
+int output_queue_write(output_queue_t *queue, int socket);
+
+#endif // __HOMEKIT_OUTPUT_QUEUE_H__
@@ -0,0 +1,505 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && !defined(ESP_IDF) && !defined(ESP_OPEN_RTOS)
+// Host build (unit tests). POLLER_POLL or POLLER_SELECT can be defined
+// to run lwIP backends against host sockets.
+#include <errno.h>
+#include <stdint.h>
+#if !defined(POLLER_POLL) && !defined(POLLER_SELECT)
+#define POLLER_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#endif
+#else
+#include <lwip/sockets.h>
+#if defined(LWIP_SOCKET_POLL) && LWIP_SOCKET_POLL
+#define POLLER_POLL
+#else
+#define POLLER_SELECT
+#endif
+#endif
+
+#include "poller.h"
+#include "debug.h"
+
+
+#ifdef POLLER_EPOLL
+
+struct _poller {
+    int epoll_fd;
+
+    int max_fds;
+    struct epoll_event *events;
+
+    int wakeup_fd;
+    volatile bool wakeup_pending;
+};
+
+
+static uint32_t poller_epoll_events(int events) {
+    uint32_t e = 0;
+    if (events & POLLER_READ)
+        e |= EPOLLIN;
+    if (events & POLLER_WRITE)
+        e |= EPOLLOUT;
+    return e;
+}
+
+
+poller_t *poller_new(int max_fds) {
+    poller_t *poller = malloc(sizeof(poller_t));
+    if (!poller)
+        return NULL;
+
+    // One extra slot for wakeup eventfd
+    poller->max_fds = max_fds + 1;
+    poller->events = malloc(sizeof(struct epoll_event) * poller->max_fds);
+    if (!poller->events) {
+        ERROR("Failed to allocate poller events for %d sockets", poller->max_fds);
+        free(poller);
+        return NULL;
+    }
+
+    poller->epoll_fd = epoll_create1(0);
+    if (poller->epoll_fd < 0) {
+        ERROR("Failed to create epoll instance (code %d)", errno);
+        free(poller->events);
+        free(poller);
+        return NULL;
+    }
+
+    poller->wakeup_pending = false;
+    poller->wakeup_fd = eventfd(0, EFD_NONBLOCK);
+    if (poller->wakeup_fd < 0) {
+        ERROR("Failed to create wakeup eventfd (code %d)", errno);
+    } else {
+        struct epoll_event e = {
+            .events = EPOLLIN,
+            .data.ptr = poller,
+        };
+        if (epoll_ctl(poller->epoll_fd, EPOLL_CTL_ADD, poller->wakeup_fd, &e)) {
+            ERROR("Failed to register wakeup eventfd (code %d)", errno);
+            close(poller->wakeup_fd);
+            poller->wakeup_fd = -1;
+        }
+    }
+
+    return poller;
+}
+
+
+void poller_free(poller_t *poller) {
+    if (poller->wakeup_fd >= 0)
+        close(poller->wakeup_fd);
+    close(poller->epoll_fd);
+    free(poller->events);
+    free(poller);
+}
+
+
+void poller_wakeup(poller_t *poller) {
+    if (poller->wakeup_fd < 0 || poller->wakeup_pending)
+        return;
+
+    poller->wakeup_pending = true;
+
+    uint64_t x = 1;
+    write(poller->wakeup_fd, &x, sizeof(x));
+}
+
+
+bool poller_can_wakeup(poller_t *poller) {
+    return poller->wakeup_fd >= 0;
+}
+
+
+int poller_add(poller_t *poller, int fd, int events, void *data) {
+    struct epoll_event e = {
+        .events = poller_epoll_events(events),
+        .data.ptr = data,
+    };
+    int r = epoll_ctl(poller->epoll_fd, EPOLL_CTL_ADD, fd, &e);
+    if (r && errno == EEXIST)
+        // Socket that is already registered only changes its events
+        r = epoll_ctl(poller->epoll_fd, EPOLL_CTL_MOD, fd, &e);
+
+    return r;
+}
+
+
+int poller_modify(poller_t *poller, int fd, int events, void *data) {
+    struct epoll_event e = {
+        .events = poller_epoll_events(events),
+        .data.ptr = data,
+    };
+    return epoll_ctl(poller->epoll_fd, EPOLL_CTL_MOD, fd, &e);
+}
+
+
+int poller_remove(poller_t *poller, int fd) {
+    struct epoll_event e;
+    return epoll_ctl(poller->epoll_fd, EPOLL_CTL_DEL, fd, &e);
+}
+
+
+int poller_wait(poller_t *poller, poller_event_t *events, int max_events, int timeout) {
+    if (max_events > poller->max_fds)
+        max_events = poller->max_fds;
+
+    int triggered = epoll_wait(poller->epoll_fd, poller->events, max_events, timeout);
+    if (triggered < 0) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+
+    int n = 0;
+    for (int i=0; i<triggered; i++) {
+        uint32_t e = poller->events[i].events;
+
+        if (poller->events[i].data.ptr == poller) {
+            // Clear flag first so that wakeups that come while draining are not lost
+            poller->wakeup_pending = false;
+
+            uint64_t x;
+            read(poller->wakeup_fd, &x, sizeof(x));
+            continue;
+        }
+
+        events[n].data = poller->events[i].data.ptr;
+        events[n].events = 0;
+        if (e & EPOLLIN)
+            events[n].events |= POLLER_READ;
+        if (e & EPOLLOUT)
+            events[n].events |= POLLER_WRITE;
+        if (e & (EPOLLERR | EPOLLHUP))
+            events[n].events |= POLLER_ERROR | POLLER_READ;
+        n++;
+    }
+
+    return n;
+}
+
+#else // POLLER_POLL || POLLER_SELECT
+
+typedef struct {
+    int fd;
+    int events;
+    void *data;
+} poller_entry_t;
+
+
+// Registered sockets are kept in a dense array so that removal is a swap
+// with the last entry and waiting does not depend on socket numbers.
+struct _poller {
+    int max_fds;
+    int count;
+    poller_entry_t *entries;
+
+    // UDP socket connected to itself, registered as first entry
+    int wakeup_fd;
+    volatile bool wakeup_pending;
+
+#ifdef POLLER_POLL
+    struct pollfd *fds;
+#else
+    fd_set read_fds;
+    fd_set write_fds;
+    int max_fd;
+#endif
+};
+
+
+static int poller_wakeup_socket() {
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s < 0)
+        return -1;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    socklen_t addr_len = sizeof(addr);
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) ||
+            getsockname(s, (struct sockaddr *)&addr, &addr_len) ||
+            connect(s, (struct sockaddr *)&addr, sizeof(addr)))
+    {
+        close(s);
+        return -1;
+    }
+
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+
+    return s;
+}
+
+
+poller_t *poller_new(int max_fds) {
+    poller_t *poller = malloc(sizeof(poller_t));
+    if (!poller)
+        return NULL;
+
+    // One extra slot for wakeup socket
+    max_fds++;
+    poller->max_fds = max_fds;
+    poller->count = 0;
+    poller->entries = malloc(sizeof(poller_entry_t) * max_fds);
+    if (!poller->entries) {
+        ERROR("Failed to allocate poller entries for %d sockets", max_fds);
+        free(poller);
+        return NULL;
+    }
+
+#ifdef POLLER_POLL
+    poller->fds = malloc(sizeof(struct pollfd) * max_fds);
+    if (!poller->fds) {
+        ERROR("Failed to allocate poller entries for %d sockets", max_fds);
+        free(poller->entries);
+        free(poller);
+        return NULL;
+    }
+#else
+    FD_ZERO(&poller->read_fds);
+    FD_ZERO(&poller->write_fds);
+    poller->max_fd = -1;
+#endif
+
+    poller->wakeup_pending = false;
+    poller->wakeup_fd = poller_wakeup_socket();
+    if (poller->wakeup_fd < 0) {
+        ERROR("Failed to create wakeup socket (code %d)", errno);
+    } else if (poller_add(poller, poller->wakeup_fd, POLLER_READ, poller)) {
+        ERROR("Failed to register wakeup socket");
+        close(poller->wakeup_fd);
+        poller->wakeup_fd = -1;
+    }
+
+    return poller;
+}
+
+
+void poller_free(poller_t *poller) {
+    if (poller->wakeup_fd >= 0)
+        close(poller->wakeup_fd);
+#ifdef POLLER_POLL
+    free(poller->fds);
+#endif
+    free(poller->entries);
+    free(poller);
+}
+
+
+void poller_wakeup(poller_t *poller) {
+    if (poller->wakeup_fd < 0 || poller->wakeup_pending)
+        return;
+
+    poller->wakeup_pending = true;
+
+    char x = 0;
+    send(poller->wakeup_fd, &x, 1, 0);
+}
+
+
+bool poller_can_wakeup(poller_t *poller) {
+    return poller->wakeup_fd >= 0;
+}
+
+
+static void poller_drain_wakeup(poller_t *poller) {
+    // Clear flag first so that wakeups that come while draining are not lost
+    poller->wakeup_pending = false;
+
+    char buffer[16];
+    while (recv(poller->wakeup_fd, buffer, sizeof(buffer), 0) > 0);
+}
+
+
+static int poller_find(poller_t *poller, int fd) {
+    for (int i=0; i<poller->count; i++) {
+        if (poller->entries[i].fd == fd)
+            return i;
+    }
+
+    return -1;
+}
+
+
+static void poller_set_events(poller_t *poller, int i, int events) {
+    poller->entries[i].events = events;
+
+#ifdef POLLER_POLL
+    poller->fds[i].fd = poller->entries[i].fd;
+    poller->fds[i].events = 0;
+    if (events & POLLER_READ)
+        poller->fds[i].events |= POLLIN;
+    if (events & POLLER_WRITE)
+        poller->fds[i].events |= POLLOUT;
+    poller->fds[i].revents = 0;
+#else
+    int fd = poller->entries[i].fd;
+    if (events & POLLER_READ)
+        FD_SET(fd, &poller->read_fds);
+    else
+        FD_CLR(fd, &poller->read_fds);
+
+    if (events & POLLER_WRITE)
+        FD_SET(fd, &poller->write_fds);
+    else
+        FD_CLR(fd, &poller->write_fds);
+#endif
+}
+
+
+int poller_add(poller_t *poller, int fd, int events, void *data) {
+    // Socket that is already registered only changes its events
+    if (poller_find(poller, fd) >= 0)
+        return poller_modify(poller, fd, events, data);
+
+    if (poller->count >= poller->max_fds) {
+        ERROR("Failed to register socket %d: too many sockets", fd);
+        return -1;
+    }
+
+    int i = poller->count++;
+    poller->entries[i].fd = fd;
+    poller->entries[i].data = data;
+    poller_set_events(poller, i, events);
+
+#ifdef POLLER_SELECT
+    if (fd > poller->max_fd)
+        poller->max_fd = fd;
+#endif
+
+    return 0;
+}
+
+
+int poller_modify(poller_t *poller, int fd, int events, void *data) {
+    int i = poller_find(poller, fd);
+    if (i < 0)
+        return -1;
+
+    poller->entries[i].data = data;
+    poller_set_events(poller, i, events);
+
+    return 0;
+}
+
+
+int poller_remove(poller_t *poller, int fd) {
+    int i = poller_find(poller, fd);
+    if (i < 0)
+        return -1;
+
+    poller_set_events(poller, i, 0);
+
+    poller->count--;
+    if (i != poller->count) {
+        poller->entries[i] = poller->entries[poller->count];
+#ifdef POLLER_POLL
+        poller->fds[i] = poller->fds[poller->count];
+#endif
+    }
+
+#ifdef POLLER_SELECT
+    if (fd == poller->max_fd) {
+        poller->max_fd = -1;
+        for (int j=0; j<poller->count; j++) {
+            if (poller->entries[j].fd > poller->max_fd)
+                poller->max_fd = poller->entries[j].fd;
+        }
+    }
+#endif
+
+    return 0;
+}
+
+
+int poller_wait(poller_t *poller, poller_event_t *events, int max_events, int timeout) {
+#ifdef POLLER_POLL
+    int triggered = poll(poller->fds, poller->count, timeout);
+    if (triggered <= 0)
+        return (triggered < 0 && errno != EINTR) ? -1 : 0;
+
+    int n = 0;
+    for (int i=0; i<poller->count && triggered && n < max_events; i++) {
+        short revents = poller->fds[i].revents;
+        if (!revents)
+            continue;
+
+        triggered--;
+
+        if (poller->entries[i].data == poller) {
+            poller_drain_wakeup(poller);
+            continue;
+        }
+
+        events[n].data = poller->entries[i].data;
+        events[n].events = 0;
+        if (revents & POLLIN)
+            events[n].events |= POLLER_READ;
+        if (revents & POLLOUT)
+            events[n].events |= POLLER_WRITE;
+        if (revents & (POLLERR | POLLHUP | POLLNVAL))
+            events[n].events |= POLLER_ERROR | POLLER_READ;
+        n++;
+    }
+
+    return n;
+#else
+    fd_set read_fds, write_fds;
+    memcpy(&read_fds, &poller->read_fds, sizeof(read_fds));
+    memcpy(&write_fds, &poller->write_fds, sizeof(write_fds));
+
+    struct timeval tv;
+    struct timeval *tv_ptr = NULL;
+    if (timeout >= 0) {
+        tv.tv_sec = timeout / 1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
+        tv_ptr = &tv;
+    }
+
+    int triggered = select(poller->max_fd + 1, &read_fds, &write_fds, NULL, tv_ptr);
+    if (triggered <= 0)
+        return (triggered < 0 && errno != EINTR) ? -1 : 0;
+
+    int n = 0;
+    for (int i=0; i<poller->count && triggered && n < max_events; i++) {
+        int fd = poller->entries[i].fd;
+
+        int e = 0;
+        if (FD_ISSET(fd, &read_fds)) {
+            e |= POLLER_READ;
+            triggered--;
+        }
+        if (FD_ISSET(fd, &write_fds)) {
+            e |= POLLER_WRITE;
+            triggered--;
+        }
+        if (!e)
+            continue;
+
+        if (poller->entries[i].data == poller) {
+            poller_drain_wakeup(poller);
+            continue;
+        }
+
+        events[n].data = poller->entries[i].data;
+        events[n].events = e;
+        n++;
+    }
+
+    return n;
+#endif
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef __HOMEKIT_POLLER_H__
+#define __HOMEKIT_POLLER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Socket readiness notification backend for server loop.
+// Uses epoll on Linux hosts, poll() on lwIP builds that have LWIP_SOCKET_POLL
+// and falls back to select() otherwise.
+//
+// poller_wakeup() interrupts poller_wait() from another task. It uses
+// eventfd on Linux and a loopback UDP socket connected to itself on lwIP.
+
+typedef enum {
+    POLLER_READ = (1 << 0),
+    POLLER_WRITE = (1 << 1),
+    POLLER_ERROR = (1 << 2),
+} poller_events_t;
+
+
+typedef struct {
+    // Data pointer that was specified when socket was registered
+    void *data;
+    // Combination of poller_events_t flags that were triggered
+    int events;
+} poller_event_t;
+
+
+struct _poller;
+typedef struct _poller poller_t;
+
+
+poller_t *poller_new(int max_fds);
+void poller_free(poller_t *poller);
+
+int poller_add(poller_t *poller, int fd, int events, void *data);
+int poller_modify(poller_t *poller, int fd, int events, void *data);
+int poller_remove(poller_t *poller, int fd);
+
+// Waits for registered sockets to become ready. Timeout is in milliseconds,
+// negative timeout means wait forever. Returns number of events written
+// to events array, 0 on timeout or negative value on error.
+int poller_wait(poller_t *poller, poller_event_t *events, int max_events, int timeout);
+
+// Makes current or next poller_wait() return immediately. Can be called
+// from any task, repeated calls before poller_wait() returns are coalesced.
+void poller_wakeup(poller_t *poller);
+// Returns false if wakeup socket could not be created
+// (e.g. lwIP is built without loopback support)
+bool poller_can_wakeup(poller_t *poller);
+
+#endif // __HOMEKIT_POLLER_H__
@@ -6,6 +6,8 @@
 #include <esp/hwrand.h>
 #include <espressif/esp_common.h>
 #include <esplibs/libmain.h>
+#include <FreeRTOS.h>
+#include <task.h>
 #include "mdnsresponder.h"
 
 #ifndef MDNS_TTL
@@ -32,6 +34,15 @@ void homekit_overclock_end() {
     sdk_system_restoreclock();
 }
 
+int homekit_atomic_add(volatile int *value, int delta) {
+    // ESP8266 has no atomic instructions, single core
+    // makes critical section enough
+    taskENTER_CRITICAL();
+    int result = (*value += delta);
+    taskEXIT_CRITICAL();
+    return result;
+}
+
 static char mdns_instance_name[65] = {0};
 static char mdns_txt_rec[128] = {0};
 static int mdns_port = 80;
@@ -102,6 +113,10 @@ void homekit_overclock_start() {
 void homekit_overclock_end() {
 }
 
+int homekit_atomic_add(volatile int *value, int delta) {
+    return __atomic_add_fetch(value, delta, __ATOMIC_ACQ_REL);
+}
+
 void homekit_mdns_init() {
     mdns_init();
 }
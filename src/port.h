@@ -9,6 +9,9 @@ void homekit_system_restart();
 void homekit_overclock_start();
 void homekit_overclock_end();
 
+// Atomically adds delta to counter and returns new value
+int homekit_atomic_add(volatile int *value, int delta);
+
 #ifdef ESP_OPEN_RTOS
 #include <spiflash.h>
 #define ESP_OK 0
@@ -29,6 +32,103 @@ void homekit_overclock_end();
 #define SERVER_TASK_STACK 2048
 #endif
 
+// Pair setup and pair verify run in a separate task
+#ifndef CRYPTO_TASK_STACK
+#define CRYPTO_TASK_STACK SERVER_TASK_STACK
+#endif
+
+// Size of blocks client output is queued in, fits several encrypted
+// frames (1042 bytes each). Blocks are allocated only while client
+// has outgoing data.
+#ifndef HOMEKIT_CLIENT_OUTPUT_BUFFER_SIZE
+#ifdef ESP_IDF
+#define HOMEKIT_CLIENT_OUTPUT_BUFFER_SIZE ((1024 + 18) * 4)
+#else
+#define HOMEKIT_CLIENT_OUTPUT_BUFFER_SIZE ((1024 + 18) * 2)
+#endif
+#endif
+
+// Client that lets more than this number of bytes of output pile up
+// is disconnected. Should fit the largest response (accessories list).
+#ifndef HOMEKIT_CLIENT_OUTPUT_MAX_SIZE
+#define HOMEKIT_CLIENT_OUTPUT_MAX_SIZE (HOMEKIT_CLIENT_OUTPUT_BUFFER_SIZE * 8)
+#endif
+
+// Client is not sent any notifications while it has more than this
+// number of bytes not yet accepted by socket.
+#ifndef HOMEKIT_CLIENT_OUTPUT_HIGH_WATER
+#define HOMEKIT_CLIENT_OUTPUT_HIGH_WATER (HOMEKIT_CLIENT_OUTPUT_BUFFER_SIZE / 2)
+#endif
+
+// Time in milliseconds client socket can go without accepting any
+// pending output before client is disconnected.
+#ifndef HOMEKIT_CLIENT_SEND_TIMEOUT
+#define HOMEKIT_CLIENT_SEND_TIMEOUT 2000
+#endif
+
+// Size of per-client block for request scoped allocations (URL, query
+// parameters, body, TLVs, JSON buffers). Requests that need more
+// fall back to separate heap allocations.
+#ifndef HOMEKIT_CLIENT_ARENA_SIZE
+#ifdef ESP_IDF
+#define HOMEKIT_CLIENT_ARENA_SIZE 2048
+#else
+#define HOMEKIT_CLIENT_ARENA_SIZE 1024
+#endif
+#endif
+
+// Size of JSON output buffer for /accessories and write status responses,
+// every time it fills up it is sent as a separate chunk. Buffer is
+// allocated from client arena, so it has to leave room there for URL,
+// request body and the rest of request state.
+#ifndef HOMEKIT_JSON_BUFFER_SIZE
+#ifdef ESP_IDF
+#define HOMEKIT_JSON_BUFFER_SIZE 1024
+#else
+#define HOMEKIT_JSON_BUFFER_SIZE 512
+#endif
+#endif
+
+// Time in milliseconds to wait for asynchronous getters before
+// responding with timeout status for characteristics that did not complete
+#ifndef HOMEKIT_GETTER_TIMEOUT
+#define HOMEKIT_GETTER_TIMEOUT 3000
+#endif
+
+// Time in milliseconds after which connection that did not complete
+// pair verify is closed if client does not send anything
+#ifndef HOMEKIT_CLIENT_IDLE_TIMEOUT
+#define HOMEKIT_CLIENT_IDLE_TIMEOUT 30000
+#endif
+
+// Time in milliseconds after which unfinished pair setup is abandoned
+// and other controllers are allowed to pair
+#ifndef HOMEKIT_PAIRING_TIMEOUT
+#define HOMEKIT_PAIRING_TIMEOUT 60000
+#endif
+
+// Time in milliseconds to collect characteristic changes before sending
+// events to controllers. With 0 events are sent as soon as possible.
+#ifndef HOMEKIT_NOTIFICATION_BATCH_WINDOW
+#define HOMEKIT_NOTIFICATION_BATCH_WINDOW 0
+#endif
+
+// Requests with larger body are rejected
+#ifndef HOMEKIT_MAX_BODY_SIZE
+#define HOMEKIT_MAX_BODY_SIZE 4096
+#endif
+
+// Requests with longer URL (including query) are rejected
+#ifndef HOMEKIT_MAX_URL_SIZE
+#define HOMEKIT_MAX_URL_SIZE 512
+#endif
+
+// Maximum number of bytes read from one client per poll, so that
+// a client sending many requests does not delay others
+#ifndef HOMEKIT_CLIENT_READ_BUDGET
+#define HOMEKIT_CLIENT_READ_BUDGET ((1024 + 18) * 4)
+#endif
+
 
 void homekit_mdns_init();
 void homekit_mdns_configure_init(const char *instance_name, int port);
@@ -1,9 +1,25 @@
 #include <stdlib.h>
 #include <string.h>
 #include "query_params.h"
+#include "arena.h"
+
+
+static void *query_params_alloc(arena_t *arena, size_t size) {
+    return arena ? arena_alloc(arena, size) : malloc(size);
+}
+
+
+static char *query_params_strndup(arena_t *arena, const char *s, size_t length) {
+    return arena ? arena_strndup(arena, s, length) : strndup(s, length);
+}
 
 
 query_param_t *query_params_parse(const char *s) {
+    return query_params_parse_in(NULL, s);
+}
+
+
+query_param_t *query_params_parse_in(arena_t *arena, const char *s) {
     query_param_t *params = NULL;
 
     int i = 0;
@@ -15,8 +31,8 @@ query_param_t *query_params_parse(const char *s) {
             continue;
         }
 
-        query_param_t *param = malloc(sizeof(query_param_t));
-        param->name = strndup(s+pos, i-pos);
+        query_param_t *param = query_params_alloc(arena, sizeof(query_param_t));
+        param->name = query_params_strndup(arena, s+pos, i-pos);
         param->value = NULL;
         param->next = params;
         params = param;
@@ -26,7 +42,7 @@ query_param_t *query_params_parse(const char *s) {
             pos = i;
             while (s[i] && s[i] != '&' && s[i] != '#') i++;
             if (i != pos) {
-                param->value = strndup(s+pos, i-pos);
+                param->value = query_params_strndup(arena, s+pos, i-pos);
             }
         }
 
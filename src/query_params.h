@@ -8,7 +8,12 @@ typedef struct _query_param {
     struct _query_param *next;
 } query_param_t;
 
+struct _arena;
+
 query_param_t *query_params_parse(const char *s);
+// Parses query parameters allocating them from given arena.
+// Result should not be freed with query_params_free().
+query_param_t *query_params_parse_in(struct _arena *arena, const char *s);
 query_param_t *query_params_find(query_param_t *params, const char *name);
 void query_params_free(query_param_t *params);
 
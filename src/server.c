@@ -1,4 +1,6 @@
 #include <ctype.h>
+#include <float.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -13,16 +15,17 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/queue.h>
+#include <freertos/semphr.h>
 #elif defined(ESP_OPEN_RTOS)
 #include <FreeRTOS.h>
 #include <task.h>
 #include <queue.h>
+#include <semphr.h>
 #else
 #error "Unknown target platform"
 #endif
 
 #include <http-parser/http_parser.h>
-#include <cJSON.h>
 #include <wolfssl/wolfcrypt/hash.h>
 #include <wolfssl/wolfcrypt/coding.h>
 
@@ -34,6 +37,11 @@
 #include "json.h"
 #include "debug.h"
 #include "port.h"
+#include "poller.h"
+#include "arena.h"
+#include "timer_wheel.h"
+#include "output_queue.h"
+#include "server.h"
 
 #include <homekit/homekit.h>
 #include <homekit/characteristics.h>
@@ -49,12 +57,42 @@
 struct _client_context_t;
 typedef struct _client_context_t client_context_t;
 
+// Client handle combines client slot index (lower 16 bits) with slot
+// generation (upper 16 bits), so a handle to a closed client never
+// resolves to another client that later reuses the same slot.
+typedef uint32_t client_handle_t;
+
+#define CLIENT_HANDLE(slot, generation) (((uint32_t)(generation) << 16) | (slot))
+#define CLIENT_HANDLE_SLOT(handle) ((handle) & 0xffff)
+#define CLIENT_HANDLE_NONE 0
+
+// Set of clients by their slot index
+#if HOMEKIT_MAX_CLIENTS <= 32
+typedef uint32_t client_mask_t;
+#elif HOMEKIT_MAX_CLIENTS <= 64
+typedef uint64_t client_mask_t;
+#else
+#error "HOMEKIT_MAX_CLIENTS should not be greater than 64"
+#endif
+
+#define CLIENT_MASK(handle) ((client_mask_t)1 << CLIENT_HANDLE_SLOT(handle))
+
 
 #define HOMEKIT_NOTIFY_EVENT(server, event) \
   if ((server)->config->on_event) \
       (server)->config->on_event(event);
 
 
+// Effects of pair setup and pair verify that call into user code
+// or mDNS. These requests can run on crypto task, so effects are
+// recorded on client and applied by server task once request completes.
+typedef enum {
+    PAIRING_ACTION_PAIRING_ADDED = (1 << 0),
+    PAIRING_ACTION_PAIRED = (1 << 1),
+    PAIRING_ACTION_CLIENT_VERIFIED = (1 << 2),
+} pairing_action_t;
+
+
 typedef enum {
     HOMEKIT_ENDPOINT_UNKNOWN = 0,
     HOMEKIT_ENDPOINT_PAIR_SETUP,
@@ -74,7 +112,8 @@ typedef struct {
     byte *public_key;
     size_t public_key_size;
 
-    client_context_t *client;
+    // Pair setup step was accepted since expiry timer was last armed
+    bool renew_expiry;
 } pairing_context_t;
 
 
@@ -97,35 +136,128 @@ typedef struct {
     homekit_server_config_t *config;
 
     bool paired;
+    // Pairing context is owned by server task. It is handed over to pair
+    // setup request of its client and taken back once request completes,
+    // pairing_client stays set in between.
     pairing_context_t *pairing_context;
+    client_handle_t pairing_client;
 
     int listen_fd;
-    fd_set fds;
-    int max_fd;
-    int nfds;
-
-    client_context_t *clients;
+    poller_t *poller;
+
+    // Deadlines of server task: request and idle timeouts,
+    // pairing context expiry, notification batching, restart
+    timer_wheel_t *timers;
+    wheel_timer_t pairing_timer;
+    wheel_timer_t notify_timer;
+    wheel_timer_t restart_timer;
+
+    // Slot table indexed by client handle slot
+    struct {
+        client_context_t *client;
+        uint16_t generation;
+    } client_slots[HOMEKIT_MAX_CLIENTS];
+    // Stack of unused slot indexes
+    uint16_t free_slots[HOMEKIT_MAX_CLIENTS];
+    int free_slots_count;
+
+    // Connected clients, kept contiguous for iteration
+    client_context_t *clients[HOMEKIT_MAX_CLIENTS];
+    int clients_count;
+
+    // Pair setup and pair verify requests are processed by crypto task.
+    // Clients are posted to crypto_jobs and come back through crypto_results.
+    QueueHandle_t crypto_jobs;
+    QueueHandle_t crypto_results;
+    int crypto_jobs_pending;
+
+    // All characteristics indexed by their slot
+    homekit_characteristic_t **characteristics;
+    unsigned int characteristics_count;
+
+    // Latest changed value of each characteristic by slot. Notifiers
+    // store value and mark slot in event bitmap of subscribed clients,
+    // both under events_lock.
+    SemaphoreHandle_t events_lock;
+    homekit_value_t *event_values;
+    // Clients subscribed to each characteristic by slot, modified
+    // by server task under events_lock
+    client_mask_t *subscribers;
+
+    // JSON body of EVENT message, built once for all clients
+    // that have the same set of changed characteristics
+    byte *event_body;
+    size_t event_body_size;
+    size_t event_body_length;
+    bool event_body_failed;
+
+    // Values reported by asynchronous getters
+    QueueHandle_t getter_results;
+    // Number of clients waiting for asynchronous getters
+    int deferred_count;
 } homekit_server_t;
 
 
 struct _client_context_t {
     homekit_server_t *server;
+    client_handle_t handle;
+    // Position in server->clients array
+    int index;
     int socket;
     homekit_endpoint_t endpoint;
     query_param_t *endpoint_params;
 
+    // Request URL allocated from arena, collected from all pieces
+    // parser reports it in
+    char *url;
+    size_t url_length;
+
     byte *data;
     size_t data_size;
     size_t data_available;
-
+    // Number of bytes at the start of data that are already decrypted,
+    // left after parser was paused in the middle of a frame
+    size_t data_decrypted;
+
+    // Data waiting to be written to socket, socket is watched
+    // for writability while it is not empty
+    output_queue_t output;
+    // Socket accepted some data since last client_flush()
+    bool output_progress;
+    int poller_events;
+
+    // Request scoped allocations, released when request is processed
+    arena_t *arena;
+
+    // Body either points into data buffer (if it was received in one piece)
+    // or is allocated from arena with size taken from Content-Length header
     char *body;
     size_t body_length;
+    size_t body_size;
     http_parser *parser;
 
+    // End of data being parsed and whether byte right after it
+    // can be overwritten to NUL-terminate body in place
+    char *parse_end;
+    bool parse_end_writable;
+
     int pairing_id;
     byte permissions;
 
     bool disconnect;
+    // Request is being processed by crypto task, client must not be
+    // touched by server task until it is resumed
+    bool suspended;
+    // Response is waiting for asynchronous getters listed in reads
+    bool deferred;
+    struct _characteristic_reads *reads;
+
+    // Fires when asynchronous getters take too long
+    wheel_timer_t request_timer;
+    // Fires when connection stays idle before pair verify
+    wheel_timer_t idle_timer;
+    // Fires when socket does not accept pending output for too long
+    wheel_timer_t send_timer;
 
     homekit_characteristic_t *current_characteristic;
     homekit_value_t *current_value;
@@ -136,13 +268,30 @@ struct _client_context_t {
     int count_reads;
     int count_writes;
 
-    QueueHandle_t event_queue;
+    // Bitmap of characteristic slots changed since last EVENT
+    // was sent to client, guarded by server events_lock
+    uint32_t *events;
+    volatile bool events_pending;
+    // Changes taken from events bitmap that are being sent
+    uint32_t *events_batch;
+    // Bitmap of characteristic slots client is subscribed to
+    uint32_t *subscriptions;
+
     pair_verify_context_t *verify_context;
 
-    struct _client_context_t *next;
+    // Pairing state handed to pair setup request, which can run on
+    // crypto task: pairing context if it belongs to this client and
+    // client that owned pairing context when request was dispatched
+    pairing_context_t *pairing_context;
+    client_handle_t pairing_client;
+    // Set of pairing_action_t to apply after request completes
+    int pairing_actions;
 };
 
 
+#define EVENT_WORDS(count) (((count) + 31) / 32)
+
+
 typedef struct {
     homekit_characteristic_t *characteristic;
     homekit_value_t value;
@@ -152,18 +301,60 @@ typedef struct {
 void client_context_free(client_context_t *c);
 void pairing_context_free(pairing_context_t *context);
 
+void homekit_server_on_pairing_timeout(wheel_timer_t *timer, void *arg);
+void homekit_server_on_notify_timer(wheel_timer_t *timer, void *arg);
+void homekit_server_on_restart_timer(wheel_timer_t *timer, void *arg);
+void homekit_client_on_request_timeout(wheel_timer_t *timer, void *arg);
+void homekit_client_on_idle_timeout(wheel_timer_t *timer, void *arg);
+void homekit_client_on_send_timeout(wheel_timer_t *timer, void *arg);
+
+
+// Current time in milliseconds for server timers
+static inline uint32_t homekit_server_time() {
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
 
 homekit_server_t *server_new() {
     homekit_server_t *server = malloc(sizeof(homekit_server_t));
-    FD_ZERO(&server->fds);
-    server->max_fd = 0;
-    server->nfds = 0;
+    server->poller = NULL;
+    server->timers = NULL;
+    wheel_timer_init(&server->pairing_timer, homekit_server_on_pairing_timeout, server);
+    wheel_timer_init(&server->notify_timer, homekit_server_on_notify_timer, server);
+    wheel_timer_init(&server->restart_timer, homekit_server_on_restart_timer, server);
     server->accessory_id = NULL;
     server->accessory_key = NULL;
     server->config = NULL;
     server->paired = false;
     server->pairing_context = NULL;
-    server->clients = NULL;
+    server->pairing_client = CLIENT_HANDLE_NONE;
+
+    for (int i=0; i<HOMEKIT_MAX_CLIENTS; i++) {
+        server->client_slots[i].client = NULL;
+        server->client_slots[i].generation = 1;
+        server->free_slots[i] = HOMEKIT_MAX_CLIENTS - 1 - i;
+    }
+    server->free_slots_count = HOMEKIT_MAX_CLIENTS;
+    server->clients_count = 0;
+
+    server->crypto_jobs = NULL;
+    server->crypto_results = NULL;
+    server->crypto_jobs_pending = 0;
+
+    server->characteristics = NULL;
+    server->characteristics_count = 0;
+    server->events_lock = NULL;
+    server->event_values = NULL;
+    server->subscribers = NULL;
+
+    server->event_body = NULL;
+    server->event_body_size = 0;
+    server->event_body_length = 0;
+    server->event_body_failed = false;
+
+    server->getter_results = NULL;
+    server->deferred_count = 0;
+
     return server;
 }
 
@@ -178,23 +369,48 @@ void server_free(homekit_server_t *server) {
     if (server->pairing_context)
         pairing_context_free(server->pairing_context);
 
-    if (server->clients) {
-        client_context_t *client = server->clients;
-        while (client) {
-            client_context_t *next = client->next;
-            client_context_free(client);
-            client = next;
-        }
+    if (server->poller)
+        poller_free(server->poller);
+
+    for (int i=0; i<server->clients_count; i++) {
+        client_context_free(server->clients[i]);
+    }
+
+    if (server->timers)
+        timer_wheel_free(server->timers);
+
+    if (server->event_values) {
+        for (unsigned int i=0; i<server->characteristics_count; i++)
+            homekit_value_destruct(&server->event_values[i]);
+        free(server->event_values);
     }
 
+    if (server->characteristics)
+        free(server->characteristics);
+
+    if (server->subscribers)
+        free(server->subscribers);
+
+    if (server->event_body)
+        free(server->event_body);
+
+    if (server->events_lock)
+        vSemaphoreDelete(server->events_lock);
+
     free(server);
 }
 
-#ifdef HOMEKIT_DEBUG
-#define TLV_DEBUG(values) tlv_debug(values)
-#else
-#define TLV_DEBUG(values)
-#endif
+#define TLV_DEBUG(values) \
+    do { \
+        if (DEBUG_ENABLED()) \
+            tlv_debug(values); \
+    } while (0)
+
+#define TLV_READER_DEBUG(reader) \
+    do { \
+        if (DEBUG_ENABLED()) \
+            tlv_reader_debug(reader); \
+    } while (0)
 
 #define CLIENT_DEBUG(client, message, ...) DEBUG("[Client %d] " message, client->socket, ##__VA_ARGS__)
 #define CLIENT_INFO(client, message, ...) INFO("[Client %d] " message, client->socket, ##__VA_ARGS__)
@@ -209,6 +425,24 @@ void tlv_debug(const tlv_values_t *values) {
     }
 }
 
+void tlv_reader_debug(const tlv_reader_t *reader) {
+    DEBUG("Got following TLV values:");
+    for (size_t i=0; i < reader->count; i++) {
+        const tlv_item_t *item = &reader->items[i];
+        if (item->fragmented) {
+            DEBUG("Type %d value (%d bytes, fragmented)", item->type, item->size);
+            continue;
+        }
+
+        char *escaped_payload = binary_to_string(reader->buffer + item->offset, item->size);
+        DEBUG("Type %d value (%d bytes): %s", item->type, item->size, escaped_payload);
+        free(escaped_payload);
+    }
+}
+
+// Pairing requests carry only a handful of items
+#define TLV_MAX_ITEMS 16
+
 
 typedef enum {
     TLVType_Method = 0,        // (integer) Method to use for pairing. See PairMethod
@@ -323,18 +557,34 @@ void pair_verify_context_free(pair_verify_context_t *context) {
 client_context_t *client_context_new() {
     client_context_t *c = malloc(sizeof(client_context_t));
     c->server = NULL;
+    c->handle = CLIENT_HANDLE_NONE;
+    c->index = -1;
+    c->endpoint = HOMEKIT_ENDPOINT_UNKNOWN;
     c->endpoint_params = NULL;
+    c->url = NULL;
+    c->url_length = 0;
 
     c->data_size = 1024 + 18;
     c->data_available = 0;
+    c->data_decrypted = 0;
     c->data = malloc(c->data_size);
 
+    output_queue_init(&c->output, HOMEKIT_CLIENT_OUTPUT_BUFFER_SIZE, HOMEKIT_CLIENT_OUTPUT_MAX_SIZE);
+    c->output_progress = false;
+    c->poller_events = POLLER_READ;
+
+    c->arena = arena_new(HOMEKIT_CLIENT_ARENA_SIZE);
+
     c->body = NULL;
     c->body_length = 0;
+    c->body_size = 0;
     c->parser = malloc(sizeof(*c->parser));
     http_parser_init(c->parser, HTTP_REQUEST);
     c->parser->data = c;
 
+    c->parse_end = NULL;
+    c->parse_end_writable = false;
+
     c->pairing_id = -1;
     c->encrypted = false;
     c->read_key = NULL;
@@ -343,11 +593,24 @@ client_context_t *client_context_new() {
     c->count_writes = 0;
 
     c->disconnect = false;
+    c->suspended = false;
+    c->deferred = false;
+    c->reads = NULL;
+
+    wheel_timer_init(&c->request_timer, homekit_client_on_request_timeout, c);
+    wheel_timer_init(&c->idle_timer, homekit_client_on_idle_timeout, c);
+    wheel_timer_init(&c->send_timer, homekit_client_on_send_timeout, c);
+
+    c->events = NULL;
+    c->events_pending = false;
+    c->events_batch = NULL;
+    c->subscriptions = NULL;
 
-    c->event_queue = xQueueCreate(20, sizeof(characteristic_event_t*));
     c->verify_context = NULL;
 
-    c->next = NULL;
+    c->pairing_context = NULL;
+    c->pairing_client = CLIENT_HANDLE_NONE;
+    c->pairing_actions = 0;
 
     return c;
 }
@@ -363,11 +626,20 @@ void client_context_free(client_context_t *c) {
     if (c->verify_context)
         pair_verify_context_free(c->verify_context);
 
-    if (c->event_queue)
-        vQueueDelete(c->event_queue);
+    if (c->pairing_context)
+        pairing_context_free(c->pairing_context);
+
+    if (c->events)
+        free(c->events);
+
+    if (c->events_batch)
+        free(c->events_batch);
 
-    if (c->endpoint_params)
-        query_params_free(c->endpoint_params);
+    if (c->subscriptions)
+        free(c->subscriptions);
+
+    if (c->arena)
+        arena_free(c->arena);
 
     if (c->parser)
         free(c->parser);
@@ -375,8 +647,7 @@ void client_context_free(client_context_t *c) {
     if (c->data)
         free(c->data);
 
-    if (c->body)
-        free(c->body);
+    output_queue_clear(&c->output);
 
     free(c);
 }
@@ -387,9 +658,9 @@ void client_context_free(client_context_t *c) {
 pairing_context_t *pairing_context_new() {
     pairing_context_t *context = malloc(sizeof(pairing_context_t));
     context->srp = crypto_srp_new();
-    context->client = NULL;
     context->public_key = NULL;
     context->public_key_size = 0;
+    context->renew_expiry = false;
     return context;
 }
 
@@ -404,7 +675,7 @@ void pairing_context_free(pairing_context_t *context) {
 }
 
 
-void client_notify_characteristic(homekit_characteristic_t *ch, homekit_value_t value, void *client);
+bool client_is_subscribed(client_context_t *context, const homekit_characteristic_t *ch);
 
 
 typedef enum {
@@ -415,6 +686,45 @@ typedef enum {
 } characteristic_format_t;
 
 
+// Characteristic requested by GET /characteristics
+typedef struct {
+    int aid;
+    int iid;
+    homekit_characteristic_t *ch;
+    HAPStatus status;
+    // Value is not yet reported by asynchronous getter
+    bool pending;
+    // Value was obtained from asynchronous getter
+    bool has_value;
+    homekit_value_t value;
+} characteristic_read_t;
+
+
+typedef struct _characteristic_reads {
+    characteristic_format_t format;
+    int count;
+    int pending_count;
+
+    characteristic_read_t reads[];
+} characteristic_reads_t;
+
+
+// Releases values obtained from asynchronous getters,
+// reads themselves are allocated from request arena
+void characteristic_reads_free(client_context_t *context) {
+    characteristic_reads_t *reads = context->reads;
+    if (!reads)
+        return;
+
+    for (int i=0; i<reads->count; i++) {
+        if (reads->reads[i].has_value)
+            homekit_value_destruct(&reads->reads[i].value);
+    }
+
+    context->reads = NULL;
+}
+
+
 void write_characteristic_json(json_stream *json, client_context_t *client, const homekit_characteristic_t *ch, characteristic_format_t format, const homekit_value_t *value) {
     json_string(json, "aid"); json_integer(json, ch->service->accessory->id);
     json_string(json, "iid"); json_integer(json, ch->id);
@@ -441,7 +751,7 @@ void write_characteristic_json(json_stream *json, client_context_t *client, cons
     }
 
     if ((format & characteristic_format_events) && (ch->permissions & homekit_permissions_notify)) {
-        bool events = homekit_characteristic_has_notify_callback(ch, client_notify_characteristic, client);
+        bool events = client_is_subscribed(client, ch);
         json_string(json, "ev"); json_boolean(json, events);
     }
 
@@ -552,7 +862,7 @@ void write_characteristic_json(json_stream *json, client_context_t *client, cons
                     break;
                 }
                 case homekit_format_string: {
-                    json_string(json, "value"); json_string(json, v.string_value);
+                    json_string(json, "value"); json_string(json, homekit_value_string(&v));
                     break;
                 }
                 case homekit_format_tlv: {
@@ -595,9 +905,97 @@ void write_characteristic_json(json_stream *json, client_context_t *client, cons
 }
 
 
+// Writes as much pending output as socket accepts without blocking.
+int client_output_write(client_context_t *context) {
+    int r = output_queue_write(&context->output, context->socket);
+    if (r < 0) {
+        CLIENT_ERROR(context, "Error writing data to socket (code %d). Disconnecting", errno);
+        output_queue_clear(&context->output);
+        context->disconnect = true;
+        return -1;
+    }
+
+    if (r)
+        context->output_progress = true;
+
+    return 0;
+}
+
+
+// Returns pointer to at least size bytes of contiguous free space
+// after pending client output. Output that socket does not accept
+// is queued, client is disconnected once queue exceeds
+// HOMEKIT_CLIENT_OUTPUT_MAX_SIZE.
+byte *client_output_reserve(client_context_t *context, size_t size) {
+    if (context->disconnect)
+        return NULL;
+
+    // Let socket take what it can before queueing another block
+    if (output_queue_free_space(&context->output) < size && client_output_write(context))
+        return NULL;
+
+    byte *data = output_queue_reserve(&context->output, size);
+    if (!data) {
+        if (context->output.length + size > context->output.max_length) {
+            CLIENT_ERROR(context, "Client does not read responses (%d bytes pending). Disconnecting",
+                         context->output.length);
+        } else {
+            CLIENT_ERROR(context, "Failed to allocate output block of size %d", context->output.block_size);
+        }
+        output_queue_clear(&context->output);
+        context->disconnect = true;
+        return NULL;
+    }
+
+    return data;
+}
+
+
+void client_update_poller_events(client_context_t *context) {
+    if (context->disconnect)
+        return;
+
+    int events = 0;
+    // Stop reading requests while client does not read responses
+    // or while current request is waiting for values
+    if (context->output.length <= HOMEKIT_CLIENT_OUTPUT_HIGH_WATER && !context->deferred)
+        events |= POLLER_READ;
+    if (context->output.length)
+        events |= POLLER_WRITE;
+
+    if (events != context->poller_events) {
+        poller_modify(context->server->poller, context->socket, events, context);
+        context->poller_events = events;
+    }
+}
+
+
+// Writes pending output without blocking. Output blocks are released once
+// all data is written, otherwise rest is written when socket becomes writable.
+void client_flush(client_context_t *context) {
+    client_output_write(context);
+
+    timer_wheel_t *timers = context->server->timers;
+    if (!context->output.length) {
+        output_queue_clear(&context->output);
+        timer_wheel_cancel(timers, &context->send_timer);
+    } else if (context->output_progress || !wheel_timer_active(&context->send_timer)) {
+        timer_wheel_schedule(
+            timers, &context->send_timer,
+            homekit_server_time() + HOMEKIT_CLIENT_SEND_TIMEOUT
+        );
+    }
+    context->output_progress = false;
+
+    client_update_poller_events(context);
+}
+
+
+// Splits given data into frames of up to 1024 bytes and encrypts them
+// in place inside client output queue.
 int client_send_encrypted(
     client_context_t *context,
-    byte *payload, size_t size
+    const struct iovec *iov, int iovcnt
 ) {
     if (!context || !context->encrypted || !context->read_key)
         return -1;
@@ -605,164 +1003,273 @@ int client_send_encrypted(
     byte nonce[12];
     memset(nonce, 0, sizeof(nonce));
 
-    byte encrypted[1024 + 18];
-    int payload_offset = 0;
+    int i = 0;
+    size_t iov_offset = 0;
+
+    while (i < iovcnt) {
+        byte *frame = client_output_reserve(context, 1024 + 18);
+        if (!frame)
+            return -1;
+
+        size_t chunk_size = 0;
+        while (chunk_size < 1024 && i < iovcnt) {
+            size_t size = iov[i].iov_len - iov_offset;
+            if (size > 1024 - chunk_size)
+                size = 1024 - chunk_size;
+
+            memcpy(frame + 2 + chunk_size, (byte *)iov[i].iov_base + iov_offset, size);
+            chunk_size += size;
+            iov_offset += size;
 
-    while (payload_offset < size) {
-        size_t chunk_size = size - payload_offset;
-        if (chunk_size > 1024)
-            chunk_size = 1024;
+            if (iov_offset == iov[i].iov_len) {
+                i++;
+                iov_offset = 0;
+            }
+        }
 
-        byte aead[2] = {chunk_size % 256, chunk_size / 256};
+        if (!chunk_size)
+            break;
 
-        memcpy(encrypted, aead, 2);
+        frame[0] = chunk_size % 256;
+        frame[1] = chunk_size / 256;
 
-        byte i = 4;
+        byte n = 4;
         int x = context->count_reads++;
         while (x) {
-            nonce[i++] = x % 256;
+            nonce[n++] = x % 256;
             x /= 256;
         }
 
-        size_t available = sizeof(encrypted) - 2;
+        size_t available = chunk_size + 16;
         int r = crypto_chacha20poly1305_encrypt(
-            context->read_key, nonce, aead, 2,
-            payload+payload_offset, chunk_size,
-            encrypted+2, &available
+            context->read_key, nonce, frame, 2,
+            frame+2, chunk_size,
+            frame+2, &available
         );
         if (r) {
             ERROR("Failed to chacha encrypt payload (code %d)", r);
             return -1;
         }
 
-        payload_offset += chunk_size;
-
-        write(context->socket, encrypted, available + 2);
+        output_queue_commit(&context->output, available + 2);
     }
 
     return 0;
 }
 
 
-int client_decrypt(
+// Decrypts a single frame at the beginning of data in place: decrypted payload
+// replaces ciphertext starting at data+2. Returns number of bytes the frame
+// occupies (so next frame starts there), 0 if data does not contain complete
+// frame yet, or negative value on error.
+int client_decrypt_frame(
     client_context_t *context,
-    byte *payload, size_t payload_size,
-    byte *decrypted, size_t *decrypted_size
+    byte *data, size_t data_size,
+    size_t *payload_size
 ) {
     if (!context || !context->encrypted || !context->write_key)
         return -1;
 
-    const size_t block_size = 1024 + 16 + 2;
-    size_t required_decrypted_size =
-        payload_size / block_size * 1024 + payload_size % block_size - 16 - 2;
-    if (*decrypted_size < required_decrypted_size) {
-        *decrypted_size = required_decrypted_size;
-        return -2;
-    }
+    if (data_size < 2)
+        return 0;
 
-    *decrypted_size = required_decrypted_size;
+    size_t chunk_size = data[0] + data[1]*256;
+    if (chunk_size > 1024)
+        return -1;
+
+    if (chunk_size + 18 > data_size)
+        // Unfinished frame
+        return 0;
 
     byte nonce[12];
     memset(nonce, 0, sizeof(nonce));
 
-    int payload_offset = 0;
-    int decrypted_offset = 0;
+    byte i = 4;
+    int x = context->count_writes++;
+    while (x) {
+        nonce[i++] = x % 256;
+        x /= 256;
+    }
 
-    while (payload_offset < payload_size) {
-        size_t chunk_size = payload[payload_offset] + payload[payload_offset+1]*256;
-        if (chunk_size+18 > payload_size-payload_offset) {
-            // Unfinished chunk
-            break;
-        }
+    size_t decrypted_len = chunk_size;
+    int r = crypto_chacha20poly1305_decrypt(
+        context->write_key, nonce, data, 2,
+        data+2, chunk_size + 16,
+        data+2, &decrypted_len
+    );
+    if (r) {
+        ERROR("Failed to chacha decrypt payload (code %d)", r);
+        return -1;
+    }
 
-        byte i = 4;
-        int x = context->count_writes++;
-        while (x) {
-            nonce[i++] = x % 256;
-            x /= 256;
-        }
+    *payload_size = decrypted_len;
 
-        size_t decrypted_len = *decrypted_size - decrypted_offset;
-        int r = crypto_chacha20poly1305_decrypt(
-            context->write_key, nonce, payload+payload_offset, 2,
-            payload+payload_offset+2, chunk_size + 16,
-            decrypted, &decrypted_len
-        );
-        if (r) {
-            ERROR("Failed to chacha decrypt payload (code %d)", r);
-            return -1;
-        }
+    return chunk_size + 18;  // 2 bytes of size + 16 bytes of auth tag
+}
 
-        decrypted_offset += decrypted_len;
-        payload_offset += chunk_size + 0x12; // 0x10 is for some auth bytes
-    }
 
-    return payload_offset;
+void homekit_setup_mdns(homekit_server_t *server);
+
+
+static homekit_server_t *running_server = NULL;
+
+
+bool client_is_subscribed(client_context_t *context, const homekit_characteristic_t *ch) {
+    return context->subscriptions[ch->slot / 32] & (1u << (ch->slot % 32));
 }
 
 
-void homekit_setup_mdns(homekit_server_t *server);
+void client_subscribe(client_context_t *context, homekit_characteristic_t *ch, bool subscribe) {
+    homekit_server_t *server = context->server;
+    uint32_t bit = 1u << (ch->slot % 32);
+
+    xSemaphoreTake(server->events_lock, portMAX_DELAY);
+    if (subscribe) {
+        server->subscribers[ch->slot] |= CLIENT_MASK(context->handle);
+        context->subscriptions[ch->slot / 32] |= bit;
+    } else {
+        server->subscribers[ch->slot] &= ~CLIENT_MASK(context->handle);
+        context->subscriptions[ch->slot / 32] &= ~bit;
+    }
+    xSemaphoreGive(server->events_lock);
+}
 
 
-void client_notify_characteristic(homekit_characteristic_t *ch, homekit_value_t value, void *context) {
-    client_context_t *client = context;
+// Removes client from subscribers of all characteristics it is
+// subscribed to. After that notifiers no longer reference the client.
+void client_unsubscribe_all(client_context_t *context) {
+    homekit_server_t *server = context->server;
+    if (!context->subscriptions)
+        return;
+
+    xSemaphoreTake(server->events_lock, portMAX_DELAY);
+    for (unsigned int i=0; i<EVENT_WORDS(server->characteristics_count); i++) {
+        uint32_t bits = context->subscriptions[i];
+        while (bits) {
+            unsigned int slot = i * 32 + __builtin_ctz(bits);
+            bits &= bits - 1;
+
+            server->subscribers[slot] &= ~CLIENT_MASK(context->handle);
+        }
+        context->subscriptions[i] = 0;
+    }
+    xSemaphoreGive(server->events_lock);
+}
+
+
+void homekit_server_notify_characteristic(homekit_characteristic_t *ch, homekit_value_t value) {
+    homekit_server_t *server = running_server;
+    if (!server)
+        return;
 
-    if (client->current_characteristic == ch && client->current_value && homekit_value_equal(client->current_value, &value))
-        // This value is set by this client, no need to send notification
+    if (ch->slot >= server->characteristics_count || server->characteristics[ch->slot] != ch)
         return;
 
     DEBUG("Got characteristic %d.%d change event", ch->service->accessory->id, ch->id);
 
-    if (!client->event_queue) {
-        ERROR("Client has no event queue. Skipping notification");
+    xSemaphoreTake(server->events_lock, portMAX_DELAY);
+
+    client_mask_t subscribers = server->subscribers[ch->slot];
+    if (!subscribers) {
+        xSemaphoreGive(server->events_lock);
         return;
     }
 
-    characteristic_event_t *event = malloc(sizeof(characteristic_event_t));
-    event->characteristic = ch;
-    homekit_value_copy(&event->value, &value);
+    // Repeated changes overwrite value and set the same bit,
+    // so nothing piles up while client is not reading
+    homekit_value_t *latest = &server->event_values[ch->slot];
+    if (!homekit_value_equal(latest, &value)) {
+        homekit_value_destruct(latest);
+        homekit_value_copy_compact(latest, &value);
+    }
+
+    bool notified = false;
+    while (subscribers) {
+        int slot = __builtin_ctzll(subscribers);
+        subscribers &= subscribers - 1;
+
+        client_context_t *client = server->client_slots[slot].client;
+        if (!client)
+            continue;
+
+        if (client->current_characteristic == ch && client->current_value &&
+                homekit_value_equal(client->current_value, &value))
+            // This value is set by this client, no need to send notification
+            continue;
+
+        DEBUG("Sending event to client %d", client->socket);
+
+        client->events[ch->slot / 32] |= 1u << (ch->slot % 32);
+        client->events_pending = true;
+        notified = true;
+    }
 
-    DEBUG("Sending event to client %d", client->socket);
+    xSemaphoreGive(server->events_lock);
 
-    xQueueSendToBack(client->event_queue, &event, 10);
+    if (notified)
+        // Send event right away instead of on next poll timeout
+        poller_wakeup(server->poller);
 }
 
 
-void client_send(client_context_t *context, byte *data, size_t data_size) {
-#if HOMEKIT_DEBUG
-    if (data_size < 4096) {
-        char *payload = binary_to_string(data, data_size);
-        CLIENT_DEBUG(context, "Sending payload: %s", payload);
-        free(payload);
+// Sends data composed of multiple pieces. Data is accumulated in client
+// output queue and is written to socket by client_flush().
+void client_send_iov(client_context_t *context, const struct iovec *iov, int iovcnt) {
+    if (DEBUG_ENABLED()) {
+        for (int i=0; i<iovcnt; i++) {
+            if (iov[i].iov_len && iov[i].iov_len < 4096) {
+                char *payload = binary_to_string(iov[i].iov_base, iov[i].iov_len);
+                CLIENT_DEBUG(context, "Sending payload: %s", payload);
+                free(payload);
+            }
+        }
     }
-#endif
 
     if (context->encrypted) {
-        int r = client_send_encrypted(context, data, data_size);
+        int r = client_send_encrypted(context, iov, iovcnt);
         if (r) {
             CLIENT_ERROR(context, "Failed to encrypt response (code %d)", r);
             return;
         }
     } else {
-        write(context->socket, data, data_size);
+        for (int i=0; i<iovcnt; i++) {
+            size_t offset = 0;
+            while (offset < iov[i].iov_len) {
+                size_t size = iov[i].iov_len - offset;
+                if (size > 1024)
+                    size = 1024;
+
+                byte *output = client_output_reserve(context, size);
+                if (!output)
+                    return;
+
+                memcpy(output, (byte *)iov[i].iov_base + offset, size);
+                output_queue_commit(&context->output, size);
+                offset += size;
+            }
+        }
     }
 }
 
 
-void client_send_chunk(byte *data, size_t size, void *arg) {
-    client_context_t *context = arg;
+void client_send(client_context_t *context, byte *data, size_t data_size) {
+    struct iovec iov = { data, data_size };
+    client_send_iov(context, &iov, 1);
+}
 
-    size_t payload_size = size + 8;
-    byte *payload = malloc(payload_size);
 
-    int offset = snprintf((char *)payload, payload_size, "%x\r\n", size);
-    memcpy(payload + offset, data, size);
-    payload[offset + size] = '\r';
-    payload[offset + size + 1] = '\n';
+void client_send_chunk(byte *data, size_t size, void *arg) {
+    client_context_t *context = arg;
 
-    client_send(context, payload, offset + size + 2);
+    char chunk_header[12];
+    int chunk_header_size = snprintf(chunk_header, sizeof(chunk_header), "%x\r\n", size);
 
-    free(payload);
+    struct iovec iov[] = {
+        { chunk_header, chunk_header_size },
+        { data, size },
+        { "\r\n", 2 },
+    };
+    client_send_iov(context, iov, 3);
 }
 
 
@@ -776,39 +1283,77 @@ void send_404_response(client_context_t *context) {
     client_send(context, (byte *)response, sizeof(response)-1);
 }
 
+void send_413_response(client_context_t *context) {
+    static char response[] = "HTTP/1.1 413 Payload Too Large\r\nConnection: close\r\n\r\n";
+    client_send(context, (byte *)response, sizeof(response)-1);
+}
 
-typedef struct _client_event {
-    const homekit_characteristic_t *characteristic;
-    homekit_value_t value;
+void send_414_response(client_context_t *context) {
+    static char response[] = "HTTP/1.1 414 URI Too Long\r\nConnection: close\r\n\r\n";
+    client_send(context, (byte *)response, sizeof(response)-1);
+}
 
-    struct _client_event *next;
-} client_event_t;
+void send_500_response(client_context_t *context) {
+    static char response[] = "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n";
+    client_send(context, (byte *)response, sizeof(response)-1);
+}
 
 
-void send_client_events(client_context_t *context, client_event_t *events) {
-    CLIENT_DEBUG(context, "Sending EVENT");
-    DEBUG_HEAP();
+static void event_body_append(uint8_t *data, size_t size, void *arg) {
+    homekit_server_t *server = arg;
+    if (server->event_body_failed)
+        return;
+
+    if (server->event_body_length + size > server->event_body_size) {
+        size_t new_size = server->event_body_size ? server->event_body_size * 2 : 256;
+        while (new_size < server->event_body_length + size)
+            new_size *= 2;
+
+        byte *new_body = realloc(server->event_body, new_size);
+        if (!new_body) {
+            ERROR("Failed to allocate %d bytes for EVENT body", new_size);
+            server->event_body_failed = true;
+            return;
+        }
+
+        server->event_body = new_body;
+        server->event_body_size = new_size;
+    }
+
+    memcpy(server->event_body + server->event_body_length, data, size);
+    server->event_body_length += size;
+}
 
-    static byte http_headers[] =
-        "EVENT/1.0 200 OK\r\n"
-        "Content-Type: application/hap+json\r\n"
-        "Transfer-Encoding: chunked\r\n\r\n";
 
-    client_send(context, http_headers, sizeof(http_headers)-1);
+// Serializes latest values of given characteristic slots into server->event_body
+int homekit_server_build_event(homekit_server_t *server, const uint32_t *events) {
+    server->event_body_length = 0;
+    server->event_body_failed = false;
+
+    json_stream *json = json_new(256, event_body_append, server);
+    if (!json)
+        return -1;
 
-    // ~35 bytes per event JSON
-    // 256 should be enough for ~7 characteristic updates
-    json_stream *json = json_new(256, client_send_chunk, context);
     json_object_start(json);
     json_string(json, "characteristics"); json_array_start(json);
 
-    client_event_t *e = events;
-    while (e) {
-        json_object_start(json);
-        write_characteristic_json(json, context, e->characteristic, 0, &e->value);
-        json_object_end(json);
+    for (unsigned int i=0; i<EVENT_WORDS(server->characteristics_count); i++) {
+        uint32_t bits = events[i];
+        while (bits) {
+            unsigned int slot = i * 32 + __builtin_ctz(bits);
+            bits &= bits - 1;
+
+            homekit_value_t value;
+            xSemaphoreTake(server->events_lock, portMAX_DELAY);
+            homekit_value_copy_compact(&value, &server->event_values[slot]);
+            xSemaphoreGive(server->events_lock);
+
+            json_object_start(json);
+            write_characteristic_json(json, NULL, server->characteristics[slot], 0, &value);
+            json_object_end(json);
 
-        e = e->next;
+            homekit_value_destruct(&value);
+        }
     }
 
     json_array_end(json);
@@ -817,62 +1362,106 @@ void send_client_events(client_context_t *context, client_event_t *events) {
     json_flush(json);
     json_free(json);
 
-    client_send_chunk(NULL, 0, context);
+    return server->event_body_failed ? -1 : 0;
+}
+
+
+// Sends EVENT with body from server->event_body, only encryption is per client
+void send_client_event(client_context_t *context) {
+    homekit_server_t *server = context->server;
+
+    CLIENT_DEBUG(context, "Sending EVENT");
+    DEBUG_HEAP();
+
+    static byte http_headers[] =
+        "EVENT/1.0 200 OK\r\n"
+        "Content-Type: application/hap+json\r\n"
+        "Transfer-Encoding: chunked\r\n\r\n";
+
+    char chunk_header[12];
+    int chunk_header_size = snprintf(chunk_header, sizeof(chunk_header), "%x\r\n", server->event_body_length);
+
+    struct iovec iov[] = {
+        { http_headers, sizeof(http_headers)-1 },
+        { chunk_header, chunk_header_size },
+        { server->event_body, server->event_body_length },
+        { "\r\n0\r\n\r\n", 7 },
+    };
+    client_send_iov(context, iov, 4);
 }
 
 
-void send_tlv_response(client_context_t *context, tlv_values_t *values);
+void send_tlv_payload(client_context_t *context, const byte *payload, size_t payload_size);
 
 void send_tlv_error_response(client_context_t *context, int state, TLVError error) {
-    tlv_values_t *response = tlv_new();
-    tlv_add_integer_value(response, TLVType_State, 1, state);
-    tlv_add_integer_value(response, TLVType_Error, 1, error);
+    byte payload[6];
+    tlv_writer_t response;
+    tlv_writer_init(&response, payload, sizeof(payload));
+    tlv_writer_add_integer(&response, TLVType_State, 1, state);
+    tlv_writer_add_integer(&response, TLVType_Error, 1, error);
 
-    send_tlv_response(context, response);
+    send_tlv_payload(context, response.buffer, response.length);
 }
 
 
 void send_tlv_response(client_context_t *context, tlv_values_t *values) {
+    if (!values) {
+        CLIENT_ERROR(context, "Failed to allocate TLV response");
+        send_500_response(context);
+        return;
+    }
+
     CLIENT_DEBUG(context, "Sending TLV response");
     TLV_DEBUG(values);
 
     size_t payload_size = 0;
     tlv_format(values, NULL, &payload_size);
 
-    byte *payload = malloc(payload_size);
+    byte *payload = arena_alloc(context->arena, payload_size);
+    if (!payload) {
+        CLIENT_ERROR(context, "Failed to allocate %d bytes for TLV payload", payload_size);
+        tlv_free(values);
+        send_500_response(context);
+        return;
+    }
+
     int r = tlv_format(values, payload, &payload_size);
     if (r) {
         CLIENT_ERROR(context, "Failed to format TLV payload (code %d)", r);
-        free(payload);
+        tlv_free(values);
+        send_500_response(context);
         return;
     }
 
     tlv_free(values);
 
+    send_tlv_payload(context, payload, payload_size);
+}
+
+
+// Sets up writer over buffer of given size allocated from request arena.
+// Failed allocation shows up as writer overflow.
+void client_tlv_writer_init(client_context_t *context, tlv_writer_t *writer, size_t size) {
+    tlv_writer_init(writer, arena_alloc(context->arena, size), size);
+}
+
+
+// Sends TLV payload that was formatted by caller
+void send_tlv_payload(client_context_t *context, const byte *payload, size_t payload_size) {
     static char *http_headers =
         "HTTP/1.1 200 OK\r\n"
         "Content-Type: application/pairing+tlv8\r\n"
         "Content-Length: %d\r\n"
         "Connection: keep-alive\r\n\r\n";
 
-    int response_size = strlen(http_headers) + payload_size + 32;
-    char *response = malloc(response_size);
-    int response_len = snprintf(response, response_size, http_headers, payload_size);
-
-    if (response_size - response_len < payload_size + 1) {
-        CLIENT_ERROR(context, "Incorrect response buffer size %d: headers took %d, payload size %d", response_size, response_len, payload_size);
-        free(response);
-        free(payload);
-        return;
-    }
-    memcpy(response+response_len, payload, payload_size);
-    response_len += payload_size;
-
-    free(payload);
-
-    client_send(context, (byte *)response, response_len);
+    char headers[128];
+    int headers_len = snprintf(headers, sizeof(headers), http_headers, payload_size);
 
-    free(response);
+    struct iovec iov[] = {
+        { headers, headers_len },
+        { (void *)payload, payload_size },
+    };
+    client_send_iov(context, iov, 2);
 }
 
 
@@ -913,28 +1502,14 @@ void send_json_response(client_context_t *context, int status_code, byte *payloa
         case 503: status_text = "Service Unavailable"; break;
     }
 
-    int response_size = strlen(http_headers) + payload_size + strlen(status_text) + 32;
-    char *response = malloc(response_size);
-    if (!response) {
-        CLIENT_ERROR(context, "Failed to allocate response buffer of size %d", response_size);
-        return;
-    }
-    int response_len = snprintf(response, response_size, http_headers, status_code, status_text, payload_size);
-
-    if (response_size - response_len < payload_size + 1) {
-        CLIENT_ERROR(context, "Incorrect response buffer size %d: headers took %d, payload size %d", response_size, response_len, payload_size);
-        free(response);
-        return;
-    }
-    memcpy(response+response_len, payload, payload_size);
-    response_len += payload_size;
-    response[response_len] = 0;  // required for debug output
-
-    CLIENT_DEBUG(context, "Sending HTTP response: %s", response);
-
-    client_send(context, (byte *)response, response_len);
+    char headers[160];
+    int headers_len = snprintf(headers, sizeof(headers), http_headers, status_code, status_text, payload_size);
 
-    free(response);
+    struct iovec iov[] = {
+        { headers, headers_len },
+        { payload, payload_size },
+    };
+    client_send_iov(context, iov, 2);
 }
 
 
@@ -948,13 +1523,39 @@ void send_json_error_response(client_context_t *context, int status_code, HAPSta
 
 static client_context_t *current_client_context = NULL;
 
-homekit_client_id_t homekit_get_client_id() {
-    return (homekit_client_id_t)current_client_context;
-}
+void homekit_characteristic_getter_complete(homekit_characteristic_t *ch, homekit_value_t value) {
+    if (!running_server || !running_server->getter_results)
+        return;
 
-bool homekit_client_is_admin() {
-    if (!current_client_context)
-        return false;
+    characteristic_event_t *result = malloc(sizeof(characteristic_event_t));
+    if (!result) {
+        ERROR("Failed to report value of %d.%d: error allocating memory",
+              ch->service->accessory->id, ch->id);
+        return;
+    }
+
+    result->characteristic = ch;
+    homekit_value_copy_compact(&result->value, &value);
+
+    if (!xQueueSendToBack(running_server->getter_results, &result, 10)) {
+        ERROR("Failed to report value of %d.%d: too many pending values",
+              ch->service->accessory->id, ch->id);
+        homekit_value_destruct(&result->value);
+        free(result);
+        return;
+    }
+
+    poller_wakeup(running_server->poller);
+}
+
+
+homekit_client_id_t homekit_get_client_id() {
+    return (homekit_client_id_t)current_client_context;
+}
+
+bool homekit_client_is_admin() {
+    if (!current_client_context)
+        return false;
 
     return current_client_context->permissions & pairing_permissions_admin;
 }
@@ -980,6 +1581,7 @@ void homekit_server_on_identify(client_context_t *context) {
     }
 
     send_204_response(context);
+    client_flush(context);
 
     homekit_accessory_t *accessory =
         homekit_accessory_by_id(context->server->config->accessories, 1);
@@ -1008,16 +1610,21 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
     DEBUG("Pair Setup");
     DEBUG_HEAP();
 
+    tlv_item_t message_items[TLV_MAX_ITEMS];
+    tlv_reader_t message;
+    if (tlv_reader_init(&message, data, size, message_items, TLV_MAX_ITEMS)) {
+        CLIENT_ERROR(context, "Failed to parse TLV payload");
+        send_tlv_error_response(context, 2, TLVError_Unknown);
+        return;
+    }
+
 #ifdef HOMEKIT_OVERCLOCK_PAIR_SETUP
     homekit_overclock_start();
 #endif
 
-    tlv_values_t *message = tlv_new();
-    tlv_parse(data, size, message);
-
-    TLV_DEBUG(message);
+    TLV_READER_DEBUG(&message);
 
-    switch(tlv_get_integer_value(message, TLVType_State, -1)) {
+    switch(tlv_reader_get_integer(&message, TLVType_State, -1)) {
         case 1: {
             CLIENT_INFO(context, "Pair Setup Step 1/3");
             DEBUG_HEAP();
@@ -1027,15 +1634,15 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
                 break;
             }
 
-            if (context->server->pairing_context) {
-                if (context->server->pairing_context->client != context) {
-                    CLIENT_INFO(context, "Refusing to pair: another pairing in progress");
-                    send_tlv_error_response(context, 2, TLVError_Busy);
-                    break;
-                }
-            } else {
-                context->server->pairing_context = pairing_context_new();
-                context->server->pairing_context->client = context;
+            if (context->pairing_client != CLIENT_HANDLE_NONE &&
+                    context->pairing_client != context->handle) {
+                CLIENT_INFO(context, "Refusing to pair: another pairing in progress");
+                send_tlv_error_response(context, 2, TLVError_Busy);
+                break;
+            }
+
+            if (!context->pairing_context) {
+                context->pairing_context = pairing_context_new();
             }
 
             CLIENT_DEBUG(context, "Initializing crypto");
@@ -1059,67 +1666,95 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
             }
 
             crypto_srp_init(
-                context->server->pairing_context->srp,
+                context->pairing_context->srp,
                 "Pair-Setup", password
             );
 
-            if (context->server->pairing_context->public_key) {
-                free(context->server->pairing_context->public_key);
-                context->server->pairing_context->public_key = NULL;
+            if (context->pairing_context->public_key) {
+                free(context->pairing_context->public_key);
+                context->pairing_context->public_key = NULL;
             }
-            context->server->pairing_context->public_key_size = 0;
-            crypto_srp_get_public_key(context->server->pairing_context->srp, NULL, &context->server->pairing_context->public_key_size);
+            context->pairing_context->public_key_size = 0;
+            crypto_srp_get_public_key(context->pairing_context->srp, NULL, &context->pairing_context->public_key_size);
 
-            context->server->pairing_context->public_key = malloc(context->server->pairing_context->public_key_size);
-            int r = crypto_srp_get_public_key(context->server->pairing_context->srp, context->server->pairing_context->public_key, &context->server->pairing_context->public_key_size);
+            context->pairing_context->public_key = malloc(context->pairing_context->public_key_size);
+            int r = crypto_srp_get_public_key(context->pairing_context->srp, context->pairing_context->public_key, &context->pairing_context->public_key_size);
             if (r) {
                 CLIENT_ERROR(context, "Failed to dump SPR public key (code %d)", r);
 
-                pairing_context_free(context->server->pairing_context);
-                context->server->pairing_context = NULL;
+                pairing_context_free(context->pairing_context);
+                context->pairing_context = NULL;
 
                 send_tlv_error_response(context, 2, TLVError_Unknown);
                 break;
             }
 
             size_t salt_size = 0;
-            crypto_srp_get_salt(context->server->pairing_context->srp, NULL, &salt_size);
+            crypto_srp_get_salt(context->pairing_context->srp, NULL, &salt_size);
 
             byte *salt = malloc(salt_size);
-            r = crypto_srp_get_salt(context->server->pairing_context->srp, salt, &salt_size);
+            r = crypto_srp_get_salt(context->pairing_context->srp, salt, &salt_size);
             if (r) {
                 CLIENT_ERROR(context, "Failed to get salt (code %d)", r);
 
                 free(salt);
-                pairing_context_free(context->server->pairing_context);
-                context->server->pairing_context = NULL;
+                pairing_context_free(context->pairing_context);
+                context->pairing_context = NULL;
 
                 send_tlv_error_response(context, 2, TLVError_Unknown);
                 break;
             }
 
-            tlv_values_t *response = tlv_new();
-            tlv_add_value(response, TLVType_PublicKey, context->server->pairing_context->public_key, context->server->pairing_context->public_key_size);
-            tlv_add_value(response, TLVType_Salt, salt, salt_size);
-            tlv_add_integer_value(response, TLVType_State, 1, 2);
+            tlv_writer_t response;
+            client_tlv_writer_init(
+                context, &response,
+                tlv_encoded_size(context->pairing_context->public_key_size) +
+                tlv_encoded_size(salt_size) + tlv_encoded_size(1)
+            );
+            tlv_writer_add_value(&response, TLVType_PublicKey, context->pairing_context->public_key, context->pairing_context->public_key_size);
+            tlv_writer_add_value(&response, TLVType_Salt, salt, salt_size);
+            tlv_writer_add_integer(&response, TLVType_State, 1, 2);
 
             free(salt);
 
-            send_tlv_response(context, response);
+            if (response.overflow) {
+                CLIENT_ERROR(context, "Failed to format TLV response");
+
+                pairing_context_free(context->pairing_context);
+                context->pairing_context = NULL;
+
+                send_tlv_error_response(context, 2, TLVError_Unknown);
+                break;
+            }
+
+            context->pairing_context->renew_expiry = true;
+
+            send_tlv_payload(context, response.buffer, response.length);
             break;
         }
         case 3: {
             CLIENT_INFO(context, "Pair Setup Step 2/3");
             DEBUG_HEAP();
-            tlv_t *device_public_key = tlv_get_value(message, TLVType_PublicKey);
-            if (!device_public_key) {
+            if (!context->pairing_context) {
+                if (context->pairing_client != CLIENT_HANDLE_NONE) {
+                    CLIENT_INFO(context, "Refusing to continue pairing: another pairing in progress");
+                    send_tlv_error_response(context, 4, TLVError_Busy);
+                } else {
+                    CLIENT_ERROR(context, "Refusing to continue pairing: no pair setup in progress");
+                    send_tlv_error_response(context, 4, TLVError_Unknown);
+                }
+                break;
+            }
+
+            tlv_view_t device_public_key;
+            if (!tlv_reader_get(&message, TLVType_PublicKey, &device_public_key, context->arena)) {
                 CLIENT_ERROR(context, "Invalid payload: no device public key");
                 send_tlv_error_response(context, 4, TLVError_Authentication);
                 break;
             }
 
-            tlv_t *proof = tlv_get_value(message, TLVType_Proof);
-            if (!proof) {
+            tlv_view_t proof;
+            if (!tlv_reader_get(&message, TLVType_Proof, &proof, context->arena)) {
                 CLIENT_ERROR(context, "Invalid payload: no device proof");
                 send_tlv_error_response(context, 4, TLVError_Authentication);
                 break;
@@ -1128,10 +1763,10 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
             CLIENT_DEBUG(context, "Computing SRP shared secret");
             DEBUG_HEAP();
             int r = crypto_srp_compute_key(
-                context->server->pairing_context->srp,
-                device_public_key->value, device_public_key->size,
-                context->server->pairing_context->public_key,
-                context->server->pairing_context->public_key_size
+                context->pairing_context->srp,
+                device_public_key.value, device_public_key.size,
+                context->pairing_context->public_key,
+                context->pairing_context->public_key_size
             );
             if (r) {
                 CLIENT_ERROR(context, "Failed to compute SRP shared secret (code %d)", r);
@@ -1139,13 +1774,13 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
                 break;
             }
 
-            free(context->server->pairing_context->public_key);
-            context->server->pairing_context->public_key = NULL;
-            context->server->pairing_context->public_key_size = 0;
+            free(context->pairing_context->public_key);
+            context->pairing_context->public_key = NULL;
+            context->pairing_context->public_key_size = 0;
 
             CLIENT_DEBUG(context, "Verifying peer's proof");
             DEBUG_HEAP();
-            r = crypto_srp_verify(context->server->pairing_context->srp, proof->value, proof->size);
+            r = crypto_srp_verify(context->pairing_context->srp, proof.value, proof.size);
             if (r) {
                 CLIENT_ERROR(context, "Failed to verify peer's proof (code %d)", r);
                 send_tlv_error_response(context, 4, TLVError_Authentication);
@@ -1154,23 +1789,46 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
 
             CLIENT_DEBUG(context, "Generating own proof");
             size_t server_proof_size = 0;
-            crypto_srp_get_proof(context->server->pairing_context->srp, NULL, &server_proof_size);
+            crypto_srp_get_proof(context->pairing_context->srp, NULL, &server_proof_size);
+
+            tlv_writer_t response;
+            client_tlv_writer_init(
+                context, &response,
+                tlv_encoded_size(1) + tlv_encoded_size(server_proof_size)
+            );
+            tlv_writer_add_integer(&response, TLVType_State, 1, 4);
 
-            byte *server_proof = malloc(server_proof_size);
-            r = crypto_srp_get_proof(context->server->pairing_context->srp, server_proof, &server_proof_size);
+            // Proof is generated straight into the response
+            size_t proof_mark = tlv_writer_begin(&response, TLVType_Proof);
+            byte *server_proof = tlv_writer_reserve(&response, server_proof_size);
+            if (server_proof)
+                r = crypto_srp_get_proof(context->pairing_context->srp, server_proof, &server_proof_size);
+            tlv_writer_end(&response, proof_mark);
 
-            tlv_values_t *response = tlv_new();
-            tlv_add_integer_value(response, TLVType_State, 1, 4);
-            tlv_add_value(response, TLVType_Proof, server_proof, server_proof_size);
+            if (response.overflow || r) {
+                CLIENT_ERROR(context, "Failed to generate own proof (code %d)", r);
+                send_tlv_error_response(context, 4, TLVError_Unknown);
+                break;
+            }
 
-            free(server_proof);
+            context->pairing_context->renew_expiry = true;
 
-            send_tlv_response(context, response);
+            send_tlv_payload(context, response.buffer, response.length);
             break;
         }
         case 5: {
             CLIENT_INFO(context, "Pair Setup Step 3/3");
             DEBUG_HEAP();
+            if (!context->pairing_context) {
+                if (context->pairing_client != CLIENT_HANDLE_NONE) {
+                    CLIENT_INFO(context, "Refusing to continue pairing: another pairing in progress");
+                    send_tlv_error_response(context, 6, TLVError_Busy);
+                } else {
+                    CLIENT_ERROR(context, "Refusing to continue pairing: no pair setup in progress");
+                    send_tlv_error_response(context, 6, TLVError_Unknown);
+                }
+                break;
+            }
 
             int r;
 
@@ -1181,7 +1839,7 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
             const char salt1[] = "Pair-Setup-Encrypt-Salt";
             const char info1[] = "Pair-Setup-Encrypt-Info";
             r = crypto_srp_hkdf(
-                context->server->pairing_context->srp,
+                context->pairing_context->srp,
                 (byte *)salt1, sizeof(salt1)-1,
                 (byte *)info1, sizeof(info1)-1,
                 shared_secret, &shared_secret_size
@@ -1192,8 +1850,8 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
                 break;
             }
 
-            tlv_t *tlv_encrypted_data = tlv_get_value(message, TLVType_EncryptedData);
-            if (!tlv_encrypted_data) {
+            tlv_view_t tlv_encrypted_data;
+            if (!tlv_reader_get(&message, TLVType_EncryptedData, &tlv_encrypted_data, context->arena)) {
                 CLIENT_ERROR(context, "Invalid payload: no encrypted data");
                 send_tlv_error_response(context, 6, TLVError_Authentication);
                 break;
@@ -1203,66 +1861,63 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
             size_t decrypted_data_size = 0;
             crypto_chacha20poly1305_decrypt(
                 shared_secret, (byte *)"\x0\x0\x0\x0PS-Msg05", NULL, 0,
-                tlv_encrypted_data->value, tlv_encrypted_data->size,
+                tlv_encrypted_data.value, tlv_encrypted_data.size,
                 NULL, &decrypted_data_size
             );
 
-            byte *decrypted_data = malloc(decrypted_data_size);
-            // TODO: check malloc result
+            // Decrypted message is parsed in place, keep it for the rest of request
+            byte *decrypted_data = arena_alloc(context->arena, decrypted_data_size);
+            if (!decrypted_data) {
+                CLIENT_ERROR(context, "Failed to allocate %d bytes for decrypted data", decrypted_data_size);
+                send_tlv_error_response(context, 6, TLVError_Unknown);
+                break;
+            }
+
             r = crypto_chacha20poly1305_decrypt(
                 shared_secret, (byte *)"\x0\x0\x0\x0PS-Msg05", NULL, 0,
-                tlv_encrypted_data->value, tlv_encrypted_data->size,
+                tlv_encrypted_data.value, tlv_encrypted_data.size,
                 decrypted_data, &decrypted_data_size
             );
             if (r) {
                 CLIENT_ERROR(context, "Failed to decrypt data (code %d)", r);
 
-                free(decrypted_data);
-
                 send_tlv_error_response(context, 6, TLVError_Authentication);
                 break;
             }
 
-            tlv_values_t *decrypted_message = tlv_new();
-            r = tlv_parse(decrypted_data, decrypted_data_size, decrypted_message);
+            tlv_item_t decrypted_message_items[TLV_MAX_ITEMS];
+            tlv_reader_t decrypted_message;
+            r = tlv_reader_init(
+                &decrypted_message, decrypted_data, decrypted_data_size,
+                decrypted_message_items, TLV_MAX_ITEMS
+            );
             if (r) {
                 CLIENT_ERROR(context, "Failed to parse decrypted TLV (code %d)", r);
 
-                tlv_free(decrypted_message);
-                free(decrypted_data);
-
                 send_tlv_error_response(context, 6, TLVError_Authentication);
                 break;
             }
 
-            free(decrypted_data);
-
-            tlv_t *tlv_device_id = tlv_get_value(decrypted_message, TLVType_Identifier);
-            if (!tlv_device_id) {
+            tlv_view_t tlv_device_id;
+            if (!tlv_reader_get(&decrypted_message, TLVType_Identifier, &tlv_device_id, context->arena)) {
                 CLIENT_ERROR(context, "Invalid encrypted payload: no device identifier");
 
-                tlv_free(decrypted_message);
-
                 send_tlv_error_response(context, 6, TLVError_Authentication);
                 break;
             }
 
-            tlv_t *tlv_device_public_key = tlv_get_value(decrypted_message, TLVType_PublicKey);
-            if (!tlv_device_public_key) {
+            tlv_view_t tlv_device_public_key;
+            if (!tlv_reader_get(&decrypted_message, TLVType_PublicKey, &tlv_device_public_key, context->arena)) {
                 CLIENT_ERROR(context, "Invalid encrypted payload: no device public key");
 
-                tlv_free(decrypted_message);
-
                 send_tlv_error_response(context, 6, TLVError_Authentication);
                 break;
             }
 
-            tlv_t *tlv_device_signature = tlv_get_value(decrypted_message, TLVType_Signature);
-            if (!tlv_device_signature) {
+            tlv_view_t tlv_device_signature;
+            if (!tlv_reader_get(&decrypted_message, TLVType_Signature, &tlv_device_signature, context->arena)) {
                 CLIENT_ERROR(context, "Invalid encrypted payload: no device signature");
 
-                tlv_free(decrypted_message);
-
                 send_tlv_error_response(context, 6, TLVError_Authentication);
                 break;
             }
@@ -1271,13 +1926,12 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
             ed25519_key *device_key = crypto_ed25519_new();
             r = crypto_ed25519_import_public_key(
                 device_key,
-                tlv_device_public_key->value, tlv_device_public_key->size
+                tlv_device_public_key.value, tlv_device_public_key.size
             );
             if (r) {
                 CLIENT_ERROR(context, "Failed to import device public Key (code %d)", r);
 
                 crypto_ed25519_free(device_key);
-                tlv_free(decrypted_message);
 
                 send_tlv_error_response(context, 6, TLVError_Authentication);
                 break;
@@ -1290,7 +1944,7 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
             const char salt2[] = "Pair-Setup-Controller-Sign-Salt";
             const char info2[] = "Pair-Setup-Controller-Sign-Info";
             r = crypto_srp_hkdf(
-                context->server->pairing_context->srp,
+                context->pairing_context->srp,
                 (byte *)salt2, sizeof(salt2)-1,
                 (byte *)info2, sizeof(info2)-1,
                 device_x, &device_x_size
@@ -1299,36 +1953,34 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
                 CLIENT_ERROR(context, "Failed to generate DeviceX (code %d)", r);
 
                 crypto_ed25519_free(device_key);
-                tlv_free(decrypted_message);
 
                 send_tlv_error_response(context, 6, TLVError_Authentication);
                 break;
             }
 
-            size_t device_info_size = device_x_size + tlv_device_id->size + tlv_device_public_key->size;
+            size_t device_info_size = device_x_size + tlv_device_id.size + tlv_device_public_key.size;
             byte *device_info = malloc(device_info_size);
             memcpy(device_info,
                    device_x,
                    device_x_size);
             memcpy(device_info + device_x_size,
-                   tlv_device_id->value,
-                   tlv_device_id->size);
-            memcpy(device_info + device_x_size + tlv_device_id->size,
-                   tlv_device_public_key->value,
-                   tlv_device_public_key->size);
+                   tlv_device_id.value,
+                   tlv_device_id.size);
+            memcpy(device_info + device_x_size + tlv_device_id.size,
+                   tlv_device_public_key.value,
+                   tlv_device_public_key.size);
 
             CLIENT_DEBUG(context, "Verifying device signature");
             r = crypto_ed25519_verify(
                 device_key,
                 device_info, device_info_size,
-                tlv_device_signature->value, tlv_device_signature->size
+                tlv_device_signature.value, tlv_device_signature.size
             );
             if (r) {
                 CLIENT_ERROR(context, "Failed to generate DeviceX (code %d)", r);
 
                 free(device_info);
                 crypto_ed25519_free(device_key);
-                tlv_free(decrypted_message);
 
                 send_tlv_error_response(context, 6, TLVError_Authentication);
                 break;
@@ -1336,7 +1988,7 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
 
             free(device_info);
 
-            char *device_id = strndup((const char *)tlv_device_id->value, tlv_device_id->size);
+            char *device_id = strndup((const char *)tlv_device_id.value, tlv_device_id.size);
 
             r = homekit_storage_add_pairing(device_id, device_key, pairing_permissions_admin);
             if (r) {
@@ -1344,19 +1996,17 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
 
                 free(device_id);
                 crypto_ed25519_free(device_key);
-                tlv_free(decrypted_message);
                 send_tlv_error_response(context, 6, TLVError_Unknown);
                 break;
             }
 
             INFO("Added pairing with %s", device_id);
 
-            HOMEKIT_NOTIFY_EVENT(context->server, HOMEKIT_EVENT_PAIRING_ADDED);
+            context->pairing_actions |= PAIRING_ACTION_PAIRING_ADDED;
 
             free(device_id);
 
             crypto_ed25519_free(device_key);
-            tlv_free(decrypted_message);
 
             CLIENT_DEBUG(context, "Exporting accessory public key");
             size_t accessory_public_key_size = 0;
@@ -1382,7 +2032,7 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
             const char salt3[] = "Pair-Setup-Accessory-Sign-Salt";
             const char info3[] = "Pair-Setup-Accessory-Sign-Info";
             r = crypto_srp_hkdf(
-                context->server->pairing_context->srp,
+                context->pairing_context->srp,
                 (byte *)salt3, sizeof(salt3)-1,
                 (byte *)info3, sizeof(info3)-1,
                 accessory_info, &accessory_x_size
@@ -1411,95 +2061,78 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
                 NULL, &accessory_signature_size
             );
 
-            byte *accessory_signature = malloc(accessory_signature_size);
-            r = crypto_ed25519_sign(
-                context->server->accessory_key,
-                accessory_info, accessory_info_size,
-                accessory_signature, &accessory_signature_size
-            );
-            if (r) {
-                CLIENT_ERROR(context, "Failed to generate accessory signature (code %d)", r);
+            // Sub-TLV is written into the response and then encrypted in place
+            size_t response_data_size =
+                tlv_encoded_size(accessory_id_size) +
+                tlv_encoded_size(accessory_public_key_size) +
+                tlv_encoded_size(accessory_signature_size);
 
-                free(accessory_signature);
-                free(accessory_public_key);
-                free(accessory_info);
+            size_t encrypted_response_data_size = 0;
+            crypto_chacha20poly1305_encrypt(
+                shared_secret, (byte *)"\x0\x0\x0\x0PS-Msg06", NULL, 0,
+                NULL, response_data_size,
+                NULL, &encrypted_response_data_size
+            );
 
-                send_tlv_error_response(context, 6, TLVError_Unknown);
-                break;
+            tlv_writer_t response;
+            client_tlv_writer_init(
+                context, &response,
+                tlv_encoded_size(1) + tlv_encoded_size(encrypted_response_data_size)
+            );
+            tlv_writer_add_integer(&response, TLVType_State, 1, 6);
+
+            size_t encrypted_data_mark = tlv_writer_begin(&response, TLVType_EncryptedData);
+            tlv_writer_add_value(&response, TLVType_Identifier,
+                                 (byte *)context->server->accessory_id, accessory_id_size);
+            tlv_writer_add_value(&response, TLVType_PublicKey,
+                                 accessory_public_key, accessory_public_key_size);
+
+            size_t signature_mark = tlv_writer_begin(&response, TLVType_Signature);
+            byte *accessory_signature = tlv_writer_reserve(&response, accessory_signature_size);
+            r = -1;
+            if (accessory_signature) {
+                r = crypto_ed25519_sign(
+                    context->server->accessory_key,
+                    accessory_info, accessory_info_size,
+                    accessory_signature, &accessory_signature_size
+                );
             }
-
-            free(accessory_info);
-
-            tlv_values_t *response_message = tlv_new();
-            tlv_add_value(response_message, TLVType_Identifier,
-                          (byte *)context->server->accessory_id, accessory_id_size);
-            tlv_add_value(response_message, TLVType_PublicKey,
-                          accessory_public_key, accessory_public_key_size);
-            tlv_add_value(response_message, TLVType_Signature,
-                          accessory_signature, accessory_signature_size);
+            tlv_writer_end(&response, signature_mark);
 
             free(accessory_public_key);
-            free(accessory_signature);
-
-            size_t response_data_size = 0;
-            TLV_DEBUG(response_message);
-
-            tlv_format(response_message, NULL, &response_data_size);
+            free(accessory_info);
 
-            byte *response_data = malloc(response_data_size);
-            r = tlv_format(response_message, response_data, &response_data_size);
             if (r) {
-                CLIENT_ERROR(context, "Failed to format TLV response (code %d)", r);
-
-                free(response_data);
-                tlv_free(response_message);
-
+                CLIENT_ERROR(context, "Failed to generate accessory signature (code %d)", r);
                 send_tlv_error_response(context, 6, TLVError_Unknown);
                 break;
             }
 
-            tlv_free(response_message);
-
             CLIENT_DEBUG(context, "Encrypting response");
-            size_t encrypted_response_data_size = 0;
-            crypto_chacha20poly1305_encrypt(
-                shared_secret, (byte *)"\x0\x0\x0\x0PS-Msg06", NULL, 0,
-                response_data, response_data_size,
-                NULL, &encrypted_response_data_size
-            );
-
-            byte *encrypted_response_data = malloc(encrypted_response_data_size);
-            r = crypto_chacha20poly1305_encrypt(
-                shared_secret, (byte *)"\x0\x0\x0\x0PS-Msg06", NULL, 0,
-                response_data, response_data_size,
-                encrypted_response_data, &encrypted_response_data_size
-            );
-
-            free(response_data);
+            byte *response_data = tlv_writer_value(&response, encrypted_data_mark, &response_data_size);
+            r = -1;
+            if (tlv_writer_reserve(&response, encrypted_response_data_size - response_data_size)) {
+                // ChaCha20-Poly1305 supports encrypting in place
+                r = crypto_chacha20poly1305_encrypt(
+                    shared_secret, (byte *)"\x0\x0\x0\x0PS-Msg06", NULL, 0,
+                    response_data, response_data_size,
+                    response_data, &encrypted_response_data_size
+                );
+            }
+            tlv_writer_end(&response, encrypted_data_mark);
 
-            if (r) {
+            if (r || response.overflow) {
                 CLIENT_ERROR(context, "Failed to encrypt response data (code %d)", r);
-
-                free(encrypted_response_data);
-
                 send_tlv_error_response(context, 6, TLVError_Unknown);
                 break;
             }
 
-            tlv_values_t *response = tlv_new();
-            tlv_add_integer_value(response, TLVType_State, 1, 6);
-            tlv_add_value(response, TLVType_EncryptedData,
-                          encrypted_response_data, encrypted_response_data_size);
-
-            free(encrypted_response_data);
+            send_tlv_payload(context, response.buffer, response.length);
 
-            send_tlv_response(context, response);
-
-            pairing_context_free(context->server->pairing_context);
-            context->server->pairing_context = NULL;
+            pairing_context_free(context->pairing_context);
+            context->pairing_context = NULL;
 
-            context->server->paired = 1;
-            homekit_setup_mdns(context->server);
+            context->pairing_actions |= PAIRING_ACTION_PAIRED;
 
             CLIENT_INFO(context, "Successfully paired");
 
@@ -1507,12 +2140,10 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
         }
         default: {
             CLIENT_ERROR(context, "Unknown state: %d",
-                  tlv_get_integer_value(message, TLVType_State, -1));
+                  tlv_reader_get_integer(&message, TLVType_State, -1));
         }
     }
 
-    tlv_free(message);
-
 #ifdef HOMEKIT_OVERCLOCK_PAIR_SETUP
     homekit_overclock_end();
 #endif
@@ -1522,24 +2153,29 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
     DEBUG("HomeKit Pair Verify");
     DEBUG_HEAP();
 
+    tlv_item_t message_items[TLV_MAX_ITEMS];
+    tlv_reader_t message;
+    if (tlv_reader_init(&message, data, size, message_items, TLV_MAX_ITEMS)) {
+        CLIENT_ERROR(context, "Failed to parse TLV payload");
+        send_tlv_error_response(context, 2, TLVError_Unknown);
+        return;
+    }
+
 #ifdef HOMEKIT_OVERCLOCK_PAIR_VERIFY
     homekit_overclock_start();
 #endif
 
-    tlv_values_t *message = tlv_new();
-    tlv_parse(data, size, message);
-
-    TLV_DEBUG(message);
+    TLV_READER_DEBUG(&message);
 
     int r;
 
-    switch(tlv_get_integer_value(message, TLVType_State, -1)) {
+    switch(tlv_reader_get_integer(&message, TLVType_State, -1)) {
         case 1: {
             CLIENT_INFO(context, "Pair Verify Step 1/2");
 
             CLIENT_DEBUG(context, "Importing device Curve25519 public key");
-            tlv_t *tlv_device_public_key = tlv_get_value(message, TLVType_PublicKey);
-            if (!tlv_device_public_key) {
+            tlv_view_t tlv_device_public_key;
+            if (!tlv_reader_get(&message, TLVType_PublicKey, &tlv_device_public_key, context->arena)) {
                 CLIENT_ERROR(context, "Device Curve25519 public key not found");
                 send_tlv_error_response(context, 2, TLVError_Unknown);
                 break;
@@ -1547,7 +2183,7 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
             curve25519_key *device_key = crypto_curve25519_new();
             r = crypto_curve25519_import_public(
                 device_key,
-                tlv_device_public_key->value, tlv_device_public_key->size
+                tlv_device_public_key.value, tlv_device_public_key.size
             );
             if (r) {
                 CLIENT_ERROR(context, "Failed to import device Curve25519 public key (code %d)", r);
@@ -1599,7 +2235,7 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
 
             CLIENT_DEBUG(context, "Generating signature");
             size_t accessory_id_size = strlen(context->server->accessory_id);
-            size_t accessory_info_size = my_key_public_size + accessory_id_size + tlv_device_public_key->size;
+            size_t accessory_info_size = my_key_public_size + accessory_id_size + tlv_device_public_key.size;
 
             byte *accessory_info = malloc(accessory_info_size);
             memcpy(accessory_info,
@@ -1607,7 +2243,7 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
             memcpy(accessory_info + my_key_public_size,
                    context->server->accessory_id, accessory_id_size);
             memcpy(accessory_info + my_key_public_size + accessory_id_size,
-                   tlv_device_public_key->value, tlv_device_public_key->size);
+                   tlv_device_public_key.value, tlv_device_public_key.size);
 
             size_t accessory_signature_size = 0;
             crypto_ed25519_sign(
@@ -1616,46 +2252,6 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
                 NULL, &accessory_signature_size
             );
 
-            byte *accessory_signature = malloc(accessory_signature_size);
-            r = crypto_ed25519_sign(
-                context->server->accessory_key,
-                accessory_info, accessory_info_size,
-                accessory_signature, &accessory_signature_size
-            );
-            free(accessory_info);
-            if (r) {
-                CLIENT_ERROR(context, "Failed to generate signature (code %d)", r);
-                free(accessory_signature);
-                free(shared_secret);
-                free(my_key_public);
-                send_tlv_error_response(context, 2, TLVError_Unknown);
-                break;
-            }
-
-            tlv_values_t *sub_response = tlv_new();
-            tlv_add_value(sub_response, TLVType_Identifier,
-                          (const byte *)context->server->accessory_id, accessory_id_size);
-            tlv_add_value(sub_response, TLVType_Signature,
-                          accessory_signature, accessory_signature_size);
-
-            free(accessory_signature);
-
-            size_t sub_response_data_size = 0;
-            tlv_format(sub_response, NULL, &sub_response_data_size);
-
-            byte *sub_response_data = malloc(sub_response_data_size);
-            r = tlv_format(sub_response, sub_response_data, &sub_response_data_size);
-            tlv_free(sub_response);
-
-            if (r) {
-                CLIENT_ERROR(context, "Failed to format sub-TLV message (code %d)", r);
-                free(sub_response_data);
-                free(shared_secret);
-                free(my_key_public);
-                send_tlv_error_response(context, 2, TLVError_Unknown);
-                break;
-            }
-
             CLIENT_DEBUG(context, "Generating proof");
             size_t session_key_size = 0;
             const byte salt[] = "Pair-Verify-Encrypt-Salt";
@@ -1677,32 +2273,54 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
             if (r) {
                 CLIENT_ERROR(context, "Failed to derive session key (code %d)", r);
                 free(session_key);
-                free(sub_response_data);
+                free(accessory_info);
                 free(shared_secret);
                 free(my_key_public);
                 send_tlv_error_response(context, 2, TLVError_Unknown);
                 break;
             }
 
-            CLIENT_DEBUG(context, "Encrypting response");
+            // Sub-TLV is written into the response and then encrypted in place
+            size_t sub_response_data_size =
+                tlv_encoded_size(accessory_id_size) +
+                tlv_encoded_size(accessory_signature_size);
+
             size_t encrypted_response_data_size = 0;
             crypto_chacha20poly1305_encrypt(
                 session_key, (byte *)"\x0\x0\x0\x0PV-Msg02", NULL, 0,
-                sub_response_data, sub_response_data_size,
+                NULL, sub_response_data_size,
                 NULL, &encrypted_response_data_size
             );
 
-            byte *encrypted_response_data = malloc(encrypted_response_data_size);
-            r = crypto_chacha20poly1305_encrypt(
-                session_key, (byte *)"\x0\x0\x0\x0PV-Msg02", NULL, 0,
-                sub_response_data, sub_response_data_size,
-                encrypted_response_data, &encrypted_response_data_size
+            tlv_writer_t response;
+            client_tlv_writer_init(
+                context, &response,
+                tlv_encoded_size(1) + tlv_encoded_size(my_key_public_size) +
+                tlv_encoded_size(encrypted_response_data_size)
             );
-            free(sub_response_data);
+            tlv_writer_add_integer(&response, TLVType_State, 1, 2);
+            tlv_writer_add_value(&response, TLVType_PublicKey,
+                                 my_key_public, my_key_public_size);
+
+            size_t encrypted_data_mark = tlv_writer_begin(&response, TLVType_EncryptedData);
+            tlv_writer_add_value(&response, TLVType_Identifier,
+                                 (const byte *)context->server->accessory_id, accessory_id_size);
+
+            size_t signature_mark = tlv_writer_begin(&response, TLVType_Signature);
+            byte *accessory_signature = tlv_writer_reserve(&response, accessory_signature_size);
+            r = -1;
+            if (accessory_signature) {
+                r = crypto_ed25519_sign(
+                    context->server->accessory_key,
+                    accessory_info, accessory_info_size,
+                    accessory_signature, &accessory_signature_size
+                );
+            }
+            tlv_writer_end(&response, signature_mark);
+            free(accessory_info);
 
             if (r) {
-                CLIENT_ERROR(context, "Failed to encrypt sub response data (code %d)", r);
-                free(encrypted_response_data);
+                CLIENT_ERROR(context, "Failed to generate signature (code %d)", r);
                 free(session_key);
                 free(shared_secret);
                 free(my_key_public);
@@ -1710,16 +2328,29 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
                 break;
             }
 
-            tlv_values_t *response = tlv_new();
-            tlv_add_integer_value(response, TLVType_State, 1, 2);
-            tlv_add_value(response, TLVType_PublicKey,
-                          my_key_public, my_key_public_size);
-            tlv_add_value(response, TLVType_EncryptedData,
-                          encrypted_response_data, encrypted_response_data_size);
+            CLIENT_DEBUG(context, "Encrypting response");
+            byte *sub_response_data = tlv_writer_value(&response, encrypted_data_mark, &sub_response_data_size);
+            r = -1;
+            if (tlv_writer_reserve(&response, encrypted_response_data_size - sub_response_data_size)) {
+                // ChaCha20-Poly1305 supports encrypting in place
+                r = crypto_chacha20poly1305_encrypt(
+                    session_key, (byte *)"\x0\x0\x0\x0PV-Msg02", NULL, 0,
+                    sub_response_data, sub_response_data_size,
+                    sub_response_data, &encrypted_response_data_size
+                );
+            }
+            tlv_writer_end(&response, encrypted_data_mark);
 
-            free(encrypted_response_data);
+            if (r || response.overflow) {
+                CLIENT_ERROR(context, "Failed to encrypt sub response data (code %d)", r);
+                free(session_key);
+                free(shared_secret);
+                free(my_key_public);
+                send_tlv_error_response(context, 2, TLVError_Unknown);
+                break;
+            }
 
-            send_tlv_response(context, response);
+            send_tlv_payload(context, response.buffer, response.length);
 
             if (context->verify_context)
                 pair_verify_context_free(context->verify_context);
@@ -1734,10 +2365,10 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
             context->verify_context->accessory_public_key = my_key_public;
             context->verify_context->accessory_public_key_size = my_key_public_size;
 
-            context->verify_context->device_public_key = malloc(tlv_device_public_key->size);
+            context->verify_context->device_public_key = malloc(tlv_device_public_key.size);
             memcpy(context->verify_context->device_public_key,
-                   tlv_device_public_key->value, tlv_device_public_key->size);
-            context->verify_context->device_public_key_size = tlv_device_public_key->size;
+                   tlv_device_public_key.value, tlv_device_public_key.size);
+            context->verify_context->device_public_key_size = tlv_device_public_key.size;
 
             break;
         }
@@ -1750,8 +2381,8 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
                 break;
             }
 
-            tlv_t *tlv_encrypted_data = tlv_get_value(message, TLVType_EncryptedData);
-            if (!tlv_encrypted_data) {
+            tlv_view_t tlv_encrypted_data;
+            if (!tlv_reader_get(&message, TLVType_EncryptedData, &tlv_encrypted_data, context->arena)) {
                 CLIENT_ERROR(context, "Failed to verify: no encrypted data");
 
                 pair_verify_context_free(context->verify_context);
@@ -1765,20 +2396,30 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
             size_t decrypted_data_size = 0;
             crypto_chacha20poly1305_decrypt(
                 context->verify_context->session_key, (byte *)"\x0\x0\x0\x0PV-Msg03", NULL, 0,
-                tlv_encrypted_data->value, tlv_encrypted_data->size,
+                tlv_encrypted_data.value, tlv_encrypted_data.size,
                 NULL, &decrypted_data_size
             );
 
-            byte *decrypted_data = malloc(decrypted_data_size);
+            // Decrypted message is parsed in place, keep it for the rest of request
+            byte *decrypted_data = arena_alloc(context->arena, decrypted_data_size);
+            if (!decrypted_data) {
+                CLIENT_ERROR(context, "Failed to allocate %d bytes for decrypted data", decrypted_data_size);
+
+                pair_verify_context_free(context->verify_context);
+                context->verify_context = NULL;
+
+                send_tlv_error_response(context, 4, TLVError_Unknown);
+                break;
+            }
+
             r = crypto_chacha20poly1305_decrypt(
                 context->verify_context->session_key, (byte *)"\x0\x0\x0\x0PV-Msg03", NULL, 0,
-                tlv_encrypted_data->value, tlv_encrypted_data->size,
+                tlv_encrypted_data.value, tlv_encrypted_data.size,
                 decrypted_data, &decrypted_data_size
             );
             if (r) {
                 CLIENT_ERROR(context, "Failed to decrypt data (code %d)", r);
 
-                free(decrypted_data);
                 pair_verify_context_free(context->verify_context);
                 context->verify_context = NULL;
 
@@ -1786,14 +2427,16 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
                 break;
             }
 
-            tlv_values_t *decrypted_message = tlv_new();
-            r = tlv_parse(decrypted_data, decrypted_data_size, decrypted_message);
-            free(decrypted_data);
+            tlv_item_t decrypted_message_items[TLV_MAX_ITEMS];
+            tlv_reader_t decrypted_message;
+            r = tlv_reader_init(
+                &decrypted_message, decrypted_data, decrypted_data_size,
+                decrypted_message_items, TLV_MAX_ITEMS
+            );
 
             if (r) {
                 CLIENT_ERROR(context, "Failed to parse decrypted TLV (code %d)", r);
 
-                tlv_free(decrypted_message);
                 pair_verify_context_free(context->verify_context);
                 context->verify_context = NULL;
 
@@ -1801,11 +2444,10 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
                 break;
             }
 
-            tlv_t *tlv_device_id = tlv_get_value(decrypted_message, TLVType_Identifier);
-            if (!tlv_device_id) {
+            tlv_view_t tlv_device_id;
+            if (!tlv_reader_get(&decrypted_message, TLVType_Identifier, &tlv_device_id, context->arena)) {
                 CLIENT_ERROR(context, "Invalid encrypted payload: no device identifier");
 
-                tlv_free(decrypted_message);
                 pair_verify_context_free(context->verify_context);
                 context->verify_context = NULL;
 
@@ -1813,11 +2455,10 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
                 break;
             }
 
-            tlv_t *tlv_device_signature = tlv_get_value(decrypted_message, TLVType_Signature);
-            if (!tlv_device_signature) {
+            tlv_view_t tlv_device_signature;
+            if (!tlv_reader_get(&decrypted_message, TLVType_Signature, &tlv_device_signature, context->arena)) {
                 CLIENT_ERROR(context, "Invalid encrypted payload: no device identifier");
 
-                tlv_free(decrypted_message);
                 pair_verify_context_free(context->verify_context);
                 context->verify_context = NULL;
 
@@ -1825,14 +2466,13 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
                 break;
             }
 
-            char *device_id = strndup((const char *)tlv_device_id->value, tlv_device_id->size);
+            char *device_id = strndup((const char *)tlv_device_id.value, tlv_device_id.size);
             CLIENT_DEBUG(context, "Searching pairing with %s", device_id);
             pairing_t *pairing = homekit_storage_find_pairing(device_id);
             if (!pairing) {
                 CLIENT_ERROR(context, "No pairing for %s found", device_id);
 
                 free(device_id);
-                tlv_free(decrypted_message);
                 pair_verify_context_free(context->verify_context);
                 context->verify_context = NULL;
 
@@ -1849,25 +2489,24 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
             size_t device_info_size =
                 context->verify_context->device_public_key_size +
                 context->verify_context->accessory_public_key_size +
-                tlv_device_id->size;
+                tlv_device_id.size;
 
             byte *device_info = malloc(device_info_size);
             memcpy(device_info,
                    context->verify_context->device_public_key, context->verify_context->device_public_key_size);
             memcpy(device_info + context->verify_context->device_public_key_size,
-                   tlv_device_id->value, tlv_device_id->size);
-            memcpy(device_info + context->verify_context->device_public_key_size + tlv_device_id->size,
+                   tlv_device_id.value, tlv_device_id.size);
+            memcpy(device_info + context->verify_context->device_public_key_size + tlv_device_id.size,
                    context->verify_context->accessory_public_key, context->verify_context->accessory_public_key_size);
 
             CLIENT_DEBUG(context, "Verifying device signature");
             r = crypto_ed25519_verify(
                 pairing->device_key,
                 device_info, device_info_size,
-                tlv_device_signature->value, tlv_device_signature->size
+                tlv_device_signature.value, tlv_device_signature.size
             );
             free(device_info);
             pairing_free(pairing);
-            tlv_free(decrypted_message);
 
             if (r) {
                 CLIENT_ERROR(context, "Failed to verify device signature (code %d)", r);
@@ -1928,7 +2567,12 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
                 break;
             }
 
-            tlv_values_t *response = tlv_new();
+            tlv_values_t *response = tlv_new_in(context->arena);
+            if (!response) {
+                CLIENT_ERROR(context, "Failed to allocate verify response");
+                send_tlv_error_response(context, 4, TLVError_Unknown);
+                break;
+            }
             tlv_add_integer_value(response, TLVType_State, 1, 4);
 
             send_tlv_response(context, response);
@@ -1937,7 +2581,7 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
             context->permissions = permissions;
             context->encrypted = true;
 
-            HOMEKIT_NOTIFY_EVENT(context->server, HOMEKIT_EVENT_CLIENT_VERIFIED);
+            context->pairing_actions |= PAIRING_ACTION_CLIENT_VERIFIED;
 
             CLIENT_INFO(context, "Verification successful, secure session established");
 
@@ -1945,12 +2589,10 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
         }
         default: {
             CLIENT_ERROR(context, "Unknown state: %d",
-                  tlv_get_integer_value(message, TLVType_State, -1));
+                  tlv_reader_get_integer(&message, TLVType_State, -1));
         }
     }
 
-    tlv_free(message);
-
 #ifdef HOMEKIT_OVERCLOCK_PAIR_VERIFY
     homekit_overclock_end();
 #endif
@@ -1961,9 +2603,15 @@ void homekit_server_on_get_accessories(client_context_t *context) {
     CLIENT_INFO(context, "Get Accessories");
     DEBUG_HEAP();
 
+    json_stream *json = json_new_in(context->arena, HOMEKIT_JSON_BUFFER_SIZE, client_send_chunk, context);
+    if (!json) {
+        CLIENT_ERROR(context, "Failed to allocate JSON stream");
+        send_500_response(context);
+        return;
+    }
+
     client_send(context, json_200_response_headers, sizeof(json_200_response_headers)-1);
 
-    json_stream *json = json_new(1024, client_send_chunk, context);
     json_object_start(json);
     json_string(json, "accessories"); json_array_start(json);
 
@@ -2026,6 +2674,71 @@ void homekit_server_on_get_accessories(client_context_t *context) {
     client_send_chunk(NULL, 0, context);
 }
 
+void write_characteristic_error(json_stream *json, int aid, int iid, int status) {
+    json_object_start(json);
+    json_string(json, "aid"); json_integer(json, aid);
+    json_string(json, "iid"); json_integer(json, iid);
+    json_string(json, "status"); json_integer(json, status);
+    json_object_end(json);
+}
+
+
+// Sends response to GET /characteristics once all values are available
+void send_characteristics_response(client_context_t *context) {
+    characteristic_reads_t *reads = context->reads;
+
+    bool success = true;
+    for (int i=0; i<reads->count; i++) {
+        if (reads->reads[i].status != HAPStatus_Success) {
+            success = false;
+            break;
+        }
+    }
+
+    json_stream *json = json_new_in(context->arena, 256, client_send_chunk, context);
+    if (!json) {
+        CLIENT_ERROR(context, "Failed to allocate JSON stream");
+        send_500_response(context);
+        characteristic_reads_free(context);
+        return;
+    }
+
+    if (success) {
+        client_send(context, json_200_response_headers, sizeof(json_200_response_headers)-1);
+    } else {
+        client_send(context, json_207_response_headers, sizeof(json_207_response_headers)-1);
+    }
+
+    json_object_start(json);
+    json_string(json, "characteristics"); json_array_start(json);
+
+    for (int i=0; i<reads->count; i++) {
+        characteristic_read_t *read = &reads->reads[i];
+        if (read->status != HAPStatus_Success) {
+            write_characteristic_error(json, read->aid, read->iid, read->status);
+            continue;
+        }
+
+        json_object_start(json);
+        write_characteristic_json(json, context, read->ch, reads->format, read->has_value ? &read->value : NULL);
+        if (!success) {
+            json_string(json, "status"); json_integer(json, HAPStatus_Success);
+        }
+        json_object_end(json);
+    }
+
+    json_array_end(json);
+    json_object_end(json); // response
+
+    json_flush(json);
+    json_free(json);
+
+    client_send_chunk(NULL, 0, context);
+
+    characteristic_reads_free(context);
+}
+
+
 void homekit_server_on_get_characteristics(client_context_t *context) {
     CLIENT_INFO(context, "Get Characteristics");
     DEBUG_HEAP();
@@ -2061,147 +2774,182 @@ void homekit_server_on_get_characteristics(client_context_t *context) {
     if (bool_endpoint_param("ev"))
         format |= characteristic_format_events;
 
-    bool success = true;
+    int count = 1;
+    for (const char *c = id_param->value; *c; c++) {
+        if (*c == ',')
+            count++;
+    }
+
+    // Every characteristic can be requested only once
+    if ((unsigned int)count > context->server->characteristics_count) {
+        CLIENT_ERROR(context, "Invalid get characteristics request: too many IDs (%d)", count);
+        send_json_error_response(context, 400, HAPStatus_InvalidValue);
+        return;
+    }
+
+    characteristic_reads_t *reads = arena_alloc(
+        context->arena, sizeof(characteristic_reads_t) + sizeof(characteristic_read_t) * count
+    );
+    if (!reads) {
+        send_json_error_response(context, 500, HAPStatus_OutOfResources);
+        return;
+    }
+
+    reads->format = format;
+    reads->count = 0;
+    reads->pending_count = 0;
 
-    char *id = strdup(id_param->value);
-    char *ch_id;
-    char *_id = id;
-    while ((ch_id = strsep(&_id, ","))) {
-        char *dot = strstr(ch_id, ".");
-        if (!dot) {
+    // IDs are parsed in place: "<aid>.<iid>[,<aid>.<iid>...]"
+    const char *p = id_param->value;
+    while (reads->count < count) {
+        char *end;
+        long aid = strtol(p, &end, 10);
+        if (end == p || *end != '.') {
             send_json_error_response(context, 400, HAPStatus_InvalidValue);
-            free(id);
             return;
         }
 
-        *dot = 0;
-        int aid = atoi(ch_id);
-        int iid = atoi(dot+1);
-
-        CLIENT_DEBUG(context, "Requested characteristic info for %d.%d", aid, iid);
-        homekit_characteristic_t *ch = homekit_characteristic_by_aid_and_iid(context->server->config->accessories, aid, iid);
-        if (!ch) {
-            success = false;
+        p = end + 1;
+        long iid = strtol(p, &end, 10);
+        if (end == p || (*end && *end != ',')) {
+            send_json_error_response(context, 400, HAPStatus_InvalidValue);
+            return;
+        }
+        p = end + 1;
+
+        characteristic_read_t *read = &reads->reads[reads->count++];
+        read->aid = aid;
+        read->iid = iid;
+        read->status = HAPStatus_Success;
+        read->pending = false;
+        read->has_value = false;
+
+        CLIENT_DEBUG(context, "Requested characteristic info for %d.%d", read->aid, read->iid);
+        read->ch = (aid > 0 && aid <= INT_MAX && iid > 0 && iid <= INT_MAX) ?
+            homekit_characteristic_by_aid_and_iid(context->server->config->accessories, aid, iid) :
+            NULL;
+        if (!read->ch) {
+            read->status = HAPStatus_NoResource;
             continue;
         }
 
-        if (!(ch->permissions & homekit_permissions_paired_read)) {
-            success = false;
+        if (!(read->ch->permissions & homekit_permissions_paired_read)) {
+            read->status = HAPStatus_WriteOnly;
             continue;
         }
     }
 
-    free(id);
-    id = strdup(id_param->value);
+    for (int i=0; i<reads->count; i++) {
+        characteristic_read_t *read = &reads->reads[i];
+        if (read->status != HAPStatus_Success || !read->ch->getter_async)
+            continue;
 
-    if (success) {
-        client_send(context, json_200_response_headers, sizeof(json_200_response_headers)-1);
-    } else {
-        client_send(context, json_207_response_headers, sizeof(json_207_response_headers)-1);
+        if (read->ch->getter_async(read->ch, &read->value)) {
+            read->has_value = true;
+        } else {
+            read->pending = true;
+            reads->pending_count++;
+        }
     }
 
-    json_stream *json = json_new(256, client_send_chunk, context);
-    json_object_start(json);
-    json_string(json, "characteristics"); json_array_start(json);
+    context->reads = reads;
 
-    void write_characteristic_error(json_stream *json, int aid, int iid, int status) {
-        json_object_start(json);
-        json_string(json, "aid"); json_integer(json, aid);
-        json_string(json, "iid"); json_integer(json, iid);
-        json_string(json, "status"); json_integer(json, status);
-        json_object_end(json);
+    if (reads->pending_count) {
+        CLIENT_DEBUG(context, "Waiting for %d characteristic values", reads->pending_count);
+        context->deferred = true;
+        context->server->deferred_count++;
+        timer_wheel_schedule(
+            context->server->timers, &context->request_timer,
+            homekit_server_time() + HOMEKIT_GETTER_TIMEOUT
+        );
+        return;
     }
 
-    _id = id;
-    while ((ch_id = strsep(&_id, ","))) {
-        char *dot = strstr(ch_id, ".");
-        *dot = 0;
-        int aid = atoi(ch_id);
-        int iid = atoi(dot+1);
+    send_characteristics_response(context);
+}
 
-        CLIENT_DEBUG(context, "Requested characteristic info for %d.%d", aid, iid);
-        homekit_characteristic_t *ch = homekit_characteristic_by_aid_and_iid(context->server->config->accessories, aid, iid);
-        if (!ch) {
-            write_characteristic_error(json, aid, iid, HAPStatus_NoResource);
-            continue;
-        }
 
-        if (!(ch->permissions & homekit_permissions_paired_read)) {
-            write_characteristic_error(json, aid, iid, HAPStatus_WriteOnly);
-            continue;
-        }
-
-        json_object_start(json);
-        write_characteristic_json(json, context, ch, format, NULL);
-        if (!success) {
-            json_string(json, "status"); json_integer(json, HAPStatus_Success);
-        }
-        json_object_end(json);
-    }
-
-    json_array_end(json);
-    json_object_end(json); // response
-
-    json_flush(json);
-    json_free(json);
-
-    client_send_chunk(NULL, 0, context);
+// Converts NUMBER token to int, fails if value does not fit
+static int json_token_int(const json_token *token, int *value) {
+    long long x;
+    if (json_token_integer(token, &x) || x < INT_MIN || x > INT_MAX)
+        return -1;
 
-    free(id);
+    *value = x;
+    return 0;
 }
 
 void homekit_server_on_update_characteristics(client_context_t *context, const byte *data, size_t size) {
     CLIENT_INFO(context, "Update Characteristics");
     DEBUG_HEAP();
 
-    char *data1 = strndup((char *)data, size);
-    cJSON *json = cJSON_Parse(data1);
-    free(data1);
+    // Body is parsed in place with a pull parser: first pass only validates
+    // it, so that malformed request does not change anything, second pass
+    // applies updates as characteristic objects are read.
+    json_reader reader;
+    json_token token;
 
-    if (!json) {
+    json_reader_init(&reader, (char *)data, size);
+    json_token_type r;
+    while ((r = json_reader_next(&reader, &token)) > JSON_TOKEN_END)
+        ;
+
+    if (r != JSON_TOKEN_END) {
         CLIENT_ERROR(context, "Failed to parse request JSON");
         send_json_error_response(context, 400, HAPStatus_InvalidValue);
         return;
     }
 
-    cJSON *characteristics = cJSON_GetObjectItem(json, "characteristics");
-    if (!characteristics) {
+    json_reader_init(&reader, (char *)data, size);
+    if (json_reader_next(&reader, &token) != JSON_TOKEN_OBJECT_START) {
+        CLIENT_ERROR(context, "Failed to parse request: no \"characteristics\" field");
+        send_json_error_response(context, 400, HAPStatus_InvalidValue);
+        return;
+    }
+
+    bool found = false;
+    while (json_reader_next(&reader, &token) == JSON_TOKEN_KEY) {
+        bool is_characteristics = json_token_equals(&token, "characteristics");
+        json_reader_next(&reader, &token);
+        if (is_characteristics) {
+            found = true;
+            break;
+        }
+        json_reader_skip(&reader, &token);
+    }
+
+    if (!found) {
         CLIENT_ERROR(context, "Failed to parse request: no \"characteristics\" field");
-        cJSON_Delete(json);
         send_json_error_response(context, 400, HAPStatus_InvalidValue);
         return;
     }
-    if (characteristics->type != cJSON_Array) {
+    if (token.type != JSON_TOKEN_ARRAY_START) {
         CLIENT_ERROR(context, "Failed to parse request: \"characteristics\" field is not an list");
-        cJSON_Delete(json);
         send_json_error_response(context, 400, HAPStatus_InvalidValue);
         return;
     }
 
-    HAPStatus process_characteristics_update(const cJSON *j_ch) {
-        cJSON *j_aid = cJSON_GetObjectItem(j_ch, "aid");
-        if (!j_aid) {
+    HAPStatus process_characteristics_update(
+        int aid, int iid, json_token *j_aid, json_token *j_iid, json_token *j_value, json_token *j_events
+    ) {
+        if (j_aid->type == JSON_TOKEN_END) {
             CLIENT_ERROR(context, "Failed to process request: no \"aid\" field");
             return HAPStatus_NoResource;
         }
-        if (j_aid->type != cJSON_Number) {
+        if (j_aid->type != JSON_TOKEN_NUMBER) {
             CLIENT_ERROR(context, "Failed to process request: \"aid\" field is not a number");
             return HAPStatus_NoResource;
         }
 
-        cJSON *j_iid = cJSON_GetObjectItem(j_ch, "iid");
-        if (!j_iid) {
+        if (j_iid->type == JSON_TOKEN_END) {
             CLIENT_ERROR(context, "Failed to process request: no \"iid\" field");
             return HAPStatus_NoResource;
         }
-        if (j_iid->type != cJSON_Number) {
+        if (j_iid->type != JSON_TOKEN_NUMBER) {
             CLIENT_ERROR(context, "Failed to process request: \"iid\" field is not a number");
             return HAPStatus_NoResource;
         }
 
-        int aid = j_aid->valueint;
-        int iid = j_iid->valueint;
-
         homekit_characteristic_t *ch = homekit_characteristic_by_aid_and_iid(
             context->server->config->accessories, aid, iid
         );
@@ -2211,8 +2959,7 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
             return HAPStatus_NoResource;
         }
 
-        cJSON *j_value = cJSON_GetObjectItem(j_ch, "value");
-        if (j_value) {
+        if (j_value->type != JSON_TOKEN_END) {
             homekit_value_t h_value = HOMEKIT_NULL();
 
             if (!(ch->permissions & homekit_permissions_paired_write)) {
@@ -2223,13 +2970,13 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
             switch (ch->format) {
                 case homekit_format_bool: {
                     bool value = false;
-                    if (j_value->type == cJSON_True) {
+                    double number;
+                    if (j_value->type == JSON_TOKEN_TRUE) {
                         value = true;
-                    } else if (j_value->type == cJSON_False) {
+                    } else if (j_value->type == JSON_TOKEN_FALSE) {
                         value = false;
-                    } else if (j_value->type == cJSON_Number &&
-                            (j_value->valueint == 0 || j_value->valueint == 1)) {
-                        value = j_value->valueint == 1;
+                    } else if (!json_token_number(j_value, &number) && (number == 0 || number == 1)) {
+                        value = number == 1;
                     } else {
                         CLIENT_ERROR(context, "Failed to update %d.%d: value is not a boolean or 0/1", aid, iid);
                         return HAPStatus_InvalidValue;
@@ -2251,7 +2998,7 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                 case homekit_format_uint64:
                 case homekit_format_int: {
                     // We accept boolean values here in order to fix a bug in HomeKit. HomeKit sometimes sends a boolean instead of an integer of value 0 or 1.
-                    if (j_value->type != cJSON_Number && j_value->type != cJSON_False && j_value->type != cJSON_True) {
+                    if (j_value->type != JSON_TOKEN_NUMBER && j_value->type != JSON_TOKEN_FALSE && j_value->type != JSON_TOKEN_TRUE) {
                         CLIENT_ERROR(context, "Failed to update %d.%d: value is not a number", aid, iid);
                         return HAPStatus_InvalidValue;
                     }
@@ -2296,7 +3043,13 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                     if (ch->max_value)
                         max_value = (int)*ch->max_value;
 
-                    int value = j_value->valueint;
+                    long long number;
+                    if (json_token_integer(j_value, &number) || number < INT_MIN || number > INT_MAX) {
+                        CLIENT_ERROR(context, "Failed to update %d.%d: value is not in range", aid, iid);
+                        return HAPStatus_InvalidValue;
+                    }
+
+                    int value = number;
                     if (value < min_value || value > max_value) {
                         CLIENT_ERROR(context, "Failed to update %d.%d: value is not in range", aid, iid);
                         return HAPStatus_InvalidValue;
@@ -2345,12 +3098,18 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                     break;
                 }
                 case homekit_format_float: {
-                    if (j_value->type != cJSON_Number) {
+                    if (j_value->type != JSON_TOKEN_NUMBER) {
                         CLIENT_ERROR(context, "Failed to update %d.%d: value is not a number", aid, iid);
                         return HAPStatus_InvalidValue;
                     }
 
-                    float value = j_value->valuedouble;
+                    double number;
+                    if (json_token_number(j_value, &number) || number < -FLT_MAX || number > FLT_MAX) {
+                        CLIENT_ERROR(context, "Failed to update %d.%d: value is not in range", aid, iid);
+                        return HAPStatus_InvalidValue;
+                    }
+
+                    float value = number;
                     if ((ch->min_value && value < *ch->min_value) ||
                             (ch->max_value && value > *ch->max_value)) {
                         CLIENT_ERROR(context, "Failed to update %d.%d: value is not in range", aid, iid);
@@ -2368,14 +3127,14 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                     break;
                 }
                 case homekit_format_string: {
-                    if (j_value->type != cJSON_String) {
+                    if (j_value->type != JSON_TOKEN_STRING) {
                         CLIENT_ERROR(context, "Failed to update %d.%d: value is not a string", aid, iid);
                         return HAPStatus_InvalidValue;
                     }
 
                     int max_len = (ch->max_len) ? *ch->max_len : 64;
 
-                    char *value = j_value->valuestring;
+                    char *value = json_token_string(j_value);
                     if (strlen(value) > max_len) {
                         CLIENT_ERROR(context, "Failed to update %d.%d: value is too long", aid, iid);
                         return HAPStatus_InvalidValue;
@@ -2393,42 +3152,46 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                     break;
                 }
                 case homekit_format_tlv: {
-                    if (j_value->type != cJSON_String) {
+                    if (j_value->type != JSON_TOKEN_STRING) {
                         CLIENT_ERROR(context, "Failed to update %d.%d: value is not a string", aid, iid);
                         return HAPStatus_InvalidValue;
                     }
 
                     int max_len = (ch->max_len) ? *ch->max_len : 256;
 
-                    char *value = j_value->valuestring;
+                    char *value = json_token_string(j_value);
                     size_t value_len = strlen(value);
                     if (value_len > max_len) {
                         CLIENT_ERROR(context, "Failed to update %d.%d: value is too long", aid, iid);
                         return HAPStatus_InvalidValue;
                     }
 
+                    // Decoded data and parsed items only live until update is applied
                     size_t tlv_size = base64_decoded_size((unsigned char*)value, value_len);
-                    byte *tlv_data = malloc(tlv_size);
+                    byte *tlv_data = arena_alloc(context->arena, tlv_size);
+                    tlv_values_t *tlv_values = tlv_new_in(context->arena);
+                    if (!tlv_data || !tlv_values) {
+                        CLIENT_ERROR(context, "Failed to update %d.%d: error allocating TLV", aid, iid);
+                        return HAPStatus_OutOfResources;
+                    }
+
                     if (base64_decode((byte*) value, value_len, tlv_data) < 0) {
-                        free(tlv_data);
                         CLIENT_ERROR(context, "Failed to update %d.%d: error Base64 decoding", aid, iid);
                         return HAPStatus_InvalidValue;
                     }
 
-                    tlv_values_t *tlv_values = tlv_new();
-                    int r = tlv_parse(tlv_data, tlv_size, tlv_values);
-                    free(tlv_data);
-
-                    if (r) {
+                    if (tlv_parse(tlv_data, tlv_size, tlv_values)) {
                         CLIENT_ERROR(context, "Failed to update %d.%d: error parsing TLV", aid, iid);
                         return HAPStatus_InvalidValue;
                     }
 
-                    CLIENT_DEBUG(context, "Updating characteristic %d.%d with TLV:", aid, iid);
-                    for (tlv_t *t=tlv_values->head; t; t=t->next) {
-                        char *escaped_payload = binary_to_string(t->value, t->size);
-                        CLIENT_DEBUG(context, "  Type %d value (%d bytes): %s", t->type, t->size, escaped_payload);
-                        free(escaped_payload);
+                    if (DEBUG_ENABLED()) {
+                        CLIENT_DEBUG(context, "Updating characteristic %d.%d with TLV:", aid, iid);
+                        for (tlv_t *t=tlv_values->head; t; t=t->next) {
+                            char *escaped_payload = binary_to_string(t->value, t->size);
+                            CLIENT_DEBUG(context, "  Type %d value (%d bytes): %s", t->type, t->size, escaped_payload);
+                            free(escaped_payload);
+                        }
                     }
 
                     h_value = HOMEKIT_TLV(tlv_values);
@@ -2459,41 +3222,96 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
             }
         }
 
-        cJSON *j_events = cJSON_GetObjectItem(j_ch, "ev");
-        if (j_events) {
+        if (j_events->type != JSON_TOKEN_END) {
             if (!(ch->permissions && homekit_permissions_notify)) {
                 CLIENT_ERROR(context, "Failed to set notification state for %d.%d: "
                       "notifications are not supported", aid, iid);
                 return HAPStatus_NotificationsUnsupported;
             }
 
-            if ((j_events->type != cJSON_True) && (j_events->type != cJSON_False)) {
+            if ((j_events->type != JSON_TOKEN_TRUE) && (j_events->type != JSON_TOKEN_FALSE)) {
                 CLIENT_ERROR(context, "Failed to set notification state for %d.%d: "
                       "invalid state value", aid, iid);
             }
 
-            if (j_events->type == cJSON_True) {
-                homekit_characteristic_add_notify_callback(ch, client_notify_characteristic, context);
-            } else {
-                homekit_characteristic_remove_notify_callback(ch, client_notify_characteristic, context);
-            }
+            client_subscribe(context, ch, j_events->type == JSON_TOKEN_TRUE);
         }
 
         return HAPStatus_Success;
     }
 
-    HAPStatus *statuses = malloc(sizeof(HAPStatus) * cJSON_GetArraySize(characteristics));
+    typedef struct {
+        int aid;
+        int iid;
+        HAPStatus status;
+    } update_status_t;
+
+    update_status_t *statuses = NULL;
+    size_t statuses_count = 0;
+    size_t statuses_size = 0;
+
     bool has_errors = false;
-    for (int i=0; i < cJSON_GetArraySize(characteristics); i++) {
-        cJSON *j_ch = cJSON_GetArrayItem(characteristics, i);
+    while (json_reader_next(&reader, &token) != JSON_TOKEN_ARRAY_END) {
+        json_token j_aid = { .type = JSON_TOKEN_END };
+        json_token j_iid = { .type = JSON_TOKEN_END };
+        json_token j_value = { .type = JSON_TOKEN_END };
+        json_token j_events = { .type = JSON_TOKEN_END };
+
+        if (token.type == JSON_TOKEN_OBJECT_START) {
+            while (json_reader_next(&reader, &token) == JSON_TOKEN_KEY) {
+                json_token *field = NULL;
+                if (json_token_equals(&token, "aid"))
+                    field = &j_aid;
+                else if (json_token_equals(&token, "iid"))
+                    field = &j_iid;
+                else if (json_token_equals(&token, "value"))
+                    field = &j_value;
+                else if (json_token_equals(&token, "ev"))
+                    field = &j_events;
+
+                json_reader_next(&reader, &token);
+                if (field)
+                    *field = token;
+                json_reader_skip(&reader, &token);
+            }
+        } else {
+            json_reader_skip(&reader, &token);
+        }
 
-        char *s = cJSON_Print(j_ch);
-        CLIENT_DEBUG(context, "Processing element %s", s);
-        free(s);
+        int aid = 0, iid = 0;
+        bool ids_valid =
+            (j_aid.type != JSON_TOKEN_NUMBER || !json_token_int(&j_aid, &aid)) &&
+            (j_iid.type != JSON_TOKEN_NUMBER || !json_token_int(&j_iid, &iid));
 
-        statuses[i] = process_characteristics_update(j_ch);
+        CLIENT_DEBUG(context, "Processing element %d.%d", aid, iid);
 
-        if (statuses[i] != HAPStatus_Success)
+        if (statuses_count == statuses_size) {
+            size_t new_size = statuses_size ? statuses_size * 2 : 4;
+            update_status_t *new_statuses = arena_realloc(
+                context->arena, statuses,
+                sizeof(update_status_t) * statuses_size,
+                sizeof(update_status_t) * new_size
+            );
+            if (!new_statuses) {
+                CLIENT_ERROR(context, "Failed to allocate update statuses");
+                send_json_error_response(context, 500, HAPStatus_OutOfResources);
+                return;
+            }
+            statuses = new_statuses;
+            statuses_size = new_size;
+        }
+
+        update_status_t *status = &statuses[statuses_count++];
+        status->aid = aid;
+        status->iid = iid;
+        if (ids_valid) {
+            status->status = process_characteristics_update(aid, iid, &j_aid, &j_iid, &j_value, &j_events);
+        } else {
+            CLIENT_ERROR(context, "Failed to process request: \"aid\" or \"iid\" is out of range");
+            status->status = HAPStatus_InvalidValue;
+        }
+
+        if (status->status != HAPStatus_Success)
             has_errors = true;
     }
 
@@ -2503,19 +3321,24 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
         send_204_response(context);
     } else {
         CLIENT_DEBUG(context, "There were processing errors, sending Multi-Status response");
+
+        json_stream *json1 = json_new_in(context->arena, HOMEKIT_JSON_BUFFER_SIZE, client_send_chunk, context);
+        if (!json1) {
+            CLIENT_ERROR(context, "Failed to allocate JSON stream");
+            send_500_response(context);
+            return;
+        }
+
         client_send(context, json_207_response_headers, sizeof(json_207_response_headers)-1);
 
-        json_stream *json1 = json_new(1024, client_send_chunk, context);
         json_object_start(json1);
         json_string(json1, "characteristics"); json_array_start(json1);
 
-        for (int i=0; i < cJSON_GetArraySize(characteristics); i++) {
-            cJSON *j_ch = cJSON_GetArrayItem(characteristics, i);
-
+        for (size_t i=0; i < statuses_count; i++) {
             json_object_start(json1);
-            json_string(json1, "aid"); json_integer(json1, cJSON_GetObjectItem(j_ch, "aid")->valueint);
-            json_string(json1, "iid"); json_integer(json1, cJSON_GetObjectItem(j_ch, "iid")->valueint);
-            json_string(json1, "status"); json_integer(json1, statuses[i]);
+            json_string(json1, "aid"); json_integer(json1, statuses[i].aid);
+            json_string(json1, "iid"); json_integer(json1, statuses[i].iid);
+            json_string(json1, "status"); json_integer(json1, statuses[i].status);
             json_object_end(json1);
         }
 
@@ -2527,29 +3350,30 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
 
         client_send_chunk(NULL, 0, context);
     }
-
-    free(statuses);
-    cJSON_Delete(json);
 }
 
 void homekit_server_on_pairings(client_context_t *context, const byte *data, size_t size) {
     DEBUG("HomeKit Pairings");
     DEBUG_HEAP();
 
-    tlv_values_t *message = tlv_new();
-    tlv_parse(data, size, message);
+    tlv_item_t message_items[TLV_MAX_ITEMS];
+    tlv_reader_t message;
+    if (tlv_reader_init(&message, data, size, message_items, TLV_MAX_ITEMS)) {
+        CLIENT_ERROR(context, "Failed to parse TLV payload");
+        send_tlv_error_response(context, 2, TLVError_Unknown);
+        return;
+    }
 
-    TLV_DEBUG(message);
+    TLV_READER_DEBUG(&message);
 
     int r;
 
-    if (tlv_get_integer_value(message, TLVType_State, -1) != 1) {
+    if (tlv_reader_get_integer(&message, TLVType_State, -1) != 1) {
         send_tlv_error_response(context, 2, TLVError_Unknown);
-        tlv_free(message);
         return;
     }
 
-    switch(tlv_get_integer_value(message, TLVType_Method, -1)) {
+    switch(tlv_reader_get_integer(&message, TLVType_Method, -1)) {
         case TLVMethod_AddPairing: {
             CLIENT_INFO(context, "Add Pairing");
 
@@ -2559,19 +3383,19 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
                 break;
             }
 
-            tlv_t *tlv_device_identifier = tlv_get_value(message, TLVType_Identifier);
-            if (!tlv_device_identifier) {
+            tlv_view_t tlv_device_identifier;
+            if (!tlv_reader_get(&message, TLVType_Identifier, &tlv_device_identifier, context->arena)) {
                 CLIENT_ERROR(context, "Invalid add pairing request: no device identifier");
                 send_tlv_error_response(context, 2, TLVError_Unknown);
                 break;
             }
-            tlv_t *tlv_device_public_key = tlv_get_value(message, TLVType_PublicKey);
-            if (!tlv_device_public_key) {
+            tlv_view_t tlv_device_public_key;
+            if (!tlv_reader_get(&message, TLVType_PublicKey, &tlv_device_public_key, context->arena)) {
                 CLIENT_ERROR(context, "Invalid add pairing request: no device public key");
                 send_tlv_error_response(context, 2, TLVError_Unknown);
                 break;
             }
-            int device_permissions = tlv_get_integer_value(message, TLVType_Permissions, -1);
+            int device_permissions = tlv_reader_get_integer(&message, TLVType_Permissions, -1);
             if (device_permissions == -1) {
                 CLIENT_ERROR(context, "Invalid add pairing request: no device permissions");
                 send_tlv_error_response(context, 2, TLVError_Unknown);
@@ -2580,7 +3404,7 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
 
             ed25519_key *device_key = crypto_ed25519_new();
             r = crypto_ed25519_import_public_key(
-                device_key, tlv_device_public_key->value, tlv_device_public_key->size
+                device_key, tlv_device_public_key.value, tlv_device_public_key.size
             );
             if (r) {
                 CLIENT_ERROR(context, "Failed to import device public key");
@@ -2590,8 +3414,8 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
             }
 
             char *device_identifier = strndup(
-                (const char *)tlv_device_identifier->value,
-                tlv_device_identifier->size
+                (const char *)tlv_device_identifier.value,
+                tlv_device_identifier.size
             );
 
             pairing_t *pairing = homekit_storage_find_pairing(device_identifier);
@@ -2612,8 +3436,8 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
 
                 pairing_free(pairing);
 
-                if (pairing_public_key_size != tlv_device_public_key->size ||
-                        memcmp(tlv_device_public_key->value, pairing_public_key, pairing_public_key_size)) {
+                if (pairing_public_key_size != tlv_device_public_key.size ||
+                        memcmp(tlv_device_public_key.value, pairing_public_key, pairing_public_key_size)) {
                     CLIENT_ERROR(context, "Failed to add pairing: pairing public key differs from given one");
                     free(pairing_public_key);
                     free(device_identifier);
@@ -2661,7 +3485,12 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
             free(device_identifier);
             crypto_ed25519_free(device_key);
 
-            tlv_values_t *response = tlv_new();
+            tlv_values_t *response = tlv_new_in(context->arena);
+            if (!response) {
+                CLIENT_ERROR(context, "Failed to allocate pairings response");
+                send_tlv_error_response(context, 2, TLVError_Unknown);
+                break;
+            }
             tlv_add_integer_value(response, TLVType_State, 1, 2);
 
             send_tlv_response(context, response);
@@ -2677,22 +3506,23 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
                 break;
             }
 
-            tlv_t *tlv_device_identifier = tlv_get_value(message, TLVType_Identifier);
-            if (!tlv_device_identifier) {
+            tlv_view_t tlv_device_identifier;
+            if (!tlv_reader_get(&message, TLVType_Identifier, &tlv_device_identifier, context->arena)) {
                 CLIENT_ERROR(context, "Invalid remove pairing request: no device identifier");
                 send_tlv_error_response(context, 2, TLVError_Unknown);
                 break;
             }
 
             char *device_identifier = strndup(
-                (const char *)tlv_device_identifier->value,
-                tlv_device_identifier->size
+                (const char *)tlv_device_identifier.value,
+                tlv_device_identifier.size
             );
 
             pairing_t *pairing = homekit_storage_find_pairing(device_identifier);
 
             if (pairing) {
                 bool is_admin = pairing->permissions & pairing_permissions_admin;
+                int pairing_id = pairing->id;
                 pairing_free(pairing);
 
                 r = homekit_storage_remove_pairing(device_identifier);
@@ -2707,11 +3537,10 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
 
                 HOMEKIT_NOTIFY_EVENT(context->server, HOMEKIT_EVENT_PAIRING_REMOVED);
 
-                client_context_t *c = context->server->clients;
-                while (c) {
-                    if (c->pairing_id == pairing->id)
+                for (int i=0; i<context->server->clients_count; i++) {
+                    client_context_t *c = context->server->clients[i];
+                    if (c->pairing_id == pairing_id)
                         c->disconnect = true;
-                    c = c->next;
                 }
 
                 if (is_admin) {
@@ -2742,7 +3571,12 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
 
             free(device_identifier);
 
-            tlv_values_t *response = tlv_new();
+            tlv_values_t *response = tlv_new_in(context->arena);
+            if (!response) {
+                CLIENT_ERROR(context, "Failed to allocate pairings response");
+                send_tlv_error_response(context, 2, TLVError_Unknown);
+                break;
+            }
             tlv_add_integer_value(response, TLVType_State, 1, 2);
 
             send_tlv_response(context, response);
@@ -2757,7 +3591,12 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
                 break;
             }
 
-            tlv_values_t *response = tlv_new();
+            tlv_values_t *response = tlv_new_in(context->arena);
+            if (!response) {
+                CLIENT_ERROR(context, "Failed to allocate pairings response");
+                send_tlv_error_response(context, 2, TLVError_Unknown);
+                break;
+            }
             tlv_add_integer_value(response, TLVType_State, 1, 2);
 
             bool first = true;
@@ -2794,8 +3633,6 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
             break;
         }
     }
-
-    tlv_free(message);
 }
 
 void homekit_server_on_reset(client_context_t *context) {
@@ -2804,9 +3641,11 @@ void homekit_server_on_reset(client_context_t *context) {
     homekit_server_reset();
     send_204_response(context);
 
-    vTaskDelay(3000 / portTICK_PERIOD_MS);
-
-    homekit_system_restart();
+    // Keep serving until response is delivered, then restart
+    timer_wheel_schedule(
+        context->server->timers, &context->server->restart_timer,
+        homekit_server_time() + 3000
+    );
 }
 
 void homekit_server_on_resource(client_context_t *context) {
@@ -2825,57 +3664,138 @@ void homekit_server_on_resource(client_context_t *context) {
 int homekit_server_on_url(http_parser *parser, const char *data, size_t length) {
     client_context_t *context = (client_context_t*) parser->data;
 
+    // URL can come in several pieces if it crosses boundary of received data
+    if (context->url_length + length > HOMEKIT_MAX_URL_SIZE) {
+        CLIENT_ERROR(context, "Request URL is too long (max %d). Disconnecting", HOMEKIT_MAX_URL_SIZE);
+        send_414_response(context);
+        context->disconnect = true;
+        return -1;
+    }
+
+    char *url = arena_realloc(
+        context->arena, context->url,
+        context->url ? context->url_length + 1 : 0,
+        context->url_length + length + 1
+    );
+    if (!url) {
+        CLIENT_ERROR(context, "Failed to allocate %d bytes for request URL", context->url_length + length + 1);
+        context->disconnect = true;
+        return -1;
+    }
+
+    memcpy(url + context->url_length, data, length);
+    context->url = url;
+    context->url_length += length;
+    context->url[context->url_length] = 0;
+
+    return 0;
+}
+
+// Sets endpoint and its parameters from complete request URL
+static void homekit_server_parse_url(client_context_t *context, http_parser *parser) {
     context->endpoint = HOMEKIT_ENDPOINT_UNKNOWN;
+
+    char *url = context->url ? context->url : "";
+    char *query = strchr(url, '?');
+    if (query)
+        *query++ = 0;
+
     if (parser->method == HTTP_GET) {
-        if (!strncmp(data, "/accessories", length)) {
+        if (!strcmp(url, "/accessories")) {
             context->endpoint = HOMEKIT_ENDPOINT_GET_ACCESSORIES;
-        } else {
-            static const char url[] = "/characteristics";
-            size_t url_len = sizeof(url)-1;
-
-            if (length >= url_len && !strncmp(data, url, url_len) &&
-                    (data[url_len] == 0 || data[url_len] == '?'))
-            {
-                context->endpoint = HOMEKIT_ENDPOINT_GET_CHARACTERISTICS;
-                if (data[url_len] == '?') {
-                    char *query = strndup(data+url_len+1, length-url_len-1);
-                    context->endpoint_params = query_params_parse(query);
-                    free(query);
-                }
-            }
+        } else if (!strcmp(url, "/characteristics")) {
+            context->endpoint = HOMEKIT_ENDPOINT_GET_CHARACTERISTICS;
+            if (query)
+                context->endpoint_params = query_params_parse_in(context->arena, query);
         }
     } else if (parser->method == HTTP_POST) {
-        if (!strncmp(data, "/identify", length)) {
+        if (!strcmp(url, "/identify")) {
             context->endpoint = HOMEKIT_ENDPOINT_IDENTIFY;
-        } else if (!strncmp(data, "/pair-setup", length)) {
+        } else if (!strcmp(url, "/pair-setup")) {
             context->endpoint = HOMEKIT_ENDPOINT_PAIR_SETUP;
-        } else if (!strncmp(data, "/pair-verify", length)) {
+        } else if (!strcmp(url, "/pair-verify")) {
             context->endpoint = HOMEKIT_ENDPOINT_PAIR_VERIFY;
-        } else if (!strncmp(data, "/pairings", length)) {
+        } else if (!strcmp(url, "/pairings")) {
             context->endpoint = HOMEKIT_ENDPOINT_PAIRINGS;
-        } else if (!strncmp(data, "/reset", length)) {
+        } else if (!strcmp(url, "/reset")) {
             context->endpoint = HOMEKIT_ENDPOINT_RESET;
-        } else if (!strncmp(data, "/resource", length)) {
+        } else if (!strcmp(url, "/resource")) {
             context->endpoint = HOMEKIT_ENDPOINT_RESOURCE;
         }
     } else if (parser->method == HTTP_PUT) {
-        if (!strncmp(data, "/characteristics", length)) {
+        if (!strcmp(url, "/characteristics")) {
             context->endpoint = HOMEKIT_ENDPOINT_UPDATE_CHARACTERISTICS;
         }
     }
 
     if (context->endpoint == HOMEKIT_ENDPOINT_UNKNOWN) {
-        char *url = strndup(data, length);
         ERROR("Unknown endpoint: %s %s", http_method_str(parser->method), url);
-        free(url);
     }
+}
+
+int homekit_server_on_headers_complete(http_parser *parser) {
+    client_context_t *context = parser->data;
+
+    homekit_server_parse_url(context, parser);
+
+    context->body = NULL;
+    context->body_length = 0;
+    context->body_size = 0;
+
+    if (parser->content_length == ULLONG_MAX || !parser->content_length)
+        return 0;
+
+    if (parser->content_length > HOMEKIT_MAX_BODY_SIZE) {
+        CLIENT_ERROR(context, "Request body is too large (%d bytes, max %d). Disconnecting",
+                     (int)parser->content_length, HOMEKIT_MAX_BODY_SIZE);
+        send_413_response(context);
+        context->disconnect = true;
+        return -1;
+    }
+
+    context->body_size = parser->content_length;
 
     return 0;
 }
 
 int homekit_server_on_body(http_parser *parser, const char *data, size_t length) {
     client_context_t *context = parser->data;
-    context->body = realloc(context->body, context->body_length + length + 1);
+
+    if (!context->body && length == context->body_size &&
+            data + length == context->parse_end && context->parse_end_writable)
+    {
+        // Whole body is in current piece of data, use it without copying
+        context->body = (char *)data;
+        context->body_length = length;
+        context->body[length] = 0;
+        return 0;
+    }
+
+    if (context->body_length + length > context->body_size) {
+        // No Content-Length: grow body as data arrives
+        if (context->body_length + length > HOMEKIT_MAX_BODY_SIZE) {
+            CLIENT_ERROR(context, "Request body is too large (max %d). Disconnecting", HOMEKIT_MAX_BODY_SIZE);
+            send_413_response(context);
+            context->disconnect = true;
+            return -1;
+        }
+
+        context->body = arena_realloc(
+            context->arena, context->body,
+            context->body_size ? context->body_size + 1 : 0,
+            context->body_length + length + 1
+        );
+        context->body_size = context->body_length + length;
+    } else if (!context->body) {
+        context->body = arena_alloc(context->arena, context->body_size + 1);
+    }
+
+    if (!context->body) {
+        CLIENT_ERROR(context, "Failed to allocate %d bytes for request body", context->body_size + 1);
+        context->disconnect = true;
+        return -1;
+    }
+
     memcpy(context->body + context->body_length, data, length);
     context->body_length += length;
     context->body[context->body_length] = 0;
@@ -2883,9 +3803,7 @@ int homekit_server_on_body(http_parser *parser, const char *data, size_t length)
     return 0;
 }
 
-int homekit_server_on_message_complete(http_parser *parser) {
-    client_context_t *context = parser->data;
-
+void homekit_server_dispatch_request(client_context_t *context) {
     switch(context->endpoint) {
         case HOMEKIT_ENDPOINT_PAIR_SETUP: {
             homekit_server_on_pair_setup(context, (const byte *)context->body, context->body_length);
@@ -2929,16 +3847,158 @@ int homekit_server_on_message_complete(http_parser *parser) {
             break;
         }
     }
+}
+
+
+// Releases everything that was allocated for current request
+void homekit_server_finish_request(client_context_t *context) {
+    context->endpoint_params = NULL;
+    context->url = NULL;
+    context->url_length = 0;
+    context->body = NULL;
+    context->body_length = 0;
+    context->body_size = 0;
+    arena_reset(context->arena);
+}
+
+
+// Hands pairing state over to pair setup request. Called by server
+// task before request is processed.
+void homekit_server_lend_pairing_context(client_context_t *context) {
+    homekit_server_t *server = context->server;
+
+    context->pairing_client = server->pairing_client;
+    if (server->pairing_client == context->handle) {
+        context->pairing_context = server->pairing_context;
+        server->pairing_context = NULL;
+    }
+}
+
+
+// Takes pairing context back from pair setup request, which
+// could have created, kept or discarded it. Called by server task.
+void homekit_server_return_pairing_context(client_context_t *context) {
+    homekit_server_t *server = context->server;
+
+    pairing_context_t *pairing_context = context->pairing_context;
+    context->pairing_context = NULL;
+    context->pairing_client = CLIENT_HANDLE_NONE;
+
+    if (!pairing_context) {
+        if (server->pairing_client == context->handle)
+            server->pairing_client = CLIENT_HANDLE_NONE;
+        return;
+    }
+
+    if (server->pairing_client != CLIENT_HANDLE_NONE &&
+            server->pairing_client != context->handle) {
+        // Another client started pair setup while request was queued
+        CLIENT_INFO(context, "Discarding pairing state: another pairing in progress");
+        pairing_context_free(pairing_context);
+        return;
+    }
+
+    server->pairing_context = pairing_context;
+    server->pairing_client = context->handle;
+}
+
+
+// Completes pair setup or pair verify request on server task:
+// takes pairing context back and applies recorded actions
+void homekit_server_finish_pairing_request(client_context_t *context) {
+    homekit_server_t *server = context->server;
+
+    if (context->endpoint == HOMEKIT_ENDPOINT_PAIR_SETUP)
+        homekit_server_return_pairing_context(context);
+
+    int actions = context->pairing_actions;
+    context->pairing_actions = 0;
+
+    if (actions & PAIRING_ACTION_PAIRING_ADDED) {
+        HOMEKIT_NOTIFY_EVENT(server, HOMEKIT_EVENT_PAIRING_ADDED);
+    }
+
+    if (actions & PAIRING_ACTION_PAIRED) {
+        server->paired = true;
+        homekit_setup_mdns(server);
+    }
+
+    if (actions & PAIRING_ACTION_CLIENT_VERIFIED) {
+        HOMEKIT_NOTIFY_EVENT(server, HOMEKIT_EVENT_CLIENT_VERIFIED);
+    }
+}
+
+
+// Hands current request to crypto task. Client stops being polled
+// until homekit_server_resume_client() is called.
+int homekit_server_suspend_client(client_context_t *context) {
+    // Body can point into data buffer, which is compacted when parser stops
+    if (context->body && (byte *)context->body >= context->data &&
+            (byte *)context->body < context->data + context->data_size)
+    {
+        char *body = arena_alloc(context->arena, context->body_length + 1);
+        if (!body) {
+            CLIENT_ERROR(context, "Failed to allocate %d bytes for request body", context->body_length + 1);
+            context->disconnect = true;
+            return -1;
+        }
+
+        memcpy(body, context->body, context->body_length + 1);
+        context->body = body;
+    }
+
+    CLIENT_DEBUG(context, "Suspending client until crypto operation completes");
+
+    context->suspended = true;
+    poller_remove(context->server->poller, context->socket);
+
+    context->server->crypto_jobs_pending++;
+    xQueueSendToBack(context->server->crypto_jobs, &context, portMAX_DELAY);
+
+    return 0;
+}
+
 
-    if (context->endpoint_params) {
-        query_params_free(context->endpoint_params);
-        context->endpoint_params = NULL;
+int homekit_server_on_message_complete(http_parser *parser) {
+    client_context_t *context = parser->data;
+
+    if (context->endpoint == HOMEKIT_ENDPOINT_PAIR_SETUP)
+        homekit_server_lend_pairing_context(context);
+
+    if (context->server->crypto_jobs && (
+            context->endpoint == HOMEKIT_ENDPOINT_PAIR_SETUP ||
+            context->endpoint == HOMEKIT_ENDPOINT_PAIR_VERIFY))
+    {
+        if (homekit_server_suspend_client(context)) {
+            homekit_server_finish_pairing_request(context);
+            return -1;
+        }
+
+        // Pipelined requests are processed after client is resumed
+        http_parser_pause(parser, 1);
+        return 0;
     }
 
-    if (context->body) {
-        free(context->body);
-        context->body = NULL;
-        context->body_length = 0;
+    bool encrypted = context->encrypted;
+
+    homekit_server_dispatch_request(context);
+    if (context->endpoint == HOMEKIT_ENDPOINT_PAIR_SETUP ||
+            context->endpoint == HOMEKIT_ENDPOINT_PAIR_VERIFY)
+        homekit_server_finish_pairing_request(context);
+
+    if (context->deferred) {
+        // Request is finished once all values are available,
+        // pipelined requests wait for it
+        http_parser_pause(parser, 1);
+        return 0;
+    }
+
+    homekit_server_finish_request(context);
+
+    if (context->encrypted != encrypted) {
+        // Pipelined data after pair verify is encrypted,
+        // stop here so that it goes through decryption
+        http_parser_pause(parser, 1);
     }
 
     return 0;
@@ -2947,109 +4007,457 @@ int homekit_server_on_message_complete(http_parser *parser) {
 
 static http_parser_settings homekit_http_parser_settings = {
     .on_url = homekit_server_on_url,
+    .on_headers_complete = homekit_server_on_headers_complete,
     .on_body = homekit_server_on_body,
     .on_message_complete = homekit_server_on_message_complete,
 };
 
 
-static void homekit_client_process(client_context_t *context) {
-    int data_len = read(
-        context->socket,
-        context->data+context->data_available,
-        context->data_size-context->data_available
+// Feeds data to HTTP parser. Returns number of bytes consumed
+// or negative value if data is not a valid HTTP request.
+static int homekit_client_parse(client_context_t *context, char *data, size_t size, bool end_writable) {
+    context->parse_end = data + size;
+    context->parse_end_writable = end_writable;
+
+    size_t parsed = http_parser_execute(
+        context->parser, &homekit_http_parser_settings, data, size
     );
-    if (data_len == 0) {
+
+    if (HTTP_PARSER_ERRNO(context->parser) == HPE_PAUSED) {
+        http_parser_pause(context->parser, 0);
+        return parsed;
+    }
+
+    if (parsed != size) {
+        if (!context->disconnect)
+            CLIENT_ERROR(context, "Failed to parse request: %s. Disconnecting",
+                         http_errno_description(HTTP_PARSER_ERRNO(context->parser)));
         context->disconnect = true;
-        return;
+        return -1;
     }
 
-    if (data_len < 0) {
-        if (errno != EAGAIN) {
-            CLIENT_ERROR(context, "Error reading data from socket (code %d). Disconnecting", errno);
-            context->disconnect = true;
+    return parsed;
+}
+
+
+// Processes all complete frames and requests that are in client buffer.
+static void homekit_client_process_data(client_context_t *context) {
+    current_client_context = context;
+
+    size_t offset = 0;
+    while (offset < context->data_available &&
+            !context->disconnect && !context->suspended && !context->deferred)
+    {
+        if (context->data_decrypted) {
+            // Rest of a frame that was decrypted before parser was paused
+            int r = homekit_client_parse(
+                context, (char *)context->data + offset, context->data_decrypted, false
+            );
+            if (r <= 0)
+                break;
+
+            offset += r;
+            context->data_decrypted -= r;
+        } else if (context->encrypted) {
+            // Decrypt complete frames in place and feed them to parser one by one,
+            // an incomplete trailing frame stays in buffer until more data arrives.
+            size_t payload_size = 0;
+            int r = client_decrypt_frame(
+                context,
+                context->data + offset, context->data_available - offset,
+                &payload_size
+            );
+            if (r < 0) {
+                CLIENT_ERROR(context, "Invalid client data");
+                context->disconnect = true;
+                break;
+            }
+            if (r == 0)
+                break;
+
+            byte *payload = context->data + offset + 2;
+            offset += r;
+
+            CLIENT_DEBUG(context, "Decrypted %d bytes", payload_size);
+            if (!payload_size)
+                continue;
+
+            print_binary("Decrypted data", payload, payload_size);
+
+            // Auth tag follows payload and is no longer needed
+            int parsed = homekit_client_parse(context, (char *)payload, payload_size, true);
+            if (parsed < 0)
+                break;
+
+            if (parsed < payload_size) {
+                // Parser was paused, move rest of payload right in front of next frame
+                context->data_decrypted = payload_size - parsed;
+                offset -= context->data_decrypted;
+                memmove(context->data + offset, payload + parsed, context->data_decrypted);
+            }
+        } else {
+            size_t payload_size = context->data_available - offset;
+
+            // Parser stops after a request that enabled encryption,
+            // rest of data is processed as encrypted frames
+            int r = homekit_client_parse(
+                context, (char *)context->data + offset, payload_size,
+                context->data_available < context->data_size
+            );
+            if (r <= 0)
+                break;
+
+            offset += r;
+        }
+    }
+
+    if (context->disconnect) {
+        context->data_available = 0;
+        context->data_decrypted = 0;
+    } else {
+        context->data_available -= offset;
+        if (offset && context->data_available) {
+            memmove(context->data, context->data + offset, context->data_available);
         }
-        return;
     }
 
-    CLIENT_DEBUG(context, "Got %d incomming data", data_len);
-    byte *payload = (byte *)context->data;
-    size_t payload_size = (size_t)data_len;
+    CLIENT_DEBUG(context, "Available %d bytes", context->data_available);
 
-    byte *decrypted = NULL;
-    size_t decrypted_size = 0;
+    current_client_context = NULL;
+}
 
+
+// Reads and processes data until socket has no more data or client
+// used up its budget, rest of data is processed on next poll.
+static void homekit_client_process(client_context_t *context) {
+    size_t budget = HOMEKIT_CLIENT_READ_BUDGET;
+
+    // Verified connections are kept open for events, unverified
+    // ones are dropped if they stay silent for too long
     if (context->encrypted) {
-        CLIENT_DEBUG(context, "Decrypting data");
+        timer_wheel_cancel(context->server->timers, &context->idle_timer);
+    } else {
+        timer_wheel_schedule(
+            context->server->timers, &context->idle_timer,
+            homekit_server_time() + HOMEKIT_CLIENT_IDLE_TIMEOUT
+        );
+    }
 
-        client_decrypt(context, context->data, data_len, NULL, &decrypted_size);
+    while (budget && !context->disconnect && !context->suspended && !context->deferred &&
+            context->output.length <= HOMEKIT_CLIENT_OUTPUT_HIGH_WATER)
+    {
+        size_t size = context->data_size - context->data_available;
+        if (!size)
+            break;
+        if (size > budget)
+            size = budget;
 
-        decrypted = malloc(decrypted_size);
-        int r = client_decrypt(context, context->data, data_len, decrypted, &decrypted_size);
-        if (r < 0) {
-            CLIENT_ERROR(context, "Invalid client data");
-            free(decrypted);
+        int data_len = read(context->socket, context->data + context->data_available, size);
+        if (data_len == 0) {
+            context->disconnect = true;
             return;
         }
-        context->data_available = data_len - r;
-        if (r && context->data_available) {
-            memmove(context->data, &context->data[r], context->data_available);
+
+        if (data_len < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                CLIENT_ERROR(context, "Error reading data from socket (code %d). Disconnecting", errno);
+                context->disconnect = true;
+            }
+            return;
         }
-        CLIENT_DEBUG(context, "Decrypted %d bytes, available %d", decrypted_size, context->data_available);
 
-        payload = decrypted;
-        payload_size = decrypted_size;
-        if (payload_size)
-            print_binary("Decrypted data", payload, payload_size);
-    } else {
-        context->data_available = 0;
+        CLIENT_DEBUG(context, "Got %d incomming data", data_len);
+        context->data_available += data_len;
+        budget -= data_len;
+
+        homekit_client_process_data(context);
+
+        if (data_len < size)
+            // Socket is drained
+            break;
     }
 
+    CLIENT_DEBUG(context, "Finished processing");
+}
+
+
+// Finishes request that was processed asynchronously
+// and processes requests that were pipelined after it
+void homekit_client_continue(client_context_t *context) {
+    homekit_server_finish_request(context);
+
+    homekit_client_process_data(context);
+    if (!context->suspended)
+        client_flush(context);
+}
+
+
+void homekit_server_resume_client(client_context_t *context) {
+    CLIENT_DEBUG(context, "Resuming client");
+
+    context->suspended = false;
+
+    if (poller_add(context->server->poller, context->socket, POLLER_READ, context)) {
+        CLIENT_ERROR(context, "Failed to watch client for data. Disconnecting");
+        context->disconnect = true;
+    }
+    context->poller_events = POLLER_READ;
+
+    homekit_client_continue(context);
+}
+
+
+// Sends response for asynchronous getters and processes
+// requests that were pipelined after it
+void homekit_client_complete_deferred(client_context_t *context) {
+    timer_wheel_cancel(context->server->timers, &context->request_timer);
+
+    context->deferred = false;
+    context->server->deferred_count--;
+
     current_client_context = context;
+    send_characteristics_response(context);
+    current_client_context = NULL;
+
+    homekit_client_continue(context);
+}
+
+
+void homekit_client_on_request_timeout(wheel_timer_t *timer, void *arg) {
+    client_context_t *context = arg;
+    if (!context->deferred || context->disconnect)
+        return;
+
+    characteristic_reads_t *reads = context->reads;
+    CLIENT_ERROR(context, "Timeout waiting for %d characteristic values", reads->pending_count);
+    for (int j=0; j<reads->count; j++) {
+        if (reads->reads[j].pending) {
+            reads->reads[j].pending = false;
+            reads->reads[j].status = HAPStatus_Timeout;
+        }
+    }
+    reads->pending_count = 0;
+
+    homekit_client_complete_deferred(context);
+}
+
+
+// Collects values reported by asynchronous getters and
+// sends responses that are complete
+void homekit_server_process_deferred(homekit_server_t *server) {
+    bool updated = false;
+
+    characteristic_event_t *result;
+    while (server->getter_results && xQueueReceive(server->getter_results, &result, 0)) {
+        for (int i=0; i<server->clients_count; i++) {
+            client_context_t *context = server->clients[i];
+            if (!context->deferred)
+                continue;
+
+            characteristic_reads_t *reads = context->reads;
+            for (int j=0; j<reads->count; j++) {
+                characteristic_read_t *read = &reads->reads[j];
+                if (!read->pending || read->ch != result->characteristic)
+                    continue;
+
+                homekit_value_copy_compact(&read->value, &result->value);
+                read->has_value = true;
+                read->pending = false;
+                reads->pending_count--;
+                updated = true;
+            }
+        }
+
+        homekit_value_destruct(&result->value);
+        free(result);
+    }
+
+    if (!updated)
+        return;
+
+    for (int i=0; i<server->clients_count; i++) {
+        client_context_t *context = server->clients[i];
+        if (!context->deferred || context->disconnect || context->reads->pending_count)
+            continue;
+
+        homekit_client_complete_deferred(context);
+    }
+}
+
+
+void homekit_client_on_idle_timeout(wheel_timer_t *timer, void *arg) {
+    client_context_t *context = arg;
+    if (context->encrypted || context->disconnect)
+        return;
+
+    if (context->suspended || context->deferred) {
+        // Request is still in progress, check again later
+        timer_wheel_schedule(
+            context->server->timers, timer,
+            homekit_server_time() + HOMEKIT_CLIENT_IDLE_TIMEOUT
+        );
+        return;
+    }
+
+    CLIENT_INFO(context, "Closing idle unverified connection");
+    context->disconnect = true;
+}
+
+
+void homekit_client_on_send_timeout(wheel_timer_t *timer, void *arg) {
+    client_context_t *context = arg;
+    if (context->disconnect)
+        return;
+
+    if (context->suspended) {
+        // Output belongs to crypto task, check again once it is done
+        timer_wheel_schedule(
+            context->server->timers, timer,
+            homekit_server_time() + HOMEKIT_CLIENT_SEND_TIMEOUT
+        );
+        return;
+    }
+
+    if (!context->output.length)
+        return;
+
+    CLIENT_ERROR(context, "Timeout writing data to socket. Disconnecting");
+    context->disconnect = true;
+}
+
+
+void homekit_server_on_pairing_timeout(wheel_timer_t *timer, void *arg) {
+    homekit_server_t *server = arg;
+    if (server->pairing_client == CLIENT_HANDLE_NONE)
+        return;
+
+    if (!server->pairing_context) {
+        // Pairing context is handed to a request in progress
+        timer_wheel_schedule(server->timers, timer, homekit_server_time() + 1000);
+        return;
+    }
+
+    INFO("Pair setup timed out, discarding pairing state");
+    pairing_context_free(server->pairing_context);
+    server->pairing_context = NULL;
+    server->pairing_client = CLIENT_HANDLE_NONE;
+}
+
+
+// Restarts pairing context expiry after every accepted pair setup step,
+// so that abandoned pair setup does not lock out other controllers
+void homekit_server_update_pairing_timer(homekit_server_t *server) {
+    pairing_context_t *pairing_context = server->pairing_context;
+    if (!pairing_context) {
+        if (server->pairing_client == CLIENT_HANDLE_NONE)
+            timer_wheel_cancel(server->timers, &server->pairing_timer);
+        return;
+    }
+
+    if (!pairing_context->renew_expiry)
+        return;
 
-    http_parser_execute(
-        context->parser, &homekit_http_parser_settings,
-        (char *)payload, payload_size
+    pairing_context->renew_expiry = false;
+    timer_wheel_schedule(
+        server->timers, &server->pairing_timer,
+        homekit_server_time() + HOMEKIT_PAIRING_TIMEOUT
     );
+}
 
-    current_client_context = NULL;
 
-    CLIENT_DEBUG(context, "Finished processing");
+void homekit_server_on_restart_timer(wheel_timer_t *timer, void *arg) {
+    homekit_system_restart();
+}
+
+
+void homekit_crypto_task(void *args) {
+    homekit_server_t *server = args;
+
+    client_context_t *context;
+    for (;;) {
+        if (!xQueueReceive(server->crypto_jobs, &context, portMAX_DELAY))
+            continue;
 
-    if (decrypted) {
-        free(decrypted);
+        homekit_server_dispatch_request(context);
+
+        // Send response right away, whatever socket does not accept
+        // is written by server task once client is resumed
+        client_output_write(context);
+
+        xQueueSendToBack(server->crypto_results, &context, portMAX_DELAY);
+        poller_wakeup(server->poller);
     }
 }
 
 
+void homekit_server_process_crypto_results(homekit_server_t *server) {
+    client_context_t *context;
+    while (server->crypto_jobs_pending && xQueueReceive(server->crypto_results, &context, 0)) {
+        server->crypto_jobs_pending--;
+        homekit_server_finish_pairing_request(context);
+        homekit_server_resume_client(context);
+    }
+}
+
+
+void homekit_server_add_client(homekit_server_t *server, client_context_t *context) {
+    uint16_t slot = server->free_slots[--server->free_slots_count];
+
+    server->client_slots[slot].client = context;
+    context->handle = CLIENT_HANDLE(slot, server->client_slots[slot].generation);
+
+    context->index = server->clients_count++;
+    server->clients[context->index] = context;
+}
+
+
+void homekit_server_remove_client(homekit_server_t *server, client_context_t *context) {
+    uint16_t slot = CLIENT_HANDLE_SLOT(context->handle);
+
+    server->client_slots[slot].client = NULL;
+    // Invalidate all outstanding handles to this slot, skipping zero
+    // so that handle is never equal to CLIENT_HANDLE_NONE
+    if (!++server->client_slots[slot].generation)
+        server->client_slots[slot].generation = 1;
+    server->free_slots[server->free_slots_count++] = slot;
+
+    client_context_t *last = server->clients[--server->clients_count];
+    server->clients[context->index] = last;
+    last->index = context->index;
+
+    context->handle = CLIENT_HANDLE_NONE;
+    context->index = -1;
+}
+
+
 void homekit_server_close_client(homekit_server_t *server, client_context_t *context) {
     CLIENT_INFO(context, "Closing client connection");
 
-    FD_CLR(context->socket, &server->fds);
-    // TODO: recalc server->max_fd ?
-    server->nfds--;
+    poller_remove(server->poller, context->socket);
 
     close(context->socket);
 
-    if (context->server->pairing_context && context->server->pairing_context->client == context) {
-        pairing_context_free(context->server->pairing_context);
-        context->server->pairing_context = NULL;
+    if (server->pairing_client == context->handle) {
+        if (server->pairing_context)
+            pairing_context_free(server->pairing_context);
+        server->pairing_context = NULL;
+        server->pairing_client = CLIENT_HANDLE_NONE;
     }
 
-    if (context->server->clients == context) {
-        context->server->clients = context->next;
-    } else {
-        client_context_t *c = context->server->clients;
-        while (c->next && c->next != context)
-            c = c->next;
-        if (c->next)
-            c->next = c->next->next;
+    if (context->deferred) {
+        context->deferred = false;
+        server->deferred_count--;
     }
+    characteristic_reads_free(context);
 
-    homekit_accessories_clear_notify_callbacks(
-        context->server->config->accessories,
-        client_notify_characteristic,
-        context
-    );
+    timer_wheel_cancel(server->timers, &context->request_timer);
+    timer_wheel_cancel(server->timers, &context->idle_timer);
+    timer_wheel_cancel(server->timers, &context->send_timer);
+
+    // Before slot is released, so that notifiers stop referencing client
+    client_unsubscribe_all(context);
+
+    homekit_server_remove_client(server, context);
 
     HOMEKIT_NOTIFY_EVENT(server, HOMEKIT_EVENT_CLIENT_DISCONNECTED);
 
@@ -3062,7 +4470,7 @@ client_context_t *homekit_server_accept_client(homekit_server_t *server) {
     if (s < 0)
         return NULL;
 
-    if (server->nfds > HOMEKIT_MAX_CLIENTS) {
+    if (server->clients_count >= HOMEKIT_MAX_CLIENTS) {
         INFO("No more room for client connections (max %d)", HOMEKIT_MAX_CLIENTS);
         close(s);
         return NULL;
@@ -3085,17 +4493,37 @@ client_context_t *homekit_server_accept_client(homekit_server_t *server) {
     const int maxpkt = 4; /* Drop connection after 4 probes without response */
     setsockopt(s, IPPROTO_TCP, TCP_KEEPCNT, &maxpkt, sizeof(maxpkt));
 
+    /* Writes are buffered per client, server never blocks on a single client */
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+
     client_context_t *context = client_context_new();
     context->server = server;
     context->socket = s;
-    context->next = server->clients;
 
-    server->clients = context;
+    context->events = calloc(EVENT_WORDS(server->characteristics_count), sizeof(uint32_t));
+    context->events_batch = calloc(EVENT_WORDS(server->characteristics_count), sizeof(uint32_t));
+    context->subscriptions = calloc(EVENT_WORDS(server->characteristics_count), sizeof(uint32_t));
+    if (!context->events || !context->events_batch || !context->subscriptions) {
+        ERROR("Failed to allocate event bitmaps for client %d", s);
+        close(s);
+        client_context_free(context);
+        return NULL;
+    }
+
+    homekit_server_add_client(server, context);
+
+    if (poller_add(server->poller, s, POLLER_READ, context)) {
+        ERROR("Failed to watch client %d for data", s);
+        homekit_server_remove_client(server, context);
+        close(s);
+        client_context_free(context);
+        return NULL;
+    }
 
-    FD_SET(s, &server->fds);
-    server->nfds++;
-    if (s > server->max_fd)
-        server->max_fd = s;
+    timer_wheel_schedule(
+        server->timers, &context->idle_timer,
+        homekit_server_time() + HOMEKIT_CLIENT_IDLE_TIMEOUT
+    );
 
     HOMEKIT_NOTIFY_EVENT(server, HOMEKIT_EVENT_CLIENT_CONNECTED);
 
@@ -3103,87 +4531,104 @@ client_context_t *homekit_server_accept_client(homekit_server_t *server) {
 }
 
 
-client_context_t *homekit_server_find_client_by_fd(homekit_server_t *server, int fd) {
-    client_context_t *context = server->clients;
-    while (context) {
-        if (context->socket == fd)
-            return context;
-        context = context->next;
-    }
+client_context_t *homekit_server_find_client(homekit_server_t *server, client_handle_t handle) {
+    uint16_t slot = CLIENT_HANDLE_SLOT(handle);
+    if (handle == CLIENT_HANDLE_NONE || slot >= HOMEKIT_MAX_CLIENTS)
+        return NULL;
 
-    return NULL;
+    client_context_t *context = server->client_slots[slot].client;
+    if (!context || context->handle != handle)
+        return NULL;
+
+    return context;
 }
 
 
 void homekit_server_process_notifications(homekit_server_t *server) {
-    client_context_t *context = server->clients;
-    while (context) {
-        characteristic_event_t *event = NULL;
-        if (xQueueReceive(context->event_queue, &event, 0)) {
-            // Get and coalesce all client events
-            client_event_t *events_head = malloc(sizeof(client_event_t));
-            events_head->characteristic = event->characteristic;
-            homekit_value_copy(&events_head->value, &event->value);
-            events_head->next = NULL;
-
-            homekit_value_destruct(&event->value);
-            free(event);
-
-            client_event_t *events_tail = events_head;
-
-            while (xQueueReceive(context->event_queue, &event, 0)) {
-                client_event_t *e = events_head;
-                while (e) {
-                    if (e->characteristic == event->characteristic)
-                        break;
-
-                    e = e->next;
-                }
+    size_t events_size = EVENT_WORDS(server->characteristics_count) * sizeof(uint32_t);
 
-                if (e) {
-                    homekit_value_destruct(&e->value);
-                } else {
-                    e = malloc(sizeof(client_event_t));
-                    e->characteristic = event->characteristic;
-                    e->next = NULL;
+    client_context_t *batch[HOMEKIT_MAX_CLIENTS];
+    int batch_count = 0;
 
-                    events_tail->next = e;
-                    events_tail = e;
-                }
+    // Take changes of all clients at once, so that clients
+    // subscribed to the same characteristics share EVENT body
+    xSemaphoreTake(server->events_lock, portMAX_DELAY);
+    for (int i=0; i<server->clients_count; i++) {
+        client_context_t *context = server->clients[i];
 
-                homekit_value_copy(&e->value, &event->value);
+        // Leave events pending while client is behind on reading,
+        // they are coalesced once its output drains
+        if (context->disconnect || context->suspended || !context->events_pending ||
+                context->output.length > HOMEKIT_CLIENT_OUTPUT_HIGH_WATER)
+            continue;
 
-                homekit_value_destruct(&event->value);
-                free(event);
-            }
+        memcpy(context->events_batch, context->events, events_size);
+        memset(context->events, 0, events_size);
+        context->events_pending = false;
+
+        batch[batch_count++] = context;
+    }
+    xSemaphoreGive(server->events_lock);
 
-            send_client_events(context, events_head);
+    for (int i=0; i<batch_count; i++) {
+        if (!batch[i])
+            continue;
 
-            client_event_t *e = events_head;
-            while (e) {
-                client_event_t *next = e->next;
+        const uint32_t *events = batch[i]->events_batch;
+        if (homekit_server_build_event(server, events)) {
+            ERROR("Failed to build EVENT body, dropping events");
+            continue;
+        }
 
-                homekit_value_destruct(&e->value);
-                free(e);
+        for (int j=i; j<batch_count; j++) {
+            client_context_t *context = batch[j];
+            if (!context || memcmp(context->events_batch, events, events_size))
+                continue;
 
-                e = next;
-            }
+            send_client_event(context);
+            client_flush(context);
+
+            batch[j] = NULL;
         }
+    }
+}
+
+
+void homekit_server_on_notify_timer(wheel_timer_t *timer, void *arg) {
+    homekit_server_process_notifications(arg);
+}
+
+
+// Delays sending events by batching window, so that bursts
+// of changes go out in as few EVENT messages as possible
+void homekit_server_schedule_notifications(homekit_server_t *server) {
+    if (wheel_timer_active(&server->notify_timer))
+        return;
 
-        context = context->next;
+    for (int i=0; i<server->clients_count; i++) {
+        client_context_t *context = server->clients[i];
+        if (context->disconnect || context->suspended ||
+                context->output.length > HOMEKIT_CLIENT_OUTPUT_HIGH_WATER)
+            continue;
+
+        if (context->events_pending) {
+            timer_wheel_schedule(
+                server->timers, &server->notify_timer,
+                homekit_server_time() + HOMEKIT_NOTIFICATION_BATCH_WINDOW
+            );
+            return;
+        }
     }
 }
 
 
 void homekit_server_close_clients(homekit_server_t *server) {
-    client_context_t *context = server->clients;
-    while (context) {
-        client_context_t *next = context->next;
+    // Iterate backwards: closing a client moves last client into its position
+    for (int i=server->clients_count-1; i>=0; i--) {
+        client_context_t *context = server->clients[i];
 
-        if (context->disconnect)
+        if (context->disconnect && !context->suspended)
             homekit_server_close_client(server, context);
-
-        context = next;
     }
 }
 
@@ -3201,36 +4646,80 @@ static void homekit_run_server(homekit_server_t *server)
     bind(server->listen_fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr));
     listen(server->listen_fd, 10);
 
-    FD_SET(server->listen_fd, &server->fds);
-    server->max_fd = server->listen_fd;
-    server->nfds = 1;
+    // Client sockets plus listening socket
+    server->poller = poller_new(HOMEKIT_MAX_CLIENTS + 1);
+    if (!server->poller) {
+        ERROR("Failed to create socket poller");
+        close(server->listen_fd);
+        return;
+    }
+    // Listening socket is registered with server as data pointer,
+    // all other sockets map directly to their client context
+    poller_add(server->poller, server->listen_fd, POLLER_READ, server);
+
+    poller_event_t events[HOMEKIT_MAX_CLIENTS + 1];
+
+    server->timers = timer_wheel_new(homekit_server_time());
+
+    server->getter_results = xQueueCreate(HOMEKIT_MAX_CLIENTS * 2, sizeof(characteristic_event_t*));
+    running_server = server;
+
+    server->crypto_jobs = xQueueCreate(HOMEKIT_MAX_CLIENTS, sizeof(client_context_t*));
+    server->crypto_results = xQueueCreate(HOMEKIT_MAX_CLIENTS, sizeof(client_context_t*));
+    if (!server->crypto_jobs || !server->crypto_results ||
+            xTaskCreate(homekit_crypto_task, "HomeKit Crypto", CRYPTO_TASK_STACK, server, 1, NULL) != pdPASS)
+    {
+        ERROR("Failed to start crypto task, pairing will block server");
+        if (server->crypto_jobs) {
+            vQueueDelete(server->crypto_jobs);
+            server->crypto_jobs = NULL;
+        }
+        if (server->crypto_results) {
+            vQueueDelete(server->crypto_results);
+            server->crypto_results = NULL;
+        }
+    }
 
     for (;;) {
-        fd_set read_fds;
-        memcpy(&read_fds, &server->fds, sizeof(read_fds));
+        // Sleep until nearest deadline, anything else wakes poller up
+        int timeout = timer_wheel_next_timeout(server->timers, homekit_server_time());
+        if (!poller_can_wakeup(server->poller)) {
+            // Without wakeups, poll often while there are requests in progress
+            int max_timeout = (server->crypto_jobs_pending || server->deferred_count) ? 10 : 1000;
+            if (timeout < 0 || timeout > max_timeout)
+                timeout = max_timeout;
+        }
 
-        struct timeval timeout = { 1, 0 }; /* 1 second timeout */
-        int triggered_nfds = select(server->max_fd + 1, &read_fds, NULL, NULL, &timeout);
-        if (triggered_nfds > 0) {
-            if (FD_ISSET(server->listen_fd, &read_fds)) {
-                homekit_server_accept_client(server);
-                triggered_nfds--;
-            }
+        int triggered_nfds = poller_wait(
+            server->poller, events, sizeof(events) / sizeof(*events), timeout
+        );
 
-            client_context_t *context = server->clients;
-            while (context && triggered_nfds) {
-                if (FD_ISSET(context->socket, &read_fds)) {
-                    homekit_client_process(context);
-                    triggered_nfds--;
-                }
+        timer_wheel_advance(server->timers, homekit_server_time());
 
-                context = context->next;
+        if (triggered_nfds > 0) {
+            for (int i=0; i<triggered_nfds; i++) {
+                if (events[i].data == server) {
+                    homekit_server_accept_client(server);
+                } else {
+                    client_context_t *context = events[i].data;
+                    if (context->deferred && (events[i].events & POLLER_ERROR))
+                        context->disconnect = true;
+                    if (events[i].events & POLLER_READ)
+                        homekit_client_process(context);
+                    if (!context->suspended)
+                        client_flush(context);
+                }
             }
-
-            homekit_server_close_clients(server);
         }
 
-        homekit_server_process_notifications(server);
+        homekit_server_process_crypto_results(server);
+        homekit_server_process_deferred(server);
+        if (HOMEKIT_NOTIFICATION_BATCH_WINDOW)
+            homekit_server_schedule_notifications(server);
+        else
+            homekit_server_process_notifications(server);
+        homekit_server_update_pairing_timer(server);
+        homekit_server_close_clients(server);
     }
 
     server_free(server);
@@ -3396,6 +4885,40 @@ void homekit_server_task(void *args) {
 #define ISDIGIT(x) isdigit((unsigned char)(x))
 #define ISBASE36(x) (isdigit((unsigned char)(x)) || (x >= 'A' && x <= 'Z'))
 
+// Builds table of characteristics by slot and storage for their events
+int homekit_server_init_events(homekit_server_t *server) {
+    unsigned int count = 0;
+    for (homekit_accessory_t **accessory_it = server->config->accessories; *accessory_it; accessory_it++) {
+        for (homekit_service_t **service_it = (*accessory_it)->services; *service_it; service_it++) {
+            for (homekit_characteristic_t **ch_it = (*service_it)->characteristics; *ch_it; ch_it++) {
+                if ((*ch_it)->slot >= count)
+                    count = (*ch_it)->slot + 1;
+            }
+        }
+    }
+
+    server->characteristics = calloc(count, sizeof(homekit_characteristic_t*));
+    server->event_values = calloc(count, sizeof(homekit_value_t));
+    server->subscribers = calloc(count, sizeof(client_mask_t));
+    server->events_lock = xSemaphoreCreateMutex();
+    if (!server->characteristics || !server->event_values ||
+            !server->subscribers || !server->events_lock)
+        return -1;
+
+    server->characteristics_count = count;
+
+    for (homekit_accessory_t **accessory_it = server->config->accessories; *accessory_it; accessory_it++) {
+        for (homekit_service_t **service_it = (*accessory_it)->services; *service_it; service_it++) {
+            for (homekit_characteristic_t **ch_it = (*service_it)->characteristics; *ch_it; ch_it++) {
+                server->characteristics[(*ch_it)->slot] = *ch_it;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
 void homekit_server_init(homekit_server_config_t *config) {
     if (!config->accessories) {
         ERROR("Error initializing HomeKit accessory server: "
@@ -3447,6 +4970,13 @@ void homekit_server_init(homekit_server_config_t *config) {
     homekit_server_t *server = server_new();
     server->config = config;
 
+    if (homekit_server_init_events(server)) {
+        ERROR("Error initializing HomeKit accessory server: "
+              "failed to allocate event storage");
+        server_free(server);
+        return;
+    }
+
     xTaskCreate(homekit_server_task, "HomeKit Server", SERVER_TASK_STACK, server, 1, NULL);
 }
 
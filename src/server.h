@@ -0,0 +1,12 @@
+#ifndef __HOMEKIT_SERVER_H__
+#define __HOMEKIT_SERVER_H__
+
+#include <homekit/types.h>
+
+// Internal interface between accessory model and server
+
+// Delivers change to controllers subscribed to characteristic events.
+// Called by homekit_characteristic_notify().
+void homekit_server_notify_characteristic(homekit_characteristic_t *ch, homekit_value_t value);
+
+#endif // __HOMEKIT_SERVER_H__
@@ -1,5 +1,16 @@
 #include <string.h>
 #include <ctype.h>
+
+#if defined(ESP_IDF)
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#elif defined(ESP_OPEN_RTOS)
+#include <FreeRTOS.h>
+#include <semphr.h>
+#else
+#error "Unknown target platform"
+#endif
+
 #include "debug.h"
 #include "crypto.h"
 #include "pairing.h"
@@ -27,7 +38,23 @@
 const char magic1[] = "HAP";
 
 
-int homekit_storage_reset() {
+// Pairings are read and modified by server task, crypto task
+// (pair setup and pair verify) and user code, each public
+// function that touches pairing records holds this lock.
+static SemaphoreHandle_t storage_lock = NULL;
+
+static void storage_lock_take() {
+    if (storage_lock)
+        xSemaphoreTake(storage_lock, portMAX_DELAY);
+}
+
+static void storage_lock_give() {
+    if (storage_lock)
+        xSemaphoreGive(storage_lock);
+}
+
+
+static int storage_reset() {
     byte blank[sizeof(magic1)];
     if (!spiflash_write(MAGIC_ADDR, blank, sizeof(blank))) {
         ERROR("Failed to reset flash");
@@ -38,7 +65,23 @@ int homekit_storage_reset() {
 }
 
 
+int homekit_storage_reset() {
+    storage_lock_take();
+    int r = storage_reset();
+    storage_lock_give();
+    return r;
+}
+
+
 int homekit_storage_init() {
+    if (!storage_lock) {
+        storage_lock = xSemaphoreCreateMutex();
+        if (!storage_lock) {
+            ERROR("Failed to create storage lock");
+            return -1;
+        }
+    }
+
     char magic[sizeof(magic1)];
     memset(magic, 0, sizeof(magic));
 
@@ -143,7 +186,7 @@ typedef struct {
 } pairing_data_t;
 
 
-bool homekit_storage_can_add_pairing() {
+static bool storage_can_add_pairing() {
     pairing_data_t data;
     for (int i=0; i<MAX_PAIRINGS; i++) {
         spiflash_read(PAIRINGS_ADDR + sizeof(data)*i, (byte *)&data, sizeof(data));
@@ -153,6 +196,14 @@ bool homekit_storage_can_add_pairing() {
     return false;
 }
 
+
+bool homekit_storage_can_add_pairing() {
+    storage_lock_take();
+    bool r = storage_can_add_pairing();
+    storage_lock_give();
+    return r;
+}
+
 static int compact_data() {
     byte *data = malloc(SPI_FLASH_SECTOR_SIZE);
     if (!spiflash_read(SPIFLASH_BASE_ADDR, data, SPI_FLASH_SECTOR_SIZE)) {
@@ -215,7 +266,7 @@ static int find_empty_block() {
     return -1;
 }
 
-int homekit_storage_add_pairing(const char *device_id, const ed25519_key *device_key, byte permissions) {
+static int storage_add_pairing(const char *device_id, const ed25519_key *device_key, byte permissions) {
     int next_block_idx = find_empty_block();
     if (next_block_idx == -1) {
         compact_data();
@@ -251,7 +302,15 @@ int homekit_storage_add_pairing(const char *device_id, const ed25519_key *device
 }
 
 
-int homekit_storage_update_pairing(const char *device_id, byte permissions) {
+int homekit_storage_add_pairing(const char *device_id, const ed25519_key *device_key, byte permissions) {
+    storage_lock_take();
+    int r = storage_add_pairing(device_id, device_key, permissions);
+    storage_lock_give();
+    return r;
+}
+
+
+static int storage_update_pairing(const char *device_id, byte permissions) {
     pairing_data_t data;
     for (int i=0; i<MAX_PAIRINGS; i++) {
         spiflash_read(PAIRINGS_ADDR + sizeof(data)*i, (byte *)&data, sizeof(data));
@@ -269,7 +328,7 @@ int homekit_storage_update_pairing(const char *device_id, byte permissions) {
                 return -2;
             }
 
-            r = homekit_storage_add_pairing(data.device_id, device_key, permissions);
+            r = storage_add_pairing(data.device_id, device_key, permissions);
             crypto_ed25519_free(device_key);
             if (r) {
                 return -2;
@@ -288,7 +347,15 @@ int homekit_storage_update_pairing(const char *device_id, byte permissions) {
 }
 
 
-int homekit_storage_remove_pairing(const char *device_id) {
+int homekit_storage_update_pairing(const char *device_id, byte permissions) {
+    storage_lock_take();
+    int r = storage_update_pairing(device_id, permissions);
+    storage_lock_give();
+    return r;
+}
+
+
+static int storage_remove_pairing(const char *device_id) {
     pairing_data_t data;
     for (int i=0; i<MAX_PAIRINGS; i++) {
         spiflash_read(PAIRINGS_ADDR + sizeof(data)*i, (byte *)&data, sizeof(data));
@@ -309,7 +376,15 @@ int homekit_storage_remove_pairing(const char *device_id) {
 }
 
 
-pairing_t *homekit_storage_find_pairing(const char *device_id) {
+int homekit_storage_remove_pairing(const char *device_id) {
+    storage_lock_take();
+    int r = storage_remove_pairing(device_id);
+    storage_lock_give();
+    return r;
+}
+
+
+static pairing_t *storage_find_pairing(const char *device_id) {
     pairing_data_t data;
     for (int i=0; i<MAX_PAIRINGS; i++) {
         spiflash_read(PAIRINGS_ADDR + sizeof(data)*i, (byte *)&data, sizeof(data));
@@ -338,6 +413,14 @@ pairing_t *homekit_storage_find_pairing(const char *device_id) {
 }
 
 
+pairing_t *homekit_storage_find_pairing(const char *device_id) {
+    storage_lock_take();
+    pairing_t *pairing = storage_find_pairing(device_id);
+    storage_lock_give();
+    return pairing;
+}
+
+
 typedef struct {
     int idx;
 } pairing_iterator_t;
@@ -355,7 +438,7 @@ void homekit_storage_pairing_iterator_free(pairing_iterator_t *iterator) {
 }
 
 
-pairing_t *homekit_storage_next_pairing(pairing_iterator_t *it) {
+static pairing_t *storage_next_pairing(pairing_iterator_t *it) {
     pairing_data_t data;
     while(it->idx < MAX_PAIRINGS) {
         int id = it->idx++;
@@ -384,3 +467,11 @@ pairing_t *homekit_storage_next_pairing(pairing_iterator_t *it) {
     return NULL;
 }
 
+
+pairing_t *homekit_storage_next_pairing(pairing_iterator_t *it) {
+    storage_lock_take();
+    pairing_t *pairing = storage_next_pairing(it);
+    storage_lock_give();
+    return pairing;
+}
+
@@ -0,0 +1,231 @@
+#include <stdlib.h>
+
+#include "timer_wheel.h"
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+
+#define LEVEL_SHIFT(level) ((level) * TIMER_WHEEL_BITS)
+#define LEVEL_SLOT(time, level) (((time) >> LEVEL_SHIFT(level)) & TIMER_WHEEL_MASK)
+
+#define TIME_BEFORE(a, b) ((int32_t)((a) - (b)) < 0)
+
+// Number of level slots between slot of time and slot of later deadline,
+// computed in a way that survives time wrapping around
+#define LEVEL_DISTANCE(deadline, time, level) \
+    (((deadline) - ((time) & ~((1u << LEVEL_SHIFT(level)) - 1))) >> LEVEL_SHIFT(level))
+
+
+struct _timer_wheel {
+    // All ticks before this time are processed
+    uint32_t time;
+
+    unsigned int count[TIMER_WHEEL_LEVELS];
+    wheel_timer_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+
+timer_wheel_t *timer_wheel_new(uint32_t now) {
+    timer_wheel_t *wheel = calloc(1, sizeof(timer_wheel_t));
+    if (!wheel)
+        return NULL;
+
+    wheel->time = now;
+
+    return wheel;
+}
+
+
+void timer_wheel_free(timer_wheel_t *wheel) {
+    for (int level=0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int slot=0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            while (wheel->slots[level][slot])
+                timer_wheel_cancel(wheel, wheel->slots[level][slot]);
+        }
+    }
+
+    free(wheel);
+}
+
+
+void wheel_timer_init(wheel_timer_t *timer, wheel_timer_callback_fn callback, void *context) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->deadline = 0;
+    timer->level = 0;
+    timer->callback = callback;
+    timer->context = context;
+}
+
+
+bool wheel_timer_active(const wheel_timer_t *timer) {
+    return timer->pprev != NULL;
+}
+
+
+static void timer_link(wheel_timer_t **head, wheel_timer_t *timer) {
+    timer->next = *head;
+    if (timer->next)
+        timer->next->pprev = &timer->next;
+    timer->pprev = head;
+    *head = timer;
+}
+
+
+static void timer_unlink(wheel_timer_t *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+
+static void timer_wheel_insert(timer_wheel_t *wheel, wheel_timer_t *timer) {
+    uint32_t deadline = timer->deadline;
+    if (TIME_BEFORE(deadline, wheel->time))
+        deadline = wheel->time;
+
+    // Pick lowest level where deadline is less than a full turn away,
+    // so that its slot is reached before wheel wraps around
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+            LEVEL_DISTANCE(deadline, wheel->time, level) >= TIMER_WHEEL_SLOTS)
+        level++;
+
+    uint32_t slot;
+    if (LEVEL_DISTANCE(deadline, wheel->time, level) >= TIMER_WHEEL_SLOTS) {
+        // Too far for the wheel, park in the last slot and re-sort later
+        slot = (LEVEL_SLOT(wheel->time, level) + TIMER_WHEEL_MASK) & TIMER_WHEEL_MASK;
+    } else {
+        slot = LEVEL_SLOT(deadline, level);
+    }
+
+    timer->level = level;
+    timer_link(&wheel->slots[level][slot], timer);
+    wheel->count[level]++;
+}
+
+
+void timer_wheel_schedule(timer_wheel_t *wheel, wheel_timer_t *timer, uint32_t deadline) {
+    if (wheel_timer_active(timer))
+        timer_wheel_cancel(wheel, timer);
+
+    timer->deadline = deadline;
+    timer_wheel_insert(wheel, timer);
+}
+
+
+void timer_wheel_cancel(timer_wheel_t *wheel, wheel_timer_t *timer) {
+    if (!wheel_timer_active(timer))
+        return;
+
+    wheel->count[timer->level]--;
+    timer_unlink(timer);
+}
+
+
+// Moves timers from given slot to lower levels
+static void timer_wheel_cascade(timer_wheel_t *wheel, int level, uint32_t slot) {
+    wheel_timer_t *timer = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+
+    while (timer) {
+        wheel_timer_t *next = timer->next;
+
+        wheel->count[level]--;
+        timer->next = NULL;
+        timer->pprev = NULL;
+        timer_wheel_insert(wheel, timer);
+
+        timer = next;
+    }
+}
+
+
+static void timer_wheel_fire(timer_wheel_t *wheel, uint32_t slot) {
+    // Detach slot first, callbacks can reschedule timers into the same slot
+    wheel_timer_t *expired = wheel->slots[0][slot];
+    wheel->slots[0][slot] = NULL;
+    if (expired)
+        expired->pprev = &expired;
+
+    while (expired) {
+        wheel_timer_t *timer = expired;
+        wheel->count[0]--;
+        timer_unlink(timer);
+
+        if (timer->callback)
+            timer->callback(timer, timer->context);
+    }
+}
+
+
+void timer_wheel_advance(timer_wheel_t *wheel, uint32_t now) {
+    while (!TIME_BEFORE(now, wheel->time)) {
+        uint32_t time = wheel->time;
+
+        if (!LEVEL_SLOT(time, 0)) {
+            for (int level=1; level < TIMER_WHEEL_LEVELS; level++) {
+                uint32_t slot = LEVEL_SLOT(time, level);
+                timer_wheel_cascade(wheel, level, slot);
+                if (slot)
+                    break;
+            }
+        }
+
+        timer_wheel_fire(wheel, LEVEL_SLOT(time, 0));
+
+        // Skip over stretches of time that have nothing scheduled
+        uint32_t next = time + 1;
+        for (int level=0; level < TIMER_WHEEL_LEVELS - 1 && !wheel->count[level]; level++) {
+            uint32_t boundary = ((time >> LEVEL_SHIFT(level + 1)) + 1) << LEVEL_SHIFT(level + 1);
+            if (TIME_BEFORE(now + 1, boundary)) {
+                next = now + 1;
+                break;
+            }
+            next = boundary;
+        }
+
+        wheel->time = next;
+    }
+}
+
+
+int timer_wheel_next_timeout(timer_wheel_t *wheel, uint32_t now) {
+    uint32_t time = wheel->time;
+    bool found = false;
+    uint32_t nearest = 0;
+
+    for (int level=0; level < TIMER_WHEEL_LEVELS; level++) {
+        if (!wheel->count[level])
+            continue;
+
+        uint32_t base = time >> LEVEL_SHIFT(level);
+        for (uint32_t i=0; i < TIMER_WHEEL_SLOTS; i++) {
+            if (!wheel->slots[level][(base + i) & TIMER_WHEEL_MASK])
+                continue;
+
+            // Level 0 slot is due at its tick, higher level slots
+            // need to be cascaded once wheel gets to their start
+            uint32_t at = (base + i) << LEVEL_SHIFT(level);
+            if (TIME_BEFORE(at, time))
+                at = time;
+
+            if (!found || TIME_BEFORE(at, nearest))
+                nearest = at;
+            found = true;
+            break;
+        }
+    }
+
+    if (!found)
+        return -1;
+
+    if (!TIME_BEFORE(now, nearest))
+        return 0;
+
+    return nearest - now;
+}
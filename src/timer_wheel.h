@@ -0,0 +1,55 @@
+#ifndef __HOMEKIT_TIMER_WHEEL_H__
+#define __HOMEKIT_TIMER_WHEEL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Hierarchical timer wheel with millisecond resolution. Four levels of
+// 64 slots cover ~4.6 hours, later deadlines are kept in last level and
+// re-sorted as time advances. Timers are embedded in their owners, so
+// scheduling does not allocate memory.
+//
+// Time is passed in by caller as milliseconds in uint32_t and may wrap.
+// Not thread safe: all calls should be made from one task.
+
+struct _wheel_timer;
+typedef struct _wheel_timer wheel_timer_t;
+
+typedef void (*wheel_timer_callback_fn)(wheel_timer_t *timer, void *context);
+
+struct _wheel_timer {
+    struct _wheel_timer *next;
+    struct _wheel_timer **pprev;
+
+    uint32_t deadline;
+    uint8_t level;
+
+    wheel_timer_callback_fn callback;
+    void *context;
+};
+
+
+struct _timer_wheel;
+typedef struct _timer_wheel timer_wheel_t;
+
+
+timer_wheel_t *timer_wheel_new(uint32_t now);
+void timer_wheel_free(timer_wheel_t *wheel);
+
+void wheel_timer_init(wheel_timer_t *timer, wheel_timer_callback_fn callback, void *context);
+bool wheel_timer_active(const wheel_timer_t *timer);
+
+// Schedules timer to fire at given time. Rescheduling active timer moves it.
+// Deadline that is already processed by timer_wheel_advance() fires on next tick.
+void timer_wheel_schedule(timer_wheel_t *wheel, wheel_timer_t *timer, uint32_t deadline);
+void timer_wheel_cancel(timer_wheel_t *wheel, wheel_timer_t *timer);
+
+// Fires all timers with deadlines up to given time. Callbacks may
+// schedule and cancel timers, including the one being fired.
+void timer_wheel_advance(timer_wheel_t *wheel, uint32_t now);
+
+// Returns number of milliseconds until wheel needs to be advanced next
+// (nearest deadline or internal re-sorting), or -1 if there are no timers.
+int timer_wheel_next_timeout(timer_wheel_t *wheel, uint32_t now);
+
+#endif // __HOMEKIT_TIMER_WHEEL_H__
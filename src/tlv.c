@@ -3,15 +3,40 @@
 
 #include <homekit/tlv.h>
 
+#include "arena.h"
+
+
+static void *tlv_alloc(const tlv_values_t *values, size_t size) {
+    return values->arena ? arena_alloc(values->arena, size) : malloc(size);
+}
+
 
 tlv_values_t *tlv_new() {
     tlv_values_t *values = malloc(sizeof(tlv_values_t));
+    if (!values)
+        return NULL;
+
+    values->head = NULL;
+    values->arena = NULL;
+    return values;
+}
+
+
+tlv_values_t *tlv_new_in(arena_t *arena) {
+    tlv_values_t *values = arena_alloc(arena, sizeof(tlv_values_t));
+    if (!values)
+        return NULL;
+
     values->head = NULL;
+    values->arena = arena;
     return values;
 }
 
 
 void tlv_free(tlv_values_t *values) {
+    if (values->arena)
+        return;
+
     tlv_t *t = values->head;
     while (t) {
         tlv_t *t2 = t;
@@ -25,7 +50,13 @@ void tlv_free(tlv_values_t *values) {
 
 
 int tlv_add_value_(tlv_values_t *values, byte type, byte *value, size_t size) {
-    tlv_t *tlv = malloc(sizeof(tlv_t));
+    tlv_t *tlv = tlv_alloc(values, sizeof(tlv_t));
+    if (!tlv) {
+        if (value && !values->arena)
+            free(value);
+        return -1;
+    }
+
     tlv->type = type;
     tlv->size = size;
     tlv->value = value;
@@ -47,7 +78,10 @@ int tlv_add_value_(tlv_values_t *values, byte type, byte *value, size_t size) {
 int tlv_add_value(tlv_values_t *values, byte type, const byte *value, size_t size) {
     byte *data = NULL;
     if (size) {
-        data = malloc(size);
+        data = tlv_alloc(values, size);
+        if (!data)
+            return -1;
+
         memcpy(data, value, size);
     }
     return tlv_add_value_(values, type, data, size);
@@ -71,10 +105,14 @@ int tlv_add_integer_value(tlv_values_t *values, byte type, size_t size, int valu
 int tlv_add_tlv_value(tlv_values_t *values, byte type, tlv_values_t *value) {
     size_t tlv_size = 0;
     tlv_format(value, NULL, &tlv_size);
-    byte *tlv_data = malloc(tlv_size);
+    byte *tlv_data = tlv_alloc(values, tlv_size);
+    if (!tlv_data && tlv_size)
+        return -1;
+
     int r = tlv_format(value, tlv_data, &tlv_size);
     if (r) {
-        free(tlv_data);
+        if (!values->arena)
+            free(tlv_data);
         return r;
     }
 
@@ -124,7 +162,10 @@ tlv_values_t *tlv_get_tlv_value(const tlv_values_t *values, byte type) {
     if (!t)
         return NULL;
 
-    tlv_values_t *value = tlv_new();
+    tlv_values_t *value = values->arena ? tlv_new_in(values->arena) : tlv_new();
+    if (!value)
+        return NULL;
+
     int r = tlv_parse(t->value, t->size, value);
 
     if (r) {
@@ -136,11 +177,17 @@ tlv_values_t *tlv_get_tlv_value(const tlv_values_t *values, byte type) {
 }
 
 
+size_t tlv_encoded_size(size_t size) {
+    // Empty value still takes one header
+    return size + 2 * (size ? (size + 254) / 255 : 1);
+}
+
+
 int tlv_format(const tlv_values_t *values, byte *buffer, size_t *size) {
     size_t required_size = 0;
     tlv_t *t = values->head;
     while (t) {
-        required_size += t->size + 2 * ((t->size + 254) / 255);
+        required_size += tlv_encoded_size(t->size);
         t = t->next;
     }
 
@@ -181,42 +228,265 @@ int tlv_format(const tlv_values_t *values, byte *buffer, size_t *size) {
 }
 
 
+// Reads item at *pos, including all its fragments
+static int tlv_scan_item(const byte *buffer, size_t length, size_t *pos, tlv_item_t *item) {
+    size_t i = *pos;
+    if (i + 2 > length)
+        return -1;
+
+    byte type = buffer[i];
+    size_t chunk_size = buffer[i+1];
+    if (i + 2 + chunk_size > length)
+        return -1;
+
+    item->type = type;
+    item->fragmented = false;
+    item->offset = i + 2;
+    item->size = chunk_size;
+    i += chunk_size + 2;
+
+    // Only full chunk can be followed by continuation of the same value
+    while (chunk_size == 255 && i + 2 <= length && buffer[i] == type) {
+        chunk_size = buffer[i+1];
+        if (i + 2 + chunk_size > length)
+            return -1;
+
+        item->fragmented = true;
+        item->size += chunk_size;
+        i += chunk_size + 2;
+    }
+
+    *pos = i;
+    return 0;
+}
+
+
+static void tlv_copy_item(const byte *buffer, const tlv_item_t *item, byte *data) {
+    size_t i = item->offset - 2;
+    size_t remaining = item->size;
+    while (remaining) {
+        size_t chunk_size = buffer[i+1];
+        memcpy(data, &buffer[i+2], chunk_size);
+        data += chunk_size;
+        i += chunk_size + 2;
+        remaining -= chunk_size;
+    }
+}
+
+
 int tlv_parse(const byte *buffer, size_t length, tlv_values_t *values) {
+    tlv_t **tail = &values->head;
+    while (*tail)
+        tail = &(*tail)->next;
+
     size_t i = 0;
     while (i < length) {
-        byte type = buffer[i];
-        size_t size = 0;
+        tlv_item_t item;
+        if (tlv_scan_item(buffer, length, &i, &item))
+            return -1;
+
         byte *data = NULL;
+        if (item.size) {
+            data = tlv_alloc(values, item.size);
+            if (!data)
+                return -1;
 
-        // scan TLVs to accumulate total size of subsequent TLVs with same type (chunked data)
-        size_t j = i;
-        while (j < length && buffer[j] == type && buffer[j+1] == 255) {
-            size_t chunk_size = buffer[j+1];
-            size += chunk_size;
-            j += chunk_size + 2;
+            tlv_copy_item(buffer, &item, data);
         }
-        if (j < length && buffer[j] == type) {
-            size_t chunk_size = buffer[j+1];
-            size += chunk_size;
+
+        tlv_t *tlv = tlv_alloc(values, sizeof(tlv_t));
+        if (!tlv) {
+            if (data && !values->arena)
+                free(data);
+            return -1;
         }
 
-        // allocate memory to hold all pieces of chunked data and copy data there
-        if (size != 0) {
-            data = malloc(size);
-            byte *p = data;
-
-            size_t remaining = size;
-            while (remaining) {
-                size_t chunk_size = buffer[i+1];
-                memcpy(p, &buffer[i+2], chunk_size);
-                p += chunk_size;
-                i += chunk_size + 2;
-                remaining -= chunk_size;
-            }
+        tlv->type = item.type;
+        tlv->size = item.size;
+        tlv->value = data;
+        tlv->next = NULL;
+
+        *tail = tlv;
+        tail = &tlv->next;
+    }
+
+    return 0;
+}
+
+
+int tlv_reader_init(tlv_reader_t *reader, const byte *buffer, size_t length, tlv_item_t *items, size_t max_items) {
+    reader->buffer = buffer;
+    reader->length = length;
+    reader->items = items;
+    reader->count = 0;
+
+    size_t i = 0;
+    while (i < length) {
+        if (reader->count == max_items ||
+                tlv_scan_item(buffer, length, &i, &items[reader->count])) {
+            reader->count = 0;
+            return -1;
         }
+        reader->count++;
+    }
+
+    return 0;
+}
 
-        tlv_add_value_(values, type, data, size);
+
+const tlv_item_t *tlv_reader_find(const tlv_reader_t *reader, byte type) {
+    for (size_t i=0; i < reader->count; i++) {
+        if (reader->items[i].type == type)
+            return &reader->items[i];
     }
+    return NULL;
+}
+
+
+int tlv_reader_get_integer(const tlv_reader_t *reader, byte type, int def) {
+    const tlv_item_t *item = tlv_reader_find(reader, type);
+    if (!item || item->fragmented)
+        return def;
+
+    const byte *value = reader->buffer + item->offset;
+    int x = 0;
+    for (int i=item->size-1; i>=0; i--) {
+        x = (x << 8) + value[i];
+    }
+    return x;
+}
+
+
+void tlv_reader_copy(const tlv_reader_t *reader, const tlv_item_t *item, byte *buffer) {
+    tlv_copy_item(reader->buffer, item, buffer);
+}
+
+
+bool tlv_reader_get(const tlv_reader_t *reader, byte type, tlv_view_t *view, arena_t *arena) {
+    const tlv_item_t *item = tlv_reader_find(reader, type);
+    if (!item)
+        return false;
+
+    view->size = item->size;
+    if (!item->fragmented) {
+        view->value = reader->buffer + item->offset;
+        return true;
+    }
+
+    byte *data = arena ? arena_alloc(arena, item->size) : malloc(item->size);
+    if (!data)
+        return false;
+
+    tlv_copy_item(reader->buffer, item, data);
+    view->value = data;
+
+    return true;
+}
+
+
+void tlv_writer_init(tlv_writer_t *writer, byte *buffer, size_t size) {
+    writer->buffer = buffer;
+    writer->size = buffer ? size : 0;
+    writer->length = 0;
+    writer->overflow = false;
+}
+
+
+byte *tlv_writer_reserve(tlv_writer_t *writer, size_t size) {
+    if (writer->overflow || size > writer->size - writer->length) {
+        writer->overflow = true;
+        return NULL;
+    }
+
+    byte *data = writer->buffer + writer->length;
+    writer->length += size;
+    return data;
+}
+
+
+size_t tlv_writer_begin(tlv_writer_t *writer, byte type) {
+    size_t mark = writer->length;
+    byte *header = tlv_writer_reserve(writer, 2);
+    if (header)
+        header[0] = type;
+
+    return mark;
+}
+
+
+int tlv_writer_end(tlv_writer_t *writer, size_t mark) {
+    if (writer->overflow)
+        return -1;
+
+    byte *buffer = writer->buffer + mark;
+    byte type = buffer[0];
+    size_t size = writer->length - mark - 2;
+
+    size_t fragments = size ? (size + 254) / 255 : 1;
+    if (fragments > 1 && tlv_writer_reserve(writer, 2 * (fragments - 1)) == NULL)
+        return -1;
+
+    // Value is contiguous after the first header, spread fragments
+    // starting from the last one, so that none is overwritten before
+    // it is moved
+    for (size_t i=fragments-1; i > 0; i--) {
+        size_t chunk_size = (size - i * 255 > 255) ? 255 : size - i * 255;
+        byte *chunk = buffer + i * 257;
+        memmove(chunk + 2, buffer + 2 + i * 255, chunk_size);
+        chunk[0] = type;
+        chunk[1] = chunk_size;
+    }
+
+    buffer[1] = (size > 255) ? 255 : size;
 
     return 0;
 }
+
+
+byte *tlv_writer_value(const tlv_writer_t *writer, size_t mark, size_t *size) {
+    *size = writer->length - mark - 2;
+    return writer->buffer + mark + 2;
+}
+
+
+int tlv_writer_add_value(tlv_writer_t *writer, byte type, const byte *value, size_t size) {
+    if (writer->overflow || tlv_encoded_size(size) > writer->size - writer->length) {
+        writer->overflow = true;
+        return -1;
+    }
+
+    byte *buffer = writer->buffer + writer->length;
+    do {
+        size_t chunk_size = (size > 255) ? 255 : size;
+        buffer[0] = type;
+        buffer[1] = chunk_size;
+        if (chunk_size) {
+            memcpy(buffer + 2, value, chunk_size);
+            value += chunk_size;
+        }
+
+        buffer += chunk_size + 2;
+        size -= chunk_size;
+    } while (size);
+
+    writer->length = buffer - writer->buffer;
+
+    return 0;
+}
+
+
+int tlv_writer_add_string(tlv_writer_t *writer, byte type, const char *value) {
+    return tlv_writer_add_value(writer, type, (const byte *)value, strlen(value));
+}
+
+
+int tlv_writer_add_integer(tlv_writer_t *writer, byte type, size_t size, int value) {
+    byte data[8];
+
+    for (size_t i=0; i<size; i++) {
+        data[i] = value & 0xff;
+        value >>= 8;
+    }
+
+    return tlv_writer_add_value(writer, type, data, size);
+}
@@ -0,0 +1,105 @@
+#include <malloc.h>
+#include <string.h>
+
+#include "alloc_count.h"
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+
+alloc_stats_t alloc_stats;
+
+static int fail_after = -1;
+
+
+void alloc_count_reset() {
+    memset(&alloc_stats, 0, sizeof(alloc_stats));
+}
+
+
+void alloc_count_fail_after(int count) {
+    fail_after = count;
+}
+
+
+static int should_fail() {
+    if (fail_after < 0)
+        return 0;
+    if (fail_after == 0)
+        return 1;
+
+    fail_after--;
+    return 0;
+}
+
+
+static void count_allocation(void *ptr) {
+    alloc_stats.allocations++;
+    alloc_stats.bytes += malloc_usable_size(ptr);
+    if (alloc_stats.bytes > alloc_stats.peak_bytes)
+        alloc_stats.peak_bytes = alloc_stats.bytes;
+}
+
+
+// Blocks allocated before last reset can make bytes go below zero
+static void count_free(void *ptr) {
+    size_t size = malloc_usable_size(ptr);
+    alloc_stats.frees++;
+    alloc_stats.bytes = size < alloc_stats.bytes ? alloc_stats.bytes - size : 0;
+}
+
+
+void *__wrap_malloc(size_t size) {
+    if (should_fail())
+        return NULL;
+
+    void *ptr = __real_malloc(size);
+    if (ptr)
+        count_allocation(ptr);
+    return ptr;
+}
+
+
+void *__wrap_calloc(size_t count, size_t size) {
+    if (should_fail())
+        return NULL;
+
+    void *ptr = __real_calloc(count, size);
+    if (ptr)
+        count_allocation(ptr);
+    return ptr;
+}
+
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    if (should_fail())
+        return NULL;
+
+    if (ptr)
+        count_free(ptr);
+
+    void *new_ptr = __real_realloc(ptr, size);
+    if (new_ptr)
+        count_allocation(new_ptr);
+    else if (ptr)
+        count_allocation(ptr);
+    return new_ptr;
+}
+
+
+char *__wrap_strdup(const char *s) {
+    size_t size = strlen(s) + 1;
+    char *copy = __wrap_malloc(size);
+    if (copy)
+        memcpy(copy, s, size);
+    return copy;
+}
+
+
+void __wrap_free(void *ptr) {
+    if (ptr)
+        count_free(ptr);
+    __real_free(ptr);
+}
@@ -0,0 +1,28 @@
+#ifndef __HOMEKIT_ALLOC_COUNT_H__
+#define __HOMEKIT_ALLOC_COUNT_H__
+
+#include <stddef.h>
+
+// Counts heap allocations made by code under test. Tests using it are
+// linked with $(ALLOC_COUNT_LDFLAGS), which routes malloc(), calloc(),
+// realloc(), strdup() and free() through wrappers in alloc_count.c.
+
+typedef struct {
+    // Successful malloc/calloc/realloc/strdup calls
+    size_t allocations;
+    size_t frees;
+    // Bytes currently allocated and the most allocated at once
+    size_t bytes;
+    size_t peak_bytes;
+} alloc_stats_t;
+
+extern alloc_stats_t alloc_stats;
+
+// Zeroes counters, bytes allocated before the call are not tracked
+void alloc_count_reset();
+
+// Makes allocations fail after given number of successful ones,
+// -1 lets all allocations succeed again
+void alloc_count_fail_after(int count);
+
+#endif // __HOMEKIT_ALLOC_COUNT_H__
@@ -0,0 +1,44 @@
+#ifndef __HOMEKIT_BENCH_H__
+#define __HOMEKIT_BENCH_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+// Helpers for host benchmarks. Benchmarks print their results and
+// are not part of "make -C tests", run them with "make -C tests bench".
+
+static inline uint64_t bench_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+// Opens counter of instructions executed in user space by calling thread.
+// Returns -1 if hardware counters are not available (e.g. in containers
+// or virtual machines without PMU).
+static inline int bench_instructions_open() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static inline uint64_t bench_instructions_read(int fd) {
+    uint64_t count = 0;
+    if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+        return 0;
+    return count;
+}
+
+#endif // __HOMEKIT_BENCH_H__
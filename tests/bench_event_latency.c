@@ -0,0 +1,125 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "bench.h"
+#include "output_queue.h"
+#include "poller.h"
+
+
+#define SAMPLES 500
+
+// Server loop of the benchmark: like homekit server it waits on poller,
+// then queues pending event for its client and writes it to socket
+typedef struct {
+    poller_t *poller;
+    int socket;
+    // Wait timeout, -1 when loop is woken up, 10 for polling fallback
+    int timeout;
+
+    volatile int pending;
+    volatile bool stop;
+} event_loop_t;
+
+
+static const char event[] = "EVENT/1.0 200 OK\r\nContent-Type: application/hap+json\r\n"
+                            "Content-Length: 52\r\n\r\n"
+                            "{\"characteristics\":[{\"aid\":1,\"iid\":9,\"value\":true}]}";
+
+
+static void *event_loop_task(void *arg) {
+    event_loop_t *loop = arg;
+
+    output_queue_t output;
+    output_queue_init(&output, 1024, 8192);
+
+    poller_event_t events[4];
+    while (!loop->stop) {
+        poller_wait(loop->poller, events, 4, loop->timeout);
+
+        while (__atomic_load_n(&loop->pending, __ATOMIC_ACQUIRE)) {
+            __atomic_sub_fetch(&loop->pending, 1, __ATOMIC_ACQ_REL);
+
+            uint8_t *data = output_queue_reserve(&output, sizeof(event) - 1);
+            memcpy(data, event, sizeof(event) - 1);
+            output_queue_commit(&output, sizeof(event) - 1);
+        }
+        output_queue_write(&output, loop->socket);
+    }
+
+    output_queue_clear(&output);
+    return NULL;
+}
+
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+
+// Measures time from queueing an event on another task until
+// client receives it
+static void bench_latency(const char *name, bool wakeup) {
+    int s[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, s);
+
+    event_loop_t loop = {
+        .poller = poller_new(4),
+        .socket = s[0],
+        .timeout = wakeup ? -1 : 10,
+    };
+    poller_add(loop.poller, s[0], POLLER_READ, NULL);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, event_loop_task, &loop);
+
+    static uint64_t latencies[SAMPLES];
+    char buffer[sizeof(event)];
+    for (int i=0; i<SAMPLES; i++) {
+        // Events come at random moments relative to loop
+        usleep(random() % 2000);
+
+        uint64_t start = bench_now_ns();
+        __atomic_add_fetch(&loop.pending, 1, __ATOMIC_ACQ_REL);
+        if (wakeup)
+            poller_wakeup(loop.poller);
+
+        size_t received = 0;
+        while (received < sizeof(event) - 1) {
+            int r = read(s[1], buffer, sizeof(event) - 1 - received);
+            if (r <= 0)
+                break;
+            received += r;
+        }
+        latencies[i] = bench_now_ns() - start;
+    }
+
+    loop.stop = true;
+    poller_wakeup(loop.poller);
+    // Polling loop stops after its timeout
+    pthread_join(thread, NULL);
+
+    qsort(latencies, SAMPLES, sizeof(*latencies), compare_u64);
+    printf("%-22s p50 %8.1f us  p99 %8.1f us  max %8.1f us\n", name,
+           latencies[SAMPLES / 2] / 1000.0,
+           latencies[SAMPLES * 99 / 100] / 1000.0,
+           latencies[SAMPLES - 1] / 1000.0);
+
+    poller_free(loop.poller);
+    close(s[0]);
+    close(s[1]);
+}
+
+
+int main() {
+    printf("Notify to wire latency of %d events\n", SAMPLES);
+    bench_latency("wakeup", true);
+    bench_latency("10 ms polling", false);
+
+    return 0;
+}
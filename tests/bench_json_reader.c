@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_CJSON
+#include <cJSON.h>
+#endif
+
+#include "alloc_count.h"
+#include "arena.h"
+#include "bench.h"
+#include "json.h"
+#include "port.h"
+
+
+#define WRITE_COUNT 50
+#define ITERATIONS 2000
+
+static char body[8192];
+static size_t body_length;
+
+
+// PUT /characteristics body of a scene that sets 50 characteristics
+static void build_body() {
+    size_t n = sprintf(body, "{\"characteristics\":[");
+    for (int i=0; i<WRITE_COUNT; i++) {
+        n += sprintf(body + n, "%s{\"aid\":%d,\"iid\":%d,", i ? "," : "", i / 5 + 1, i % 5 + 9);
+        switch (i % 4) {
+            case 0: n += sprintf(body + n, "\"value\":true}"); break;
+            case 1: n += sprintf(body + n, "\"value\":%d}", i * 3); break;
+            case 2: n += sprintf(body + n, "\"value\":%d.5,\"ev\":false}", i); break;
+            case 3: n += sprintf(body + n, "\"value\":\"Scene %d\"}", i); break;
+        }
+    }
+    n += sprintf(body + n, "]}");
+    body_length = n;
+}
+
+
+typedef struct {
+    int aid;
+    int iid;
+    int status;
+} update_status_t;
+
+static long long checksum;
+
+
+// Pull parser as used by homekit_server_on_update_characteristics():
+// validating pass, then reading writes in place, statuses go to
+// request arena. Body is parsed in the buffer it was received into,
+// here it is a copy, since parsing modifies it.
+static int parse_with_reader(const char *data, size_t size, arena_t *arena) {
+    static char buffer[sizeof(body)];
+    memcpy(buffer, data, size);
+
+    json_reader reader;
+    json_token token;
+
+    json_reader_init(&reader, buffer, size);
+    json_token_type r;
+    while ((r = json_reader_next(&reader, &token)) > JSON_TOKEN_END)
+        ;
+    if (r != JSON_TOKEN_END)
+        return -1;
+
+    json_reader_init(&reader, buffer, size);
+    json_reader_next(&reader, &token);
+    json_reader_next(&reader, &token);
+    if (!json_token_equals(&token, "characteristics") ||
+            json_reader_next(&reader, &token) != JSON_TOKEN_ARRAY_START)
+        return -1;
+
+    update_status_t *statuses = NULL;
+    size_t statuses_count = 0, statuses_size = 0;
+
+    while (json_reader_next(&reader, &token) == JSON_TOKEN_OBJECT_START) {
+        json_token j_aid = {0}, j_iid = {0}, j_value = {0}, j_events = {0};
+        while (json_reader_next(&reader, &token) == JSON_TOKEN_KEY) {
+            json_token *field = NULL;
+            if (json_token_equals(&token, "aid"))
+                field = &j_aid;
+            else if (json_token_equals(&token, "iid"))
+                field = &j_iid;
+            else if (json_token_equals(&token, "value"))
+                field = &j_value;
+            else if (json_token_equals(&token, "ev"))
+                field = &j_events;
+
+            json_reader_next(&reader, &token);
+            if (field)
+                *field = token;
+            json_reader_skip(&reader, &token);
+        }
+
+        if (statuses_count == statuses_size) {
+            size_t new_size = statuses_size ? statuses_size * 2 : 4;
+            statuses = arena_realloc(arena, statuses,
+                                     sizeof(update_status_t) * statuses_size,
+                                     sizeof(update_status_t) * new_size);
+            if (!statuses)
+                return -1;
+            statuses_size = new_size;
+        }
+
+        long long aid, iid, integer;
+        double number;
+        if (json_token_integer(&j_aid, &aid) || json_token_integer(&j_iid, &iid))
+            return -1;
+
+        if (j_value.type == JSON_TOKEN_STRING)
+            checksum += strlen(json_token_string(&j_value));
+        else if (j_value.type == JSON_TOKEN_NUMBER && !json_token_number(&j_value, &number))
+            checksum += number;
+        else if (!json_token_integer(&j_value, &integer))
+            checksum += integer;
+
+        update_status_t *status = &statuses[statuses_count++];
+        status->aid = aid;
+        status->iid = iid;
+        status->status = 0;
+    }
+
+    return statuses_count;
+}
+
+
+#ifdef HAVE_CJSON
+// cJSON as previously used by the handler: copy of body, parsed tree,
+// indexed array access and separate statuses array
+static int parse_with_cjson(const char *data, size_t size) {
+    char *data1 = strndup(data, size);
+    cJSON *json = cJSON_Parse(data1);
+    free(data1);
+    if (!json)
+        return -1;
+
+    cJSON *characteristics = cJSON_GetObjectItem(json, "characteristics");
+    if (!characteristics || characteristics->type != cJSON_Array) {
+        cJSON_Delete(json);
+        return -1;
+    }
+
+    int count = cJSON_GetArraySize(characteristics);
+    int *statuses = malloc(sizeof(int) * count);
+    for (int i=0; i < cJSON_GetArraySize(characteristics); i++) {
+        cJSON *j_ch = cJSON_GetArrayItem(characteristics, i);
+        cJSON *j_aid = cJSON_GetObjectItem(j_ch, "aid");
+        cJSON *j_iid = cJSON_GetObjectItem(j_ch, "iid");
+        cJSON *j_value = cJSON_GetObjectItem(j_ch, "value");
+        cJSON *j_events = cJSON_GetObjectItem(j_ch, "ev");
+        if (!j_aid || !j_iid || !j_value)
+            continue;
+
+        if (j_value->type == cJSON_String)
+            checksum += strlen(j_value->valuestring);
+        else if (j_value->type == cJSON_Number)
+            checksum += j_value->valuedouble;
+        else
+            checksum += j_value->type == cJSON_True;
+        if (j_events)
+            checksum += j_events->type == cJSON_True;
+
+        statuses[i] = j_aid->valueint + j_iid->valueint;
+    }
+
+    free(statuses);
+    cJSON_Delete(json);
+
+    return count;
+}
+#endif
+
+
+static void report(const char *name, uint64_t elapsed) {
+    printf("%-12s %7.1f us per request, %4zu mallocs, %5zu bytes heap peak\n",
+           name, (double)elapsed / ITERATIONS / 1000,
+           alloc_stats.allocations / ITERATIONS, alloc_stats.peak_bytes);
+}
+
+
+int main() {
+    build_body();
+    printf("PUT /characteristics body of %d writes, %zu bytes\n", WRITE_COUNT, body_length);
+
+    // Client arena exists for the whole connection
+    arena_t *arena = arena_new(HOMEKIT_CLIENT_ARENA_SIZE);
+
+    alloc_count_reset();
+    uint64_t start = bench_now_ns();
+    for (int i=0; i<ITERATIONS; i++) {
+        if (parse_with_reader(body, body_length, arena) != WRITE_COUNT) {
+            printf("Pull parser failed\n");
+            return 1;
+        }
+        arena_reset(arena);
+    }
+    report("pull parser", bench_now_ns() - start);
+
+    arena_free(arena);
+
+#ifdef HAVE_CJSON
+    alloc_count_reset();
+    start = bench_now_ns();
+    for (int i=0; i<ITERATIONS; i++) {
+        if (parse_with_cjson(body, body_length) != WRITE_COUNT) {
+            printf("cJSON failed\n");
+            return 1;
+        }
+    }
+    report("cJSON", bench_now_ns() - start);
+#else
+    printf("cJSON        skipped, run with CJSON_DIR=<directory with cJSON.c>\n");
+#endif
+
+    return checksum == 0;
+}
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "json.h"
+
+
+#define ITERATIONS 2000
+
+static size_t output_length;
+static size_t token_count;
+
+
+static void on_flush(uint8_t *buffer, size_t size, void *context) {
+    output_length += size;
+}
+
+
+// Each json_* call writes one token
+
+static void write_integers(json_stream *json) {
+    json_array_start(json);
+    for (int i=0; i<200; i++)
+        json_integer(json, i * 7919 - 500000);
+    json_array_end(json);
+    token_count += 202;
+}
+
+
+static void write_floats(json_stream *json) {
+    json_array_start(json);
+    for (int i=0; i<200; i++)
+        json_float(json, i * 0.37f - 20);
+    json_array_end(json);
+    token_count += 202;
+}
+
+
+static void write_strings(json_stream *json) {
+    json_array_start(json);
+    for (int i=0; i<200; i++)
+        json_string(json, i % 4 ? "public.hap.characteristic.brightness" : "Kitchen \"Ceiling\" Light\n");
+    json_array_end(json);
+    token_count += 202;
+}
+
+
+// Characteristics as written for GET /accessories
+static void write_accessories(json_stream *json) {
+    json_object_start(json);
+    json_string(json, "accessories"); json_array_start(json);
+    token_count += 3;
+
+    for (int i=0; i<40; i++) {
+        json_object_start(json);
+        json_string(json, "aid"); json_integer(json, i / 8 + 1);
+        json_string(json, "iid"); json_integer(json, i + 10);
+        json_string(json, "type"); json_string(json, "0000008-0000-1000-8000-0026BB765291");
+        json_string(json, "perms"); json_array_start(json);
+        json_string(json, "pr"); json_string(json, "pw"); json_string(json, "ev");
+        json_array_end(json);
+        json_string(json, "format"); json_string(json, "int");
+        json_string(json, "value"); json_integer(json, i * 3);
+        json_string(json, "minValue"); json_float(json, 0);
+        json_string(json, "maxValue"); json_float(json, 100);
+        json_string(json, "minStep"); json_float(json, 0.5);
+        json_string(json, "ev"); json_boolean(json, i % 2);
+        json_object_end(json);
+        token_count += 28;
+    }
+
+    json_array_end(json);
+    json_object_end(json);
+    token_count += 2;
+}
+
+
+typedef void (*writer_fn)(json_stream *json);
+
+// Writes document ITERATIONS times through 1024 byte buffer, like
+// server does for responses
+static void bench(const char *name, writer_fn writer, int instructions_fd) {
+    output_length = 0;
+    token_count = 0;
+
+    uint64_t instructions = bench_instructions_read(instructions_fd);
+    uint64_t start = bench_now_ns();
+
+    for (int i=0; i<ITERATIONS; i++) {
+        json_stream *json = json_new(1024, on_flush, NULL);
+        writer(json);
+        json_flush(json);
+        json_free(json);
+    }
+
+    uint64_t elapsed = bench_now_ns() - start;
+    instructions = bench_instructions_read(instructions_fd) - instructions;
+
+    printf("%-12s %7.1f MB/s %6.1f ns per token", name,
+           (double)output_length * 1000 / elapsed,
+           (double)elapsed / token_count);
+    if (instructions_fd >= 0)
+        printf(" %6.1f instructions per token\n", (double)instructions / token_count);
+    else
+        printf("    n/a instructions per token\n");
+}
+
+
+int main() {
+    int instructions_fd = bench_instructions_open();
+
+    bench("integers", write_integers, instructions_fd);
+    bench("floats", write_floats, instructions_fd);
+    bench("strings", write_strings, instructions_fd);
+    bench("accessories", write_accessories, instructions_fd);
+
+    if (instructions_fd < 0)
+        printf("Instruction counter is not available\n");
+    else
+        close(instructions_fd);
+
+    return 0;
+}
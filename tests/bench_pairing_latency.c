@@ -0,0 +1,204 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "bench.h"
+#include "poller.h"
+
+
+// CPU time of one simulated pair verify, requests of other
+// clients are measured while it runs
+#define PAIRING_MS 200
+#define DURATION_MS 2000
+
+
+typedef struct {
+    poller_t *poller;
+    int client_socket;
+    int pairing_socket;
+    // Pairing is done by worker thread instead of server loop
+    bool use_worker;
+
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t job_ready;
+    bool job_pending;
+    volatile bool job_done;
+
+    volatile bool stop;
+} server_t;
+
+
+static void pairing_work() {
+    uint64_t end = bench_now_ns() + PAIRING_MS * 1000000ULL;
+    while (bench_now_ns() < end)
+        ;
+}
+
+
+// Like crypto task: runs queued pairing and posts result back
+static void *worker_task(void *arg) {
+    server_t *server = arg;
+
+    pthread_mutex_lock(&server->lock);
+    while (!server->stop) {
+        if (!server->job_pending) {
+            pthread_cond_wait(&server->job_ready, &server->lock);
+            continue;
+        }
+        server->job_pending = false;
+        pthread_mutex_unlock(&server->lock);
+
+        pairing_work();
+        server->job_done = true;
+        poller_wakeup(server->poller);
+
+        pthread_mutex_lock(&server->lock);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    return NULL;
+}
+
+
+static void *server_task(void *arg) {
+    server_t *server = arg;
+    char c;
+
+    poller_event_t events[4];
+    while (!server->stop) {
+        int n = poller_wait(server->poller, events, 4, -1);
+
+        if (server->job_done) {
+            // Pairing client is resumed once its job is finished
+            server->job_done = false;
+            write(server->pairing_socket, "p", 1);
+            poller_add(server->poller, server->pairing_socket, POLLER_READ, &server->pairing_socket);
+        }
+
+        for (int i=0; i<n; i++) {
+            if (events[i].data == &server->client_socket) {
+                if (read(server->client_socket, &c, 1) == 1)
+                    write(server->client_socket, &c, 1);
+            } else if (read(server->pairing_socket, &c, 1) == 1) {
+                if (server->use_worker) {
+                    // Client is suspended while its job runs
+                    poller_remove(server->poller, server->pairing_socket);
+                    pthread_mutex_lock(&server->lock);
+                    server->job_pending = true;
+                    pthread_cond_signal(&server->job_ready);
+                    pthread_mutex_unlock(&server->lock);
+                } else {
+                    pairing_work();
+                    write(server->pairing_socket, "p", 1);
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+typedef struct {
+    int socket;
+    volatile bool stop;
+} pairing_client_t;
+
+
+// Controller that keeps pairing, with a short pause between pairings
+static void *pairing_client_task(void *arg) {
+    pairing_client_t *client = arg;
+    char c;
+
+    while (!client->stop) {
+        write(client->socket, "p", 1);
+        if (read(client->socket, &c, 1) != 1)
+            break;
+        usleep(50000);
+    }
+
+    return NULL;
+}
+
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+
+// Measures round trip of one byte requests of a client while
+// another client keeps pairing
+static void bench_latency(const char *name, bool use_worker) {
+    int client[2], pairing[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, client);
+    socketpair(AF_UNIX, SOCK_STREAM, 0, pairing);
+
+    server_t server = {
+        .poller = poller_new(4),
+        .client_socket = client[0],
+        .pairing_socket = pairing[0],
+        .use_worker = use_worker,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .job_ready = PTHREAD_COND_INITIALIZER,
+    };
+    poller_add(server.poller, client[0], POLLER_READ, &server.client_socket);
+    poller_add(server.poller, pairing[0], POLLER_READ, &server.pairing_socket);
+
+    pthread_t server_thread, pairing_thread;
+    pthread_create(&server_thread, NULL, server_task, &server);
+    if (use_worker)
+        pthread_create(&server.worker, NULL, worker_task, &server);
+
+    pairing_client_t pairing_client = { .socket = pairing[1] };
+    pthread_create(&pairing_thread, NULL, pairing_client_task, &pairing_client);
+
+    static uint64_t latencies[100000];
+    size_t count = 0;
+    uint64_t end = bench_now_ns() + DURATION_MS * 1000000ULL;
+    char c = 'r';
+    while (bench_now_ns() < end && count < sizeof(latencies) / sizeof(*latencies)) {
+        usleep(random() % 5000);
+
+        uint64_t start = bench_now_ns();
+        write(client[1], &c, 1);
+        if (read(client[1], &c, 1) != 1)
+            break;
+        latencies[count++] = bench_now_ns() - start;
+    }
+
+    pairing_client.stop = true;
+    pthread_join(pairing_thread, NULL);
+
+    pthread_mutex_lock(&server.lock);
+    server.stop = true;
+    pthread_cond_signal(&server.job_ready);
+    pthread_mutex_unlock(&server.lock);
+    poller_wakeup(server.poller);
+    pthread_join(server_thread, NULL);
+    if (use_worker)
+        pthread_join(server.worker, NULL);
+
+    qsort(latencies, count, sizeof(*latencies), compare_u64);
+    printf("%-18s %4zu requests  p50 %8.2f ms  p99 %8.2f ms  max %8.2f ms\n", name, count,
+           latencies[count / 2] / 1e6,
+           latencies[count * 99 / 100] / 1e6,
+           latencies[count - 1] / 1e6);
+
+    poller_free(server.poller);
+    close(client[0]); close(client[1]);
+    close(pairing[0]); close(pairing[1]);
+}
+
+
+int main() {
+    printf("Request latency while another client pairs (%d ms of CPU per pairing)\n", PAIRING_MS);
+    bench_latency("pairing inline", false);
+    bench_latency("crypto worker", true);
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "bench.h"
+#include "poller.h"
+
+
+#define ITERATIONS 20000
+
+// Server loop pattern: many idle connections, one of them has a request.
+// Each iteration makes one connection readable, waits for it and
+// consumes the data. Returns average nanoseconds per iteration.
+static double bench_connections(int count) {
+    poller_t *poller = poller_new(count);
+    if (!poller) {
+        printf("Failed to create poller for %d sockets\n", count);
+        exit(1);
+    }
+
+    int (*pairs)[2] = malloc(sizeof(*pairs) * count);
+    for (int i=0; i<count; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pairs[i])) {
+            printf("Failed to create %d socket pairs\n", count);
+            exit(1);
+        }
+        poller_add(poller, pairs[i][0], POLLER_READ, pairs[i]);
+    }
+
+    poller_event_t events[16];
+    uint64_t start = bench_now_ns();
+
+    unsigned int active = 1;
+    for (int n=0; n<ITERATIONS; n++) {
+        // Spread activity over all connections
+        active = active * 1103515245 + 12345;
+        int *pair = pairs[(active >> 8) % count];
+        write(pair[1], "x", 1);
+
+        int r = poller_wait(poller, events, 16, 1000);
+        if (r != 1 || events[0].data != pair) {
+            printf("Unexpected poller result %d\n", r);
+            exit(1);
+        }
+
+        char c;
+        read(pair[0], &c, 1);
+    }
+
+    uint64_t elapsed = bench_now_ns() - start;
+
+    for (int i=0; i<count; i++) {
+        close(pairs[i][0]);
+        close(pairs[i][1]);
+    }
+    free(pairs);
+    poller_free(poller);
+
+    return (double)elapsed / ITERATIONS;
+}
+
+
+int main() {
+#if defined(POLLER_POLL)
+    const char *backend = "poll";
+#elif defined(POLLER_SELECT)
+    const char *backend = "select";
+#else
+    const char *backend = "epoll";
+#endif
+
+    int counts[] = { 16, 64, 256 };
+    for (int i=0; i<sizeof(counts) / sizeof(*counts); i++) {
+        printf("%-6s %3d connections: %8.0f ns per ready socket\n",
+               backend, counts[i], bench_connections(counts[i]));
+    }
+
+    return 0;
+}
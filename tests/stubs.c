@@ -0,0 +1,4 @@
+#include <homekit/homekit.h>
+
+// Weak, so that tests linking debug.c get its definition
+__attribute__((weak)) homekit_log_level_t homekit_log_level = HOMEKIT_LOG_NONE;
@@ -0,0 +1,32 @@
+#ifndef __HOMEKIT_TEST_H__
+#define __HOMEKIT_TEST_H__
+
+#include <stdio.h>
+
+// Minimal helpers for host unit tests. Each test is a function,
+// failed checks are reported and counted, main() returns number
+// of failed tests.
+
+static int test_check_failures = 0;
+static int test_failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            test_check_failures++; \
+        } \
+    } while (0)
+
+#define RUN_TEST(test) \
+    do { \
+        test_check_failures = 0; \
+        test(); \
+        printf("%s %s\n", test_check_failures ? "FAIL" : "ok  ", #test); \
+        if (test_check_failures) \
+            test_failures++; \
+    } while (0)
+
+#define TEST_RESULT() (test_failures)
+
+#endif // __HOMEKIT_TEST_H__
@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.h"
+#include "test.h"
+
+
+void test_alloc_from_block() {
+    arena_t *arena = arena_new(100);
+    CHECK(arena != NULL);
+
+    char *a = arena_alloc(arena, 3);
+    char *b = arena_alloc(arena, 10);
+    CHECK(a && b);
+    // Allocations are 8-byte aligned and follow each other in block
+    CHECK((uintptr_t)a % 8 == 0);
+    CHECK(b == a + 8);
+
+    memset(a, 'a', 3);
+    memset(b, 'b', 10);
+    CHECK(a[2] == 'a' && b[0] == 'b');
+
+    arena_free(arena);
+}
+
+
+void test_alloc_outside_block() {
+    arena_t *arena = arena_new(64);
+
+    char *a = arena_alloc(arena, 32);
+    // Does not fit into rest of block
+    char *big = arena_alloc(arena, 1000);
+    CHECK(big != NULL);
+    CHECK(big < a || big >= a + 64);
+    memset(big, 0, 1000);
+
+    // Block is still used for small allocations
+    char *b = arena_alloc(arena, 16);
+    CHECK(b == a + 32);
+
+    // Chunks are released by reset and by free (checked by sanitizer)
+    arena_reset(arena);
+    arena_alloc(arena, 500);
+    arena_free(arena);
+}
+
+
+void test_reset_reuses_block() {
+    arena_t *arena = arena_new(64);
+
+    char *a = arena_alloc(arena, 16);
+    arena_alloc(arena, 16);
+    arena_reset(arena);
+
+    CHECK(arena_alloc(arena, 8) == a);
+
+    arena_free(arena);
+}
+
+
+void test_realloc_last_in_place() {
+    arena_t *arena = arena_new(128);
+
+    arena_alloc(arena, 8);
+    char *a = arena_realloc(arena, NULL, 0, 10);
+    memcpy(a, "123456789", 10);
+
+    char *b = arena_realloc(arena, a, 10, 60);
+    CHECK(b == a);
+    CHECK(!strcmp(b, "123456789"));
+
+    // Next allocation goes after extended one
+    char *c = arena_alloc(arena, 8);
+    CHECK(c == a + 64);
+
+    arena_free(arena);
+}
+
+
+void test_realloc_moves() {
+    arena_t *arena = arena_new(128);
+
+    char *a = arena_alloc(arena, 10);
+    memcpy(a, "123456789", 10);
+    arena_alloc(arena, 8);
+
+    // Not the last allocation
+    char *b = arena_realloc(arena, a, 10, 20);
+    CHECK(b != a);
+    CHECK(!strcmp(b, "123456789"));
+
+    // Shrinking keeps pointer
+    CHECK(arena_realloc(arena, b, 20, 5) == b);
+
+    // Does not fit into block
+    char *c = arena_realloc(arena, b, 20, 1000);
+    CHECK(c != NULL && c != b);
+    CHECK(!strcmp(c, "123456789"));
+
+    arena_free(arena);
+}
+
+
+void test_strndup() {
+    arena_t *arena = arena_new(64);
+
+    char *s = arena_strndup(arena, "hello world", 5);
+    CHECK(!strcmp(s, "hello"));
+
+    s = arena_strndup(arena, "hi", 10);
+    CHECK(!strcmp(s, "hi"));
+
+    arena_free(arena);
+}
+
+
+int main() {
+    RUN_TEST(test_alloc_from_block);
+    RUN_TEST(test_alloc_outside_block);
+    RUN_TEST(test_reset_reuses_block);
+    RUN_TEST(test_realloc_last_in_place);
+    RUN_TEST(test_realloc_moves);
+    RUN_TEST(test_strndup);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,281 @@
+#include <string.h>
+
+#include "json.h"
+#include "test.h"
+
+
+// Reads all tokens of document, returns type of last token
+// (JSON_TOKEN_END or JSON_TOKEN_ERROR)
+static json_token_type read_all(const char *document) {
+    char buffer[256];
+    strncpy(buffer, document, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = 0;
+
+    json_reader reader;
+    json_reader_init(&reader, buffer, strlen(buffer));
+
+    json_token token;
+    json_token_type type;
+    while ((type = json_reader_next(&reader, &token)) > 0);
+
+    return type;
+}
+
+
+void test_valid_documents() {
+    const char *documents[] = {
+        "{}",
+        "[]",
+        " {\"a\":[1,2,{\"b\":null}],\"c\":true} ",
+        "1",
+        "\"x\\u00e9\"",
+        "-0.5e+3",
+        "[[],[{}]]",
+        "[true,false,null,0,-0,1.5E-3,\"\"]",
+    };
+
+    for (int i=0; i<sizeof(documents) / sizeof(*documents); i++) {
+        if (read_all(documents[i]) != JSON_TOKEN_END) {
+            printf("Rejected valid document: %s\n", documents[i]);
+            CHECK(0);
+        }
+    }
+}
+
+
+void test_invalid_documents() {
+    const char *documents[] = {
+        "", "{", "{,}", "[1,]", "{\"a\"}", "{\"a\":1,}", "[1 2]", "01", "1.",
+        "tru", "{} x", "[}", "{]", "\"\\x\"", "\"a", "{1:2}", "[\"\\u12g4\"]",
+        "]", "{\"a\":1 \"b\":2}", "[\"a\nb\"]", "-", "1e", "[,1]", ":",
+    };
+
+    for (int i=0; i<sizeof(documents) / sizeof(*documents); i++) {
+        if (read_all(documents[i]) != JSON_TOKEN_ERROR) {
+            printf("Accepted invalid document: %s\n", documents[i]);
+            CHECK(0);
+        }
+    }
+}
+
+
+void test_nesting_limit() {
+    char document[128];
+
+    // 30 levels are fine
+    memset(document, '[', 30);
+    memset(document + 30, ']', 30);
+    document[60] = 0;
+    CHECK(read_all(document) == JSON_TOKEN_END);
+
+    memset(document, '[', 31);
+    memset(document + 31, ']', 31);
+    document[62] = 0;
+    CHECK(read_all(document) == JSON_TOKEN_ERROR);
+}
+
+
+void test_tokens() {
+    char document[] = "{\"s\":\"text\",\"n\":-12,\"f\":2.5e1,\"b\":false,\"z\":null}";
+
+    json_reader reader;
+    json_reader_init(&reader, document, strlen(document));
+
+    json_token token;
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_OBJECT_START);
+
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_KEY);
+    CHECK(json_token_equals(&token, "s"));
+    CHECK(!json_token_equals(&token, "st"));
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_STRING);
+    CHECK(token.length == 4 && !strncmp(token.value, "text", 4));
+
+    long long integer;
+    double number;
+
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_KEY);
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_NUMBER);
+    CHECK(json_token_integer(&token, &integer) == 0 && integer == -12);
+
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_KEY);
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_NUMBER);
+    CHECK(json_token_number(&token, &number) == 0 && number == 25.0);
+    CHECK(json_token_integer(&token, &integer) == 0 && integer == 25);
+
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_KEY);
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_FALSE);
+    CHECK(json_token_integer(&token, &integer) == 0 && integer == 0);
+    CHECK(json_token_number(&token, &number) == -1);
+
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_KEY);
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_NULL);
+
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_OBJECT_END);
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_END);
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_END);
+}
+
+
+// Converts number document with json_token_integer()
+static int read_integer(const char *document, long long *value) {
+    char buffer[128];
+    strcpy(buffer, document);
+
+    json_reader reader;
+    json_reader_init(&reader, buffer, strlen(buffer));
+
+    json_token token;
+    if (json_reader_next(&reader, &token) != JSON_TOKEN_NUMBER)
+        return -2;
+
+    return json_token_integer(&token, value);
+}
+
+
+static int read_number(const char *document, double *value) {
+    char buffer[128];
+    strcpy(buffer, document);
+
+    json_reader reader;
+    json_reader_init(&reader, buffer, strlen(buffer));
+
+    json_token token;
+    if (json_reader_next(&reader, &token) != JSON_TOKEN_NUMBER)
+        return -2;
+
+    return json_token_number(&token, value);
+}
+
+
+void test_integer_range() {
+    long long x;
+    CHECK(read_integer("4294967297", &x) == 0 && x == 4294967297LL);
+    CHECK(read_integer("9223372036854775807", &x) == 0 && x == 9223372036854775807LL);
+    CHECK(read_integer("-9223372036854775808", &x) == 0 && x == -9223372036854775807LL - 1);
+    CHECK(read_integer("-0", &x) == 0 && x == 0);
+    CHECK(read_integer("12.9", &x) == 0 && x == 12);
+    CHECK(read_integer("1e3", &x) == 0 && x == 1000);
+
+    // Values that do not fit are reported, not wrapped or truncated
+    CHECK(read_integer("9223372036854775808", &x) == -1);
+    CHECK(read_integer("-9223372036854775809", &x) == -1);
+    CHECK(read_integer("1000000000000000000000000000000000", &x) == -1);
+    CHECK(read_integer("1e19", &x) == -1);
+    CHECK(read_integer("-1e300", &x) == -1);
+}
+
+
+void test_number_range() {
+    double x;
+    CHECK(read_number("-0.5e+3", &x) == 0 && x == -500);
+    CHECK(read_number("1000000000000000000000000000000000", &x) == 0 && x == 1e33);
+    CHECK(read_number("0.000000000000000000000000000000000000001", &x) == 0 && x == 1e-39);
+
+    CHECK(read_number("1e400", &x) == -1);
+    CHECK(read_number("-1e400", &x) == -1);
+
+    // Longer than any number written by controllers
+    char document[100];
+    memset(document, '1', 80);
+    document[80] = 0;
+    CHECK(read_number(document, &x) == -1);
+}
+
+
+void test_string_decoding() {
+    char document[] = "[\"a\\\"b\\\\c\\/d\\n\\u00e9\\ud83d\\ude00\",\"plain\",\"k\\u0065y\"]";
+
+    json_reader reader;
+    json_reader_init(&reader, document, strlen(document));
+
+    json_token token, plain, escaped;
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_ARRAY_START);
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_STRING);
+    CHECK(token.escaped);
+    CHECK(json_reader_next(&reader, &plain) == JSON_TOKEN_STRING);
+    CHECK(!plain.escaped);
+    CHECK(json_reader_next(&reader, &escaped) == JSON_TOKEN_STRING);
+
+    // Decoding in place does not disturb tokens that follow
+    CHECK(!strcmp(json_token_string(&token), "a\"b\\c/d\n\xc3\xa9\xf0\x9f\x98\x80"));
+    CHECK(!strcmp(json_token_string(&plain), "plain"));
+
+    // Escaped strings are never equal to plain ones, they need decoding
+    CHECK(!json_token_equals(&escaped, "key"));
+    CHECK(!strcmp(json_token_string(&escaped), "key"));
+
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_ARRAY_END);
+}
+
+
+void test_skip() {
+    char document[] = "{\"x\":{\"y\":[1,{\"z\":[]},\"]}\"]},\"a\":[[]],\"b\":3}";
+
+    json_reader reader;
+    json_reader_init(&reader, document, strlen(document));
+
+    json_token token;
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_OBJECT_START);
+
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_KEY);
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_OBJECT_START);
+    CHECK(json_reader_skip(&reader, &token) == 0);
+
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_KEY);
+    CHECK(json_token_equals(&token, "a"));
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_ARRAY_START);
+    CHECK(json_reader_skip(&reader, &token) == 0);
+
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_KEY);
+    CHECK(json_token_equals(&token, "b"));
+    // Skipping scalar value is a no-op
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_NUMBER);
+    CHECK(json_reader_skip(&reader, &token) == 0);
+
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_OBJECT_END);
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_END);
+}
+
+
+void test_skip_invalid() {
+    char document[] = "{\"x\":[1,2}";
+
+    json_reader reader;
+    json_reader_init(&reader, document, strlen(document));
+
+    json_token token;
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_OBJECT_START);
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_KEY);
+    CHECK(json_reader_next(&reader, &token) == JSON_TOKEN_ARRAY_START);
+    CHECK(json_reader_skip(&reader, &token) != 0);
+}
+
+
+void test_body_without_terminator() {
+    // Reader stops at given size, data after it is not looked at
+    char document[] = "{\"a\":1}garbage";
+
+    json_reader reader;
+    json_reader_init(&reader, document, 7);
+
+    json_token token;
+    json_token_type type;
+    while ((type = json_reader_next(&reader, &token)) > 0);
+    CHECK(type == JSON_TOKEN_END);
+}
+
+
+int main() {
+    RUN_TEST(test_valid_documents);
+    RUN_TEST(test_invalid_documents);
+    RUN_TEST(test_nesting_limit);
+    RUN_TEST(test_tokens);
+    RUN_TEST(test_integer_range);
+    RUN_TEST(test_number_range);
+    RUN_TEST(test_string_decoding);
+    RUN_TEST(test_skip);
+    RUN_TEST(test_skip_invalid);
+    RUN_TEST(test_body_without_terminator);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,283 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc_count.h"
+#include "arena.h"
+#include "json.h"
+#include "port.h"
+#include "test.h"
+
+
+static char output[4096];
+static size_t output_length;
+static int flush_count;
+
+
+static void on_flush(uint8_t *buffer, size_t size, void *context) {
+    if (output_length + size < sizeof(output)) {
+        memcpy(output + output_length, buffer, size);
+        output_length += size;
+    }
+    flush_count++;
+}
+
+
+typedef void (*writer_fn)(json_stream *json);
+
+// Writes document with given buffer size, returns NUL-terminated output
+static const char *write_document(size_t buffer_size, writer_fn writer) {
+    output_length = 0;
+    flush_count = 0;
+
+    json_stream *json = json_new(buffer_size, on_flush, NULL);
+    writer(json);
+    json_flush(json);
+    json_free(json);
+
+    output[output_length] = 0;
+    return output;
+}
+
+
+static float float_value;
+
+static void write_float(json_stream *json) {
+    json_float(json, float_value);
+}
+
+static const char *format_float(float x) {
+    float_value = x;
+    return write_document(64, write_float);
+}
+
+
+static void write_scalars(json_stream *json) {
+    json_object_start(json);
+    json_string(json, "min"); json_integer(json, -9223372036854775807LL - 1);
+    json_string(json, "max"); json_integer(json, 9223372036854775807LL);
+    json_string(json, "zero"); json_integer(json, 0);
+    json_string(json, "t"); json_boolean(json, true);
+    json_string(json, "f"); json_boolean(json, false);
+    json_string(json, "n"); json_null(json);
+    json_string(json, "a");
+    json_array_start(json);
+    json_integer(json, 1);
+    json_array_start(json);
+    json_array_end(json);
+    json_object_start(json);
+    json_object_end(json);
+    json_array_end(json);
+    json_object_end(json);
+}
+
+
+void test_structure() {
+    CHECK(!strcmp(
+        write_document(1024, write_scalars),
+        "{\"min\":-9223372036854775808,\"max\":9223372036854775807,\"zero\":0,"
+        "\"t\":true,\"f\":false,\"n\":null,\"a\":[1,[],{}]}"
+    ));
+    CHECK(flush_count == 1);
+}
+
+
+static void write_strings(json_stream *json) {
+    json_array_start(json);
+    json_string(json, "plain");
+    json_string(json, "quote\" backslash\\ slash/");
+    json_string(json, "\b\f\n\r\t\x01\x1f");
+    json_string(json, "\xc3\xa9");
+    json_string(json, "");
+    json_array_end(json);
+}
+
+
+void test_string_escaping() {
+    CHECK(!strcmp(
+        write_document(1024, write_strings),
+        "[\"plain\",\"quote\\\" backslash\\\\ slash/\","
+        "\"\\b\\f\\n\\r\\t\\u0001\\u001f\",\"\xc3\xa9\",\"\"]"
+    ));
+}
+
+
+void test_floats() {
+    CHECK(!strcmp(format_float(0), "0"));
+    CHECK(!strcmp(format_float(-0.0f), "0"));
+    CHECK(!strcmp(format_float(1), "1"));
+    CHECK(!strcmp(format_float(-3.25f), "-3.25"));
+    CHECK(!strcmp(format_float(21.5f), "21.5"));
+    CHECK(!strcmp(format_float(0.1f), "0.1"));
+    CHECK(!strcmp(format_float(100), "100"));
+    CHECK(!strcmp(format_float(0.0001f), "0.0001"));
+    CHECK(!strcmp(format_float(9.9999999f), "10"));
+
+    // Large and small magnitudes use exponent
+    CHECK(!strcmp(format_float(1e20f), "1e+20"));
+    CHECK(!strcmp(format_float(-2.5e15f), "-2.5e+15"));
+    CHECK(!strcmp(format_float(1e-7f), "1e-7"));
+    CHECK(!strcmp(format_float(-3.25e-9f), "-3.25e-9"));
+    CHECK(!strcmp(format_float(1.17549435e-38f), "1.175494e-38"));
+
+    CHECK(!strcmp(format_float(0.0f / 0.0f), "null"));
+    CHECK(!strcmp(format_float(1.0f / 0.0f), "null"));
+}
+
+
+void test_float_round_trip() {
+    // Written values read back within float precision
+    float values[] = { 3.14159f, -1234.5678f, 6.02e23f, 1.6e-19f, 5e-7f, 0.000123f, 65535.0f };
+    for (int i=0; i<sizeof(values) / sizeof(*values); i++) {
+        double x = strtod(format_float(values[i]), NULL);
+        double error = (x - values[i]) / values[i];
+        if (error < 0)
+            error = -error;
+        if (error > 1e-2) {
+            printf("%g written as %s\n", values[i], output);
+            CHECK(0);
+        }
+    }
+}
+
+
+static void write_document_with_everything(json_stream *json) {
+    json_object_start(json);
+    json_string(json, "characteristics");
+    json_array_start(json);
+    for (int i=0; i<10; i++) {
+        json_object_start(json);
+        json_string(json, "aid"); json_integer(json, i + 1);
+        json_string(json, "iid"); json_integer(json, i * 100);
+        json_string(json, "value"); json_float(json, 21.5f + i);
+        json_string(json, "description"); json_string(json, "Current \"Temperature\"\n");
+        json_string(json, "ev"); json_boolean(json, i % 2);
+        json_object_end(json);
+    }
+    json_array_end(json);
+    json_object_end(json);
+}
+
+
+void test_small_buffers() {
+    char expected[sizeof(output)];
+    strcpy(expected, write_document(4096, write_document_with_everything));
+
+    // Output does not depend on buffer size, even when
+    // a single token does not fit into buffer
+    for (size_t buffer_size=1; buffer_size<64; buffer_size++) {
+        if (strcmp(write_document(buffer_size, write_document_with_everything), expected)) {
+            printf("Output differs with buffer of %zu bytes\n", buffer_size);
+            CHECK(0);
+        }
+    }
+}
+
+
+static void write_invalid(json_stream *json) {
+    json_object_start(json);
+    // Object key has to be a string
+    json_integer(json, 1);
+    json_string(json, "ignored");
+    json_object_end(json);
+}
+
+
+void test_invalid_structure() {
+    // Writer stops at first error
+    CHECK(!strcmp(write_document(1024, write_invalid), "{"));
+}
+
+
+void test_arena_stream() {
+    arena_t *arena = arena_new(256);
+
+    output_length = 0;
+    json_stream *json = json_new_in(arena, 16, on_flush, NULL);
+    CHECK(json != NULL);
+    write_scalars(json);
+    json_flush(json);
+    json_free(json);
+    output[output_length] = 0;
+
+    CHECK(!strncmp(output, "{\"min\":", 7));
+
+    arena_free(arena);
+}
+
+
+void test_allocation_failure() {
+    // Stream state
+    alloc_count_fail_after(0);
+    CHECK(json_new(64, on_flush, NULL) == NULL);
+
+    // Buffer, stream state is released
+    alloc_count_reset();
+    alloc_count_fail_after(1);
+    CHECK(json_new(64, on_flush, NULL) == NULL);
+    CHECK(alloc_stats.allocations == 1 && alloc_stats.frees == 1);
+
+    // Arena can not grow
+    alloc_count_fail_after(-1);
+    arena_t *arena = arena_new(64);
+    alloc_count_fail_after(0);
+    CHECK(json_new_in(arena, 1024, on_flush, NULL) == NULL);
+
+    alloc_count_fail_after(-1);
+    arena_free(arena);
+}
+
+
+// Allocations of a request answered with JSON: URL, request body,
+// write statuses and JSON stream all come from client arena
+static void write_request(arena_t *arena, const char *url, size_t body_size, size_t statuses_size) {
+    char *request_url = arena_alloc(arena, strlen(url) + 1);
+    strcpy(request_url, url);
+    if (body_size)
+        memset(arena_alloc(arena, body_size), ' ', body_size);
+    if (statuses_size)
+        arena_alloc(arena, statuses_size);
+
+    output_length = 0;
+    json_stream *json = json_new_in(arena, HOMEKIT_JSON_BUFFER_SIZE, on_flush, NULL);
+    write_document_with_everything(json);
+    json_flush(json);
+    json_free(json);
+}
+
+
+void test_request_fits_client_arena() {
+    arena_t *arena = arena_new(HOMEKIT_CLIENT_ARENA_SIZE);
+
+    // GET /accessories
+    alloc_count_reset();
+    write_request(arena, "/accessories", 0, 0);
+    CHECK(output_length > HOMEKIT_JSON_BUFFER_SIZE);
+    CHECK(alloc_stats.allocations == 0);
+    arena_reset(arena);
+
+    // PUT /characteristics with a write of each of two characteristics
+    // that failed, answered with 207 Multi-Status
+    alloc_count_reset();
+    write_request(arena, "/characteristics",
+                  sizeof("{\"characteristics\":[{\"aid\":1,\"iid\":9,\"value\":true},"
+                         "{\"aid\":1,\"iid\":10,\"value\":22.5}]}"),
+                  4 * 3 * sizeof(int));
+    CHECK(alloc_stats.allocations == 0);
+
+    arena_free(arena);
+}
+
+
+int main() {
+    RUN_TEST(test_structure);
+    RUN_TEST(test_string_escaping);
+    RUN_TEST(test_floats);
+    RUN_TEST(test_float_round_trip);
+    RUN_TEST(test_small_buffers);
+    RUN_TEST(test_invalid_structure);
+    RUN_TEST(test_arena_stream);
+    RUN_TEST(test_allocation_failure);
+    RUN_TEST(test_request_fits_client_arena);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,231 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "output_queue.h"
+#include "test.h"
+
+
+static int nonblocking_socketpair(int s[2]) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, s))
+        return -1;
+
+    // Small socket buffer, so that queue fills up quickly
+    int size = 4096;
+    setsockopt(s[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(s[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    fcntl(s[0], F_SETFL, fcntl(s[0], F_GETFL) | O_NONBLOCK);
+    return 0;
+}
+
+
+// Queues size bytes of pattern starting at offset, one reservation
+// of chunk_size bytes at a time. Returns number of bytes queued.
+static size_t queue_pattern(output_queue_t *queue, size_t offset, size_t size, size_t chunk_size) {
+    size_t queued = 0;
+    while (queued < size) {
+        size_t n = size - queued;
+        if (n > chunk_size)
+            n = chunk_size;
+
+        uint8_t *data = output_queue_reserve(queue, n);
+        if (!data)
+            break;
+
+        for (size_t i=0; i<n; i++)
+            data[i] = (offset + queued + i) % 251;
+        output_queue_commit(queue, n);
+        queued += n;
+    }
+    return queued;
+}
+
+
+void test_reserve_and_commit() {
+    output_queue_t queue;
+    output_queue_init(&queue, 100, 1000);
+    CHECK(queue.length == 0);
+    CHECK(output_queue_free_space(&queue) == 0);
+
+    uint8_t *a = output_queue_reserve(&queue, 60);
+    CHECK(a != NULL);
+    output_queue_commit(&queue, 60);
+    CHECK(output_queue_free_space(&queue) == 40);
+
+    // Reserved but not committed space is reused
+    uint8_t *b = output_queue_reserve(&queue, 30);
+    CHECK(b == a + 60);
+    CHECK(output_queue_reserve(&queue, 30) == b);
+
+    // Does not fit into first block
+    uint8_t *c = output_queue_reserve(&queue, 50);
+    CHECK(c != NULL);
+    CHECK(c < a || c >= a + 100);
+    output_queue_commit(&queue, 50);
+    CHECK(queue.length == 110);
+    CHECK(queue.head != queue.tail);
+
+    // Larger than block
+    CHECK(output_queue_reserve(&queue, 101) == NULL);
+
+    output_queue_clear(&queue);
+    CHECK(queue.length == 0);
+    CHECK(queue.head == NULL);
+}
+
+
+void test_max_length() {
+    output_queue_t queue;
+    output_queue_init(&queue, 100, 250);
+
+    CHECK(queue_pattern(&queue, 0, 1000, 50) == 250);
+    CHECK(queue.length == 250);
+    CHECK(output_queue_reserve(&queue, 1) == NULL);
+
+    output_queue_clear(&queue);
+}
+
+
+void test_order_across_blocks() {
+    int s[2];
+    CHECK(nonblocking_socketpair(s) == 0);
+
+    output_queue_t queue;
+    output_queue_init(&queue, 1042 * 2, 100000);
+
+    // Chunks that do not divide block size leave gaps at block ends
+    size_t total = queue_pattern(&queue, 0, 50000, 1042);
+    CHECK(total == 50000);
+
+    static uint8_t received[50000];
+    size_t received_length = 0;
+    while (received_length < total) {
+        CHECK(output_queue_write(&queue, s[0]) >= 0);
+
+        int r = read(s[1], received + received_length, sizeof(received) - received_length);
+        if (r <= 0)
+            break;
+        received_length += r;
+
+        // More data queued while earlier data is still pending
+        if (total < sizeof(received)) {
+            size_t n = sizeof(received) - total;
+            total += queue_pattern(&queue, total, n > 3000 ? 3000 : n, 700);
+        }
+    }
+
+    CHECK(received_length == total);
+    CHECK(queue.length == 0);
+
+    int mismatches = 0;
+    for (size_t i=0; i<received_length; i++) {
+        if (received[i] != i % 251)
+            mismatches++;
+    }
+    CHECK(mismatches == 0);
+
+    // Drained queue keeps only the last block
+    CHECK(queue.head == queue.tail);
+    CHECK(output_queue_free_space(&queue) == queue.block_size);
+
+    output_queue_clear(&queue);
+    close(s[0]);
+    close(s[1]);
+}
+
+
+void test_stalled_peer_does_not_block() {
+    // Peer a never reads, peer b does
+    int a[2], b[2];
+    CHECK(nonblocking_socketpair(a) == 0);
+    CHECK(nonblocking_socketpair(b) == 0);
+
+    output_queue_t queue_a, queue_b;
+    output_queue_init(&queue_a, 2048, 64 * 1024);
+    output_queue_init(&queue_b, 2048, 64 * 1024);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    size_t total_b = 0, received_b = 0;
+    bool dropped_a = false;
+    for (int round=0; round<200; round++) {
+        if (!dropped_a) {
+            if (queue_pattern(&queue_a, 0, 1000, 1000) < 1000) {
+                // Queue is full, server drops such client
+                dropped_a = true;
+                output_queue_clear(&queue_a);
+            } else {
+                CHECK(output_queue_write(&queue_a, a[0]) >= 0);
+            }
+        }
+
+        total_b += queue_pattern(&queue_b, total_b, 1000, 1000);
+        CHECK(output_queue_write(&queue_b, b[0]) >= 0);
+
+        uint8_t buffer[4096];
+        int r;
+        while ((r = recv(b[1], buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+            received_b += r;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    int elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+
+    CHECK(dropped_a);
+    // Nothing waited for stalled socket
+    CHECK(elapsed_ms < 1000);
+
+    // Socket that does not accept data is not an error
+    int written = output_queue_write(&queue_a, a[0]);
+    CHECK(written == 0);
+
+    // Reading peer got everything
+    while (queue_b.length) {
+        CHECK(output_queue_write(&queue_b, b[0]) >= 0);
+        uint8_t buffer[4096];
+        int r;
+        while ((r = recv(b[1], buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+            received_b += r;
+    }
+    CHECK(received_b == total_b);
+
+    output_queue_clear(&queue_a);
+    output_queue_clear(&queue_b);
+    close(a[0]); close(a[1]); close(b[0]); close(b[1]);
+}
+
+
+void test_write_error() {
+    int s[2];
+    CHECK(nonblocking_socketpair(s) == 0);
+    close(s[1]);
+
+    output_queue_t queue;
+    output_queue_init(&queue, 100, 1000);
+    queue_pattern(&queue, 0, 10, 10);
+
+    signal(SIGPIPE, SIG_IGN);
+    CHECK(output_queue_write(&queue, s[0]) == -1);
+    CHECK(errno == EPIPE);
+
+    output_queue_clear(&queue);
+    close(s[0]);
+}
+
+
+int main() {
+    RUN_TEST(test_reserve_and_commit);
+    RUN_TEST(test_max_length);
+    RUN_TEST(test_order_across_blocks);
+    RUN_TEST(test_stalled_peer_does_not_block);
+    RUN_TEST(test_write_error);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,188 @@
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "poller.h"
+#include "test.h"
+
+
+static int elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+
+void test_read_event() {
+    poller_t *poller = poller_new(4);
+    CHECK(poller != NULL);
+
+    int a[2], b[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, a);
+    socketpair(AF_UNIX, SOCK_STREAM, 0, b);
+
+    CHECK(poller_add(poller, a[0], POLLER_READ, &a) == 0);
+    CHECK(poller_add(poller, b[0], POLLER_READ, &b) == 0);
+
+    poller_event_t events[4];
+    CHECK(poller_wait(poller, events, 4, 10) == 0);
+
+    write(b[1], "x", 1);
+    CHECK(poller_wait(poller, events, 4, 100) == 1);
+    CHECK(events[0].data == &b);
+    CHECK(events[0].events & POLLER_READ);
+
+    close(a[0]); close(a[1]); close(b[0]); close(b[1]);
+    poller_free(poller);
+}
+
+
+void test_remove_keeps_other_sockets() {
+    poller_t *poller = poller_new(4);
+
+    int s[3][2];
+    for (int i=0; i<3; i++) {
+        socketpair(AF_UNIX, SOCK_STREAM, 0, s[i]);
+        poller_add(poller, s[i][0], POLLER_READ, s[i]);
+    }
+
+    // First entry is replaced by last one
+    CHECK(poller_remove(poller, s[0][0]) == 0);
+    CHECK(poller_remove(poller, s[0][0]) == -1);
+
+    write(s[0][1], "x", 1);
+    write(s[2][1], "x", 1);
+
+    poller_event_t events[4];
+    CHECK(poller_wait(poller, events, 4, 100) == 1);
+    CHECK(events[0].data == s[2]);
+
+    for (int i=0; i<3; i++) {
+        close(s[i][0]);
+        close(s[i][1]);
+    }
+    poller_free(poller);
+}
+
+
+void test_modify() {
+    poller_t *poller = poller_new(4);
+
+    int a[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, a);
+    poller_add(poller, a[0], POLLER_READ, NULL);
+
+    poller_event_t events[4];
+    CHECK(poller_wait(poller, events, 4, 10) == 0);
+
+    CHECK(poller_modify(poller, a[0], POLLER_READ | POLLER_WRITE, &a) == 0);
+    CHECK(poller_wait(poller, events, 4, 100) == 1);
+    CHECK(events[0].data == &a);
+    CHECK(events[0].events == POLLER_WRITE);
+
+    CHECK(poller_modify(poller, a[0], 0, &a) == 0);
+    write(a[1], "x", 1);
+    CHECK(poller_wait(poller, events, 4, 10) == 0);
+
+    close(a[0]); close(a[1]);
+    poller_free(poller);
+}
+
+
+void test_add_existing_when_full() {
+    poller_t *poller = poller_new(1);
+
+    int a[2], b[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, a);
+    socketpair(AF_UNIX, SOCK_STREAM, 0, b);
+
+    CHECK(poller_add(poller, a[0], POLLER_READ, NULL) == 0);
+#if defined(POLLER_POLL) || defined(POLLER_SELECT)
+    // lwIP backends have fixed capacity
+    CHECK(poller_add(poller, b[0], POLLER_READ, &b) == -1);
+#endif
+
+    // Registered socket only changes its events and data
+    CHECK(poller_add(poller, a[0], POLLER_READ, &a) == 0);
+    write(a[1], "x", 1);
+
+    poller_event_t events[4];
+    CHECK(poller_wait(poller, events, 4, 100) == 1);
+    CHECK(events[0].data == &a);
+
+    close(a[0]); close(a[1]); close(b[0]); close(b[1]);
+    poller_free(poller);
+}
+
+
+void test_peer_close() {
+    poller_t *poller = poller_new(4);
+
+    int a[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, a);
+    poller_add(poller, a[0], POLLER_READ, &a);
+
+    close(a[1]);
+
+    poller_event_t events[4];
+    CHECK(poller_wait(poller, events, 4, 100) == 1);
+    CHECK(events[0].events & POLLER_READ);
+
+    char c;
+    CHECK(read(a[0], &c, 1) == 0);
+
+    close(a[0]);
+    poller_free(poller);
+}
+
+
+static void *wakeup_thread(void *arg) {
+    usleep(50000);
+    poller_wakeup(arg);
+    poller_wakeup(arg);
+    return NULL;
+}
+
+
+void test_wakeup() {
+    poller_t *poller = poller_new(4);
+    CHECK(poller_can_wakeup(poller));
+
+    poller_event_t events[4];
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, wakeup_thread, poller);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(poller_wait(poller, events, 4, 2000) == 0);
+    CHECK(elapsed_ms(&start) < 1000);
+
+    pthread_join(thread, NULL);
+
+    // Repeated wakeups are coalesced
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(poller_wait(poller, events, 4, 100) == 0);
+    CHECK(elapsed_ms(&start) >= 90);
+
+    // Wakeup before wait is not lost
+    poller_wakeup(poller);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(poller_wait(poller, events, 4, 2000) == 0);
+    CHECK(elapsed_ms(&start) < 1000);
+
+    poller_free(poller);
+}
+
+
+int main() {
+    RUN_TEST(test_read_event);
+    RUN_TEST(test_remove_keeps_other_sockets);
+    RUN_TEST(test_modify);
+    RUN_TEST(test_add_existing_when_full);
+    RUN_TEST(test_peer_close);
+    RUN_TEST(test_wakeup);
+
+    return TEST_RESULT();
+}
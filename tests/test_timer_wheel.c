@@ -0,0 +1,209 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "timer_wheel.h"
+#include "test.h"
+
+
+#define TIMERS_COUNT 1000
+
+static uint32_t now;
+static uint32_t fired_at[TIMERS_COUNT];
+static int fired_count;
+
+
+static void on_timer(wheel_timer_t *timer, void *context) {
+    fired_at[(intptr_t)context] = now;
+    fired_count++;
+}
+
+
+// Advances time by next timeout until there are no timers left
+static void run_wheel(timer_wheel_t *wheel) {
+    for (;;) {
+        int timeout = timer_wheel_next_timeout(wheel, now);
+        if (timeout < 0)
+            break;
+
+        now += timeout;
+        timer_wheel_advance(wheel, now);
+    }
+}
+
+
+static void check_exact_deadlines(uint32_t base) {
+    now = base;
+    timer_wheel_t *wheel = timer_wheel_new(now);
+
+    static wheel_timer_t timers[TIMERS_COUNT];
+    static uint32_t deadlines[TIMERS_COUNT];
+
+    srand(base);
+    for (int i=0; i<TIMERS_COUNT; i++) {
+        // Deadlines on every level of wheel and beyond it
+        uint32_t delay;
+        switch (i % 4) {
+            case 0: delay = rand() % 100; break;
+            case 1: delay = rand() % 10000; break;
+            case 2: delay = rand() % 1000000; break;
+            default: delay = rand() % 30000000; break;
+        }
+
+        deadlines[i] = base + delay;
+        fired_at[i] = 0xdeadbeef;
+        wheel_timer_init(&timers[i], on_timer, (void *)(intptr_t)i);
+        timer_wheel_schedule(wheel, &timers[i], deadlines[i]);
+    }
+
+    run_wheel(wheel);
+
+    int mismatches = 0;
+    for (int i=0; i<TIMERS_COUNT; i++) {
+        if (fired_at[i] != deadlines[i])
+            mismatches++;
+    }
+    CHECK(mismatches == 0);
+
+    timer_wheel_free(wheel);
+}
+
+
+void test_exact_deadlines() {
+    check_exact_deadlines(0);
+    check_exact_deadlines(12345);
+}
+
+
+void test_time_wraparound() {
+    check_exact_deadlines(0xffff0000u);
+    check_exact_deadlines(0xfffffff0u);
+}
+
+
+void test_empty_wheel() {
+    now = 1000;
+    timer_wheel_t *wheel = timer_wheel_new(now);
+    CHECK(timer_wheel_next_timeout(wheel, now) == -1);
+    timer_wheel_free(wheel);
+}
+
+
+void test_cancel_and_reschedule() {
+    now = 0;
+    fired_count = 0;
+    timer_wheel_t *wheel = timer_wheel_new(now);
+
+    wheel_timer_t a, b;
+    wheel_timer_init(&a, on_timer, (void *)0);
+    wheel_timer_init(&b, on_timer, (void *)1);
+    CHECK(!wheel_timer_active(&a));
+
+    timer_wheel_schedule(wheel, &a, 100);
+    timer_wheel_schedule(wheel, &b, 200);
+    CHECK(wheel_timer_active(&a));
+    CHECK(timer_wheel_next_timeout(wheel, now) <= 100);
+
+    timer_wheel_cancel(wheel, &a);
+    CHECK(!wheel_timer_active(&a));
+    // Cancelling inactive timer is fine
+    timer_wheel_cancel(wheel, &a);
+
+    // Rescheduling moves timer
+    timer_wheel_schedule(wheel, &b, 5000);
+
+    run_wheel(wheel);
+    CHECK(fired_count == 1);
+    CHECK(fired_at[1] == 5000);
+    CHECK(!wheel_timer_active(&b));
+
+    timer_wheel_free(wheel);
+}
+
+
+void test_late_advance() {
+    now = 0;
+    fired_count = 0;
+    timer_wheel_t *wheel = timer_wheel_new(now);
+
+    wheel_timer_t a, b;
+    wheel_timer_init(&a, on_timer, (void *)0);
+    wheel_timer_init(&b, on_timer, (void *)1);
+    timer_wheel_schedule(wheel, &a, 5000);
+    timer_wheel_schedule(wheel, &b, 200000);
+
+    // Everything that is due fires when wheel is advanced late
+    now = 100000;
+    timer_wheel_advance(wheel, now);
+    CHECK(fired_count == 1);
+    CHECK(fired_at[0] == 100000);
+    CHECK(wheel_timer_active(&b));
+
+    // Deadline that already passed fires on next tick
+    timer_wheel_schedule(wheel, &a, now - 10);
+    CHECK(timer_wheel_next_timeout(wheel, now) == 1);
+    now++;
+    timer_wheel_advance(wheel, now);
+    CHECK(fired_count == 2);
+    CHECK(fired_at[0] == 100001);
+
+    timer_wheel_free(wheel);
+}
+
+
+static timer_wheel_t *callback_wheel;
+static wheel_timer_t *cancelled_timer;
+static int repeats;
+
+static void on_repeating_timer(wheel_timer_t *timer, void *context) {
+    fired_count++;
+    if (--repeats > 0)
+        timer_wheel_schedule(callback_wheel, timer, now + 1000);
+
+    if (cancelled_timer)
+        timer_wheel_cancel(callback_wheel, cancelled_timer);
+}
+
+
+void test_schedule_from_callback() {
+    now = 0;
+    fired_count = 0;
+    callback_wheel = timer_wheel_new(now);
+
+    wheel_timer_t repeating, other;
+    wheel_timer_init(&repeating, on_repeating_timer, NULL);
+    wheel_timer_init(&other, on_timer, (void *)0);
+
+    repeats = 5;
+    timer_wheel_schedule(callback_wheel, &repeating, 10);
+    // Cancelled by first callback, before it is due
+    timer_wheel_schedule(callback_wheel, &other, 20);
+    cancelled_timer = &other;
+
+    // Both are due, only repeating timer fires
+    now = 30;
+    timer_wheel_advance(callback_wheel, now);
+    cancelled_timer = NULL;
+
+    CHECK(fired_count == 1);
+    CHECK(!wheel_timer_active(&other));
+    CHECK(wheel_timer_active(&repeating));
+
+    run_wheel(callback_wheel);
+    CHECK(now == 4030);
+    CHECK(repeats == 0);
+    CHECK(fired_count == 5);
+
+    timer_wheel_free(callback_wheel);
+}
+
+
+int main() {
+    RUN_TEST(test_exact_deadlines);
+    RUN_TEST(test_time_wraparound);
+    RUN_TEST(test_empty_wheel);
+    RUN_TEST(test_cancel_and_reschedule);
+    RUN_TEST(test_late_advance);
+    RUN_TEST(test_schedule_from_callback);
+
+    return TEST_RESULT();
+}
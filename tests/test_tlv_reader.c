@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <homekit/tlv.h>
+
+#include "arena.h"
+#include "test.h"
+
+
+static byte message[1024];
+static size_t message_length;
+static byte key[300];
+
+
+// State, 300 byte key split into two fragments, empty separator
+// and short identifier
+static void build_message() {
+    size_t n = 0;
+    message[n++] = 6; message[n++] = 1; message[n++] = 3;
+
+    for (int i=0; i<sizeof(key); i++)
+        key[i] = i * 7;
+
+    message[n++] = 3; message[n++] = 255;
+    memcpy(message + n, key, 255);
+    n += 255;
+    message[n++] = 3; message[n++] = 45;
+    memcpy(message + n, key + 255, 45);
+    n += 45;
+
+    message[n++] = 0xff; message[n++] = 0;
+    message[n++] = 1; message[n++] = 2; message[n++] = 'a'; message[n++] = 'b';
+
+    message_length = n;
+}
+
+
+void test_index() {
+    tlv_item_t items[8];
+    tlv_reader_t reader;
+    CHECK(tlv_reader_init(&reader, message, message_length, items, 8) == 0);
+    CHECK(reader.count == 4);
+
+    CHECK(tlv_reader_get_integer(&reader, 6, -1) == 3);
+    CHECK(tlv_reader_get_integer(&reader, 9, -1) == -1);
+    // Fragmented value is not an integer
+    CHECK(tlv_reader_get_integer(&reader, 3, -1) == -1);
+
+    const tlv_item_t *item = tlv_reader_find(&reader, 3);
+    CHECK(item != NULL);
+    CHECK(item->fragmented);
+    CHECK(item->size == sizeof(key));
+
+    item = tlv_reader_find(&reader, 1);
+    CHECK(item != NULL);
+    CHECK(!item->fragmented);
+    CHECK(item->size == 2);
+    CHECK(!memcmp(message + item->offset, "ab", 2));
+
+    CHECK(tlv_reader_find(&reader, 5) == NULL);
+}
+
+
+void test_empty_buffer() {
+    tlv_item_t items[1];
+    tlv_reader_t reader;
+    CHECK(tlv_reader_init(&reader, message, 0, items, 1) == 0);
+    CHECK(reader.count == 0);
+    CHECK(tlv_reader_find(&reader, 6) == NULL);
+}
+
+
+void test_copy_fragments() {
+    tlv_item_t items[8];
+    tlv_reader_t reader;
+    tlv_reader_init(&reader, message, message_length, items, 8);
+
+    byte value[sizeof(key)];
+    tlv_reader_copy(&reader, tlv_reader_find(&reader, 3), value);
+    CHECK(!memcmp(value, key, sizeof(key)));
+}
+
+
+void test_get() {
+    tlv_item_t items[8];
+    tlv_reader_t reader;
+    tlv_reader_init(&reader, message, message_length, items, 8);
+
+    arena_t *arena = arena_new(64);
+    tlv_view_t view;
+
+    // Fragments are joined in arena
+    CHECK(tlv_reader_get(&reader, 3, &view, arena));
+    CHECK(view.size == sizeof(key));
+    CHECK(!memcmp(view.value, key, sizeof(key)));
+    CHECK(view.value < message || view.value >= message + message_length);
+
+    // Single fragment points into buffer
+    CHECK(tlv_reader_get(&reader, 1, &view, arena));
+    CHECK(view.size == 2);
+    CHECK(view.value == message + message_length - 2);
+
+    CHECK(tlv_reader_get(&reader, 0xff, &view, arena));
+    CHECK(view.size == 0);
+
+    CHECK(!tlv_reader_get(&reader, 5, &view, arena));
+
+    arena_free(arena);
+
+    // Without arena joined value is allocated with malloc
+    CHECK(tlv_reader_get(&reader, 3, &view, NULL));
+    CHECK(!memcmp(view.value, key, sizeof(key)));
+    free((void *)view.value);
+}
+
+
+void test_malformed() {
+    tlv_item_t items[8];
+    tlv_reader_t reader;
+
+    // Truncated last value
+    CHECK(tlv_reader_init(&reader, message, message_length - 1, items, 8) == -1);
+    CHECK(reader.count == 0);
+
+    // Truncated header
+    byte header[] = { 6 };
+    CHECK(tlv_reader_init(&reader, header, sizeof(header), items, 8) == -1);
+
+    // Truncated continuation fragment
+    CHECK(tlv_reader_init(&reader, message, 3 + 2 + 255 + 2 + 10, items, 8) == -1);
+
+    // Value longer than buffer
+    byte value[] = { 1, 5, 'a', 'b' };
+    CHECK(tlv_reader_init(&reader, value, sizeof(value), items, 8) == -1);
+}
+
+
+void test_max_items() {
+    tlv_item_t items[4];
+    tlv_reader_t reader;
+
+    CHECK(tlv_reader_init(&reader, message, message_length, items, 4) == 0);
+    CHECK(tlv_reader_init(&reader, message, message_length, items, 3) == -1);
+    CHECK(reader.count == 0);
+}
+
+
+void test_separate_items_of_same_type() {
+    // Short item is not continued by the next one of the same type
+    byte buffer[] = { 1, 1, 'a', 1, 1, 'b' };
+
+    tlv_item_t items[4];
+    tlv_reader_t reader;
+    CHECK(tlv_reader_init(&reader, buffer, sizeof(buffer), items, 4) == 0);
+    CHECK(reader.count == 2);
+    CHECK(!items[0].fragmented);
+    CHECK(items[0].size == 1);
+}
+
+
+void test_parse() {
+    tlv_values_t *values = tlv_new();
+    CHECK(tlv_parse(message, message_length, values) == 0);
+
+    CHECK(tlv_get_integer_value(values, 6, -1) == 3);
+
+    tlv_t *t = tlv_get_value(values, 3);
+    CHECK(t != NULL);
+    CHECK(t->size == sizeof(key));
+    CHECK(!memcmp(t->value, key, sizeof(key)));
+    CHECK(tlv_get_value(values, 0xff)->size == 0);
+
+    // Formatting parsed values gives back original message
+    size_t size = 0;
+    CHECK(tlv_format(values, NULL, &size) == -1);
+    CHECK(size == message_length);
+
+    byte buffer[sizeof(message)];
+    CHECK(tlv_format(values, buffer, &size) == 0);
+    CHECK(!memcmp(buffer, message, message_length));
+
+    tlv_free(values);
+
+    values = tlv_new();
+    CHECK(tlv_parse(message, message_length - 1, values) == -1);
+    tlv_free(values);
+}
+
+
+void test_parse_in_arena() {
+    arena_t *arena = arena_new(128);
+
+    tlv_values_t *values = tlv_new_in(arena);
+    CHECK(values != NULL);
+    CHECK(tlv_parse(message, message_length, values) == 0);
+    CHECK(!memcmp(tlv_get_value(values, 3)->value, key, sizeof(key)));
+    // Nothing to release, arena owns everything
+    tlv_free(values);
+
+    arena_free(arena);
+}
+
+
+int main() {
+    build_message();
+
+    RUN_TEST(test_index);
+    RUN_TEST(test_empty_buffer);
+    RUN_TEST(test_copy_fragments);
+    RUN_TEST(test_get);
+    RUN_TEST(test_malformed);
+    RUN_TEST(test_max_items);
+    RUN_TEST(test_separate_items_of_same_type);
+    RUN_TEST(test_parse);
+    RUN_TEST(test_parse_in_arena);
+
+    return TEST_RESULT();
+}
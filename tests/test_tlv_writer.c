@@ -0,0 +1,207 @@
+#include <string.h>
+
+#include <homekit/tlv.h>
+
+#include "test.h"
+
+
+static byte data1[1000], data2[1000];
+
+
+void test_encoded_size() {
+    CHECK(tlv_encoded_size(0) == 2);
+    CHECK(tlv_encoded_size(1) == 3);
+    CHECK(tlv_encoded_size(255) == 257);
+    CHECK(tlv_encoded_size(256) == 260);
+    CHECK(tlv_encoded_size(510) == 514);
+    CHECK(tlv_encoded_size(511) == 517);
+}
+
+
+// Writes state, nested item with two values of given sizes and
+// a separator, checks result against tlv_format() of the same items
+static int check_nested(size_t size1, size_t size2) {
+    tlv_values_t *nested = tlv_new();
+    tlv_add_value(nested, 1, data1, size1);
+    tlv_add_value(nested, 2, data2, size2);
+
+    tlv_values_t *values = tlv_new();
+    tlv_add_integer_value(values, 6, 1, 4);
+    tlv_add_tlv_value(values, 5, nested);
+    tlv_add_value(values, 0xff, NULL, 0);
+
+    static byte expected[3000];
+    size_t expected_size = sizeof(expected);
+    tlv_format(values, expected, &expected_size);
+
+    tlv_free(nested);
+    tlv_free(values);
+
+    size_t nested_size = tlv_encoded_size(size1) + tlv_encoded_size(size2);
+    if (expected_size != tlv_encoded_size(1) + tlv_encoded_size(nested_size) + tlv_encoded_size(0))
+        return -1;
+
+    static byte buffer[3000];
+    memset(buffer, 0xaa, sizeof(buffer));
+
+    // Buffer of exact size
+    tlv_writer_t writer;
+    tlv_writer_init(&writer, buffer, expected_size);
+    tlv_writer_add_integer(&writer, 6, 1, 4);
+
+    size_t mark = tlv_writer_begin(&writer, 5);
+    tlv_writer_add_value(&writer, 1, data1, size1);
+
+    size_t value_mark = tlv_writer_begin(&writer, 2);
+    byte *value = tlv_writer_reserve(&writer, size2);
+    if (!value)
+        return -1;
+    memcpy(value, data2, size2);
+    if (tlv_writer_end(&writer, value_mark))
+        return -1;
+
+    size_t size;
+    tlv_writer_value(&writer, mark, &size);
+    if (size != nested_size)
+        return -1;
+
+    if (tlv_writer_end(&writer, mark))
+        return -1;
+
+    tlv_writer_add_value(&writer, 0xff, NULL, 0);
+
+    if (writer.overflow || writer.length != expected_size)
+        return -1;
+    if (memcmp(buffer, expected, expected_size) || buffer[expected_size] != 0xaa)
+        return -1;
+
+    // One byte short
+    memset(buffer, 0xaa, sizeof(buffer));
+    tlv_writer_init(&writer, buffer, expected_size - 1);
+    tlv_writer_add_integer(&writer, 6, 1, 4);
+    mark = tlv_writer_begin(&writer, 5);
+    tlv_writer_add_value(&writer, 1, data1, size1);
+    tlv_writer_add_value(&writer, 2, data2, size2);
+    tlv_writer_end(&writer, mark);
+    tlv_writer_add_value(&writer, 0xff, NULL, 0);
+
+    if (!writer.overflow || buffer[expected_size - 1] != 0xaa)
+        return -1;
+
+    return 0;
+}
+
+
+void test_same_as_format() {
+    size_t sizes[] = { 0, 1, 200, 253, 254, 255, 256, 300, 509, 510, 511, 600 };
+    size_t count = sizeof(sizes) / sizeof(*sizes);
+
+    for (int i=0; i<count; i++) {
+        for (int j=0; j<count; j++) {
+            if (check_nested(sizes[i], sizes[j])) {
+                printf("Mismatch for values of %zu and %zu bytes\n", sizes[i], sizes[j]);
+                CHECK(0);
+            }
+        }
+    }
+}
+
+
+void test_every_size() {
+    byte expected[700], buffer[700];
+
+    for (size_t size=0; size<=600; size++) {
+        tlv_values_t *values = tlv_new();
+        tlv_add_value(values, 3, data1, size);
+        size_t expected_size = sizeof(expected);
+        tlv_format(values, expected, &expected_size);
+        tlv_free(values);
+
+        tlv_writer_t writer;
+        tlv_writer_init(&writer, buffer, sizeof(buffer));
+        tlv_writer_add_value(&writer, 3, data1, size);
+        if (writer.length != expected_size || memcmp(buffer, expected, expected_size)) {
+            printf("Value of %zu bytes differs\n", size);
+            CHECK(0);
+        }
+
+        // Same value produced in place
+        tlv_writer_init(&writer, buffer, sizeof(buffer));
+        size_t mark = tlv_writer_begin(&writer, 3);
+        memcpy(tlv_writer_reserve(&writer, size), data1, size);
+        tlv_writer_end(&writer, mark);
+        if (writer.length != expected_size || memcmp(buffer, expected, expected_size)) {
+            printf("Value of %zu bytes written in place differs\n", size);
+            CHECK(0);
+        }
+    }
+}
+
+
+void test_overflow_is_sticky() {
+    byte buffer[8];
+    tlv_writer_t writer;
+    tlv_writer_init(&writer, buffer, sizeof(buffer));
+
+    CHECK(tlv_writer_add_value(&writer, 1, data1, 10) == -1);
+    CHECK(writer.overflow);
+    CHECK(writer.length == 0);
+
+    // Small writes are dropped after overflow
+    CHECK(tlv_writer_add_integer(&writer, 6, 1, 2) == -1);
+    CHECK(tlv_writer_reserve(&writer, 1) == NULL);
+    CHECK(writer.length == 0);
+}
+
+
+void test_reserve() {
+    byte buffer[16];
+    tlv_writer_t writer;
+    tlv_writer_init(&writer, buffer, sizeof(buffer));
+
+    size_t mark = tlv_writer_begin(&writer, 1);
+    CHECK(tlv_writer_reserve(&writer, 14) == buffer + 2);
+    CHECK(tlv_writer_reserve(&writer, 1) == NULL);
+    CHECK(writer.overflow);
+    CHECK(tlv_writer_end(&writer, mark) == -1);
+}
+
+
+void test_no_room_for_fragment_headers() {
+    // Value fits, but not headers of its second fragment
+    byte buffer[2 + 300 + 1];
+    tlv_writer_t writer;
+    tlv_writer_init(&writer, buffer, sizeof(buffer));
+
+    size_t mark = tlv_writer_begin(&writer, 1);
+    CHECK(tlv_writer_reserve(&writer, 300) != NULL);
+    CHECK(tlv_writer_end(&writer, mark) == -1);
+    CHECK(writer.overflow);
+}
+
+
+void test_null_buffer() {
+    tlv_writer_t writer;
+    tlv_writer_init(&writer, NULL, 100);
+
+    CHECK(tlv_writer_add_integer(&writer, 6, 1, 2) == -1);
+    CHECK(writer.overflow);
+}
+
+
+int main() {
+    for (int i=0; i<sizeof(data1); i++) {
+        data1[i] = i * 7;
+        data2[i] = i * 13;
+    }
+
+    RUN_TEST(test_encoded_size);
+    RUN_TEST(test_same_as_format);
+    RUN_TEST(test_every_size);
+    RUN_TEST(test_overflow_is_sticky);
+    RUN_TEST(test_reserve);
+    RUN_TEST(test_no_room_for_fragment_headers);
+    RUN_TEST(test_null_buffer);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <homekit/tlv.h>
+
+#include "alloc_count.h"
+#include "arena.h"
+#include "base64.h"
+#include "debug.h"
+#include "json.h"
+#include "port.h"
+#include "test.h"
+
+
+#define WRITE_COUNT 50
+
+static char body[8192];
+static size_t body_length;
+
+
+// PUT /characteristics body with writes of every value type
+// characteristic handler parses, last one is base64 encoded TLV
+static void build_body() {
+    tlv_values_t *tlv = tlv_new();
+    tlv_add_integer_value(tlv, 1, 1, 3);
+    tlv_add_string_value(tlv, 2, "Kitchen Ceiling Light");
+    byte tlv_data[64];
+    size_t tlv_size = sizeof(tlv_data);
+    tlv_format(tlv, tlv_data, &tlv_size);
+    tlv_free(tlv);
+
+    char tlv_base64[128];
+    tlv_base64[base64_encode(tlv_data, tlv_size, (unsigned char *)tlv_base64)] = 0;
+
+    size_t n = sprintf(body, "{\"characteristics\":[");
+    for (int i=0; i<WRITE_COUNT; i++) {
+        n += sprintf(body + n, "%s{\"aid\":1,\"iid\":%d,", i ? "," : "", i + 10);
+        if (i == WRITE_COUNT - 1) {
+            n += sprintf(body + n, "\"ev\":true,\"value\":\"%s\"}", tlv_base64);
+            continue;
+        }
+        switch (i % 4) {
+            case 0: n += sprintf(body + n, "\"value\":true}"); break;
+            case 1: n += sprintf(body + n, "\"value\":%d}", i * 3); break;
+            case 2: n += sprintf(body + n, "\"value\":%d.5,\"ev\":false}", i); break;
+            case 3: n += sprintf(body + n, "\"value\":\"Scene \\u00e9 %d\"}", i); break;
+        }
+    }
+    n += sprintf(body + n, "]}");
+    body_length = n;
+}
+
+
+// Reads body the way PUT /characteristics handler does: validating
+// pass, then a pass that converts fields of every write. Returns
+// number of writes applied or -1 on error.
+static int read_update_request(char *data, size_t size, arena_t *arena) {
+    json_reader reader;
+    json_token token;
+
+    json_reader_init(&reader, data, size);
+    json_token_type r;
+    while ((r = json_reader_next(&reader, &token)) > JSON_TOKEN_END)
+        ;
+    if (r != JSON_TOKEN_END)
+        return -1;
+
+    json_reader_init(&reader, data, size);
+    json_reader_next(&reader, &token);
+    if (json_reader_next(&reader, &token) != JSON_TOKEN_KEY ||
+            !json_token_equals(&token, "characteristics") ||
+            json_reader_next(&reader, &token) != JSON_TOKEN_ARRAY_START)
+        return -1;
+
+    int count = 0;
+    while (json_reader_next(&reader, &token) == JSON_TOKEN_OBJECT_START) {
+        json_token j_aid = {0}, j_iid = {0}, j_value = {0}, j_events = {0};
+        while (json_reader_next(&reader, &token) == JSON_TOKEN_KEY) {
+            json_token *field = NULL;
+            if (json_token_equals(&token, "aid"))
+                field = &j_aid;
+            else if (json_token_equals(&token, "iid"))
+                field = &j_iid;
+            else if (json_token_equals(&token, "value"))
+                field = &j_value;
+            else if (json_token_equals(&token, "ev"))
+                field = &j_events;
+
+            json_reader_next(&reader, &token);
+            if (field)
+                *field = token;
+            json_reader_skip(&reader, &token);
+        }
+
+        long long aid, iid;
+        if (json_token_integer(&j_aid, &aid) || json_token_integer(&j_iid, &iid))
+            return -1;
+
+        DEBUG("Updating characteristic %lld.%lld", aid, iid);
+
+        long long integer;
+        double number;
+        switch (j_value.type) {
+            case JSON_TOKEN_TRUE:
+            case JSON_TOKEN_FALSE:
+                if (json_token_integer(&j_value, &integer))
+                    return -1;
+                break;
+            case JSON_TOKEN_NUMBER:
+                if (json_token_number(&j_value, &number))
+                    return -1;
+                break;
+            case JSON_TOKEN_STRING: {
+                char *value = json_token_string(&j_value);
+                size_t value_len = strlen(value);
+                if (!strncmp(value, "Scene", 5))
+                    break;
+
+                size_t tlv_size = base64_decoded_size((unsigned char *)value, value_len);
+                byte *tlv_data = arena_alloc(arena, tlv_size);
+                tlv_values_t *tlv_values = tlv_new_in(arena);
+                if (!tlv_data || !tlv_values ||
+                        base64_decode((byte *)value, value_len, tlv_data) < 0 ||
+                        tlv_parse(tlv_data, tlv_size, tlv_values))
+                    return -1;
+
+                for (tlv_t *t=tlv_values->head; t; t=t->next)
+                    print_binary("TLV value", t->value, t->size);
+                break;
+            }
+            default:
+                return -1;
+        }
+
+        if (j_events.type != JSON_TOKEN_END && json_token_integer(&j_events, &integer))
+            return -1;
+
+        count++;
+    }
+
+    return count;
+}
+
+
+static void check_update_request(homekit_log_level_t level, size_t expected_allocations) {
+    homekit_log_level = level;
+
+    char data[sizeof(body)];
+    memcpy(data, body, body_length);
+
+    arena_t *arena = arena_new(HOMEKIT_CLIENT_ARENA_SIZE);
+
+    alloc_count_reset();
+    CHECK(read_update_request(data, body_length, arena) == WRITE_COUNT);
+    printf("%d writes at log level %d: %zu mallocs\n", WRITE_COUNT, level, alloc_stats.allocations);
+    CHECK(alloc_stats.allocations == expected_allocations);
+
+    arena_free(arena);
+}
+
+
+void test_reading_does_not_allocate() {
+    // Below debug level debug output is skipped even in debug builds
+    check_update_request(HOMEKIT_LOG_INFO, 0);
+    check_update_request(HOMEKIT_LOG_NONE, 0);
+
+    homekit_log_level = HOMEKIT_LOG_INFO;
+}
+
+
+int main() {
+    build_body();
+
+    RUN_TEST(test_reading_does_not_allocate);
+
+    return TEST_RESULT();
+}
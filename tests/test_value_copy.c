@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <homekit/types.h>
+
+#include "alloc_count.h"
+#include "server.h"
+#include "test.h"
+
+
+// Platform and server functions used by accessories.c
+
+int homekit_atomic_add(volatile int *value, int delta) {
+    return __atomic_add_fetch(value, delta, __ATOMIC_ACQ_REL);
+}
+
+void homekit_server_notify_characteristic(homekit_characteristic_t *ch, homekit_value_t value) {
+}
+
+
+// Makes compact copy of value and a copy of that copy (like server
+// does for event values and reads), destructs both. Returns number
+// of allocations made by copies, checks everything was released.
+static size_t count_compact_copies(homekit_value_t *value) {
+    alloc_count_reset();
+
+    homekit_value_t copy1, copy2;
+    homekit_value_copy_compact(&copy1, value);
+    homekit_value_copy_compact(&copy2, &copy1);
+    size_t allocations = alloc_stats.allocations;
+
+    CHECK(homekit_value_equal(&copy2, value));
+
+    homekit_value_destruct(&copy1);
+    homekit_value_destruct(&copy2);
+    CHECK(alloc_stats.frees == alloc_stats.allocations);
+
+    return allocations;
+}
+
+
+void test_short_string() {
+    homekit_value_t value = HOMEKIT_STRING(strdup("Kitchen"));
+
+    // Stored inside values
+    CHECK(count_compact_copies(&value) == 0);
+
+    homekit_value_destruct(&value);
+}
+
+
+void test_long_string() {
+    homekit_value_t value = HOMEKIT_STRING(strdup("Kitchen Ceiling Light"));
+
+    // One shared buffer for both copies
+    CHECK(count_compact_copies(&value) == 1);
+
+    // Owned copy allocates every time
+    alloc_count_reset();
+    homekit_value_t copy;
+    homekit_value_copy(&copy, &value);
+    CHECK(alloc_stats.allocations == 1);
+    homekit_value_destruct(&copy);
+
+    homekit_value_destruct(&value);
+}
+
+
+void test_static_string() {
+    homekit_value_t value = HOMEKIT_STRING("Kitchen Ceiling Light", .is_static=true);
+    CHECK(count_compact_copies(&value) == 0);
+}
+
+
+void test_tlv() {
+    tlv_values_t *values = tlv_new();
+    tlv_add_integer_value(values, 1, 1, 3);
+    tlv_add_string_value(values, 2, "Kitchen Ceiling Light");
+    tlv_add_value(values, 3, NULL, 0);
+
+    homekit_value_t value = HOMEKIT_TLV(values);
+
+    // Items and their data are packed into one shared buffer
+    CHECK(count_compact_copies(&value) == 1);
+
+    alloc_count_reset();
+    homekit_value_t copy;
+    homekit_value_copy(&copy, &value);
+    size_t owned_allocations = alloc_stats.allocations;
+    homekit_value_destruct(&copy);
+    CHECK(owned_allocations > 1);
+
+    printf("TLV of 3 items: 1 allocation for compact copies, %zu for owned copy\n",
+           owned_allocations);
+
+    homekit_value_destruct(&value);
+}
+
+
+void test_data() {
+    uint8_t data[64] = { 1, 2, 3 };
+    homekit_value_t value = HOMEKIT_DATA(data, sizeof(data));
+
+    CHECK(count_compact_copies(&value) == 1);
+}
+
+
+int main() {
+    RUN_TEST(test_short_string);
+    RUN_TEST(test_long_string);
+    RUN_TEST(test_static_string);
+    RUN_TEST(test_tlv);
+    RUN_TEST(test_data);
+
+    return TEST_RESULT();
+}